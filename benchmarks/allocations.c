@@ -0,0 +1,91 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+/*
+ * Heap allocation counters: malloc(), calloc() and realloc() of the whole
+ * process, GLib included, are interposed and forwarded to glibc.
+ */
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "allocations.h"
+
+static guint64 count;
+static guint64 bytes;
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+/* No GLib call here, it may allocate */
+static void
+record (size_t size)
+{
+    __atomic_add_fetch (&count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&bytes, size, __ATOMIC_RELAXED);
+}
+
+void *
+malloc (size_t size)
+{
+    record (size);
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+        size_t size)
+{
+    record (nmemb * size);
+    return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+    record (size);
+    return __libc_realloc (ptr, size);
+}
+
+/**
+ * allocations_supported:
+ *
+ * Check if allocations are counted
+ *
+ * Returns: TRUE on glibc
+ */
+gboolean
+allocations_supported (void)
+{
+    return TRUE;
+}
+
+#else
+
+gboolean
+allocations_supported (void)
+{
+    return FALSE;
+}
+
+#endif
+
+/**
+ * allocations_get:
+ *
+ * Get allocations done since startup
+ *
+ * @param allocations: (out): count and requested bytes
+ */
+void
+allocations_get (struct Allocations *allocations)
+{
+    allocations->count = __atomic_load_n (&count, __ATOMIC_RELAXED);
+    allocations->bytes = __atomic_load_n (&bytes, __ATOMIC_RELAXED);
+}
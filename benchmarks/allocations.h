@@ -0,0 +1,22 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+struct Allocations {
+    guint64 count;
+    guint64 bytes;
+};
+
+gboolean        allocations_supported       (void);
+void            allocations_get             (struct Allocations *allocations);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <string.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "bench.h"
+
+static gint
+compare_values (gconstpointer a,
+                gconstpointer b)
+{
+    gint64 value_a = *(const gint64 *) a;
+    gint64 value_b = *(const gint64 *) b;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+/**
+ * bench_create_node:
+ *
+ * Create a file, and its parents, in fake tree
+ *
+ * @param root: fake tree root
+ * @param path: absolute path as seen by daemons
+ * @param value: file contents
+ * @param length: contents length, -1 if NUL terminated
+ */
+void
+bench_create_node (const char *root,
+                   const char *path,
+                   const char *value,
+                   gssize      length)
+{
+    g_autofree char *filename = g_build_filename (root, path, NULL);
+    g_autofree char *dirname = g_path_get_dirname (filename);
+    g_autoptr (GError) error = NULL;
+
+    g_mkdir_with_parents (dirname, 0755);
+    if (!g_file_set_contents (filename, value, length, &error))
+        g_error ("Can't create %s: %s", filename, error->message);
+}
+
+/**
+ * bench_create_process:
+ *
+ * Create a fake /proc entry
+ *
+ * @param root: fake tree root
+ * @param pid: process id, see FAKE_PID_BASE
+ * @param cmdline: process command, "--daemon" is added as argument
+ */
+void
+bench_create_process (const char *root,
+                      pid_t       pid,
+                      const char *cmdline)
+{
+    g_autofree char *filename = g_strdup_printf ("/proc/%d/cmdline", pid);
+    g_autofree char *contents = NULL;
+    gsize length;
+
+    /* Arguments are NUL separated */
+    contents = g_strconcat (cmdline, "|--daemon", NULL);
+    length = strlen (contents) + 1;
+    contents[strlen (cmdline)] = '\0';
+
+    bench_create_node (root, filename, contents, length);
+}
+
+/**
+ * bench_remove_tree:
+ *
+ * Remove fake tree
+ *
+ * @param path: directory to remove
+ */
+void
+bench_remove_tree (const char *path)
+{
+    g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+    const char *name;
+
+    if (dir != NULL) {
+        while ((name = g_dir_read_name (dir)) != NULL) {
+            g_autofree char *child = g_build_filename (path, name, NULL);
+
+            if (g_file_test (child, G_FILE_TEST_IS_DIR) &&
+                    !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+                bench_remove_tree (child);
+            else
+                g_remove (child);
+        }
+    }
+    g_rmdir (path);
+}
+
+/**
+ * bench_print_timings:
+ *
+ * Print min/median/mean/max of timings, values get sorted
+ *
+ * @param timings: values in µs
+ */
+void
+bench_print_timings (struct Timings *timings)
+{
+    GArray *values = timings->values;
+    gint64 total = 0;
+    guint i;
+
+    if (values->len == 0)
+        return;
+
+    g_array_sort (values, compare_values);
+    for (i = 0; i < values->len; i++)
+        total += g_array_index (values, gint64, i);
+
+    g_print ("%-24s min %8" G_GINT64_FORMAT " µs"
+             "  median %8" G_GINT64_FORMAT " µs"
+             "  mean %8" G_GINT64_FORMAT " µs"
+             "  max %8" G_GINT64_FORMAT " µs\n",
+             timings->name,
+             g_array_index (values, gint64, 0),
+             g_array_index (values, gint64, values->len / 2),
+             total / values->len,
+             g_array_index (values, gint64, values->len - 1));
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <glib.h>
+
+/* Above PID_MAX_LIMIT: kill() fails with ESRCH, nothing real is stopped */
+#define FAKE_PID_BASE 4194304
+
+G_BEGIN_DECLS
+
+struct Timings {
+    const char *name;
+    GArray *values; /* gint64 */
+};
+
+void            bench_create_node           (const char     *root,
+                                             const char     *path,
+                                             const char     *value,
+                                             gssize          length);
+void            bench_create_process        (const char     *root,
+                                             pid_t           pid,
+                                             const char     *cmdline);
+void            bench_remove_tree           (const char     *path);
+void            bench_print_timings         (struct Timings *timings);
+
+G_END_DECLS
+
+#endif
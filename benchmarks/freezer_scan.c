@@ -0,0 +1,336 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+/*
+ * Screen off cost of Freezer on a fake /proc, time and heap allocations:
+ * - legacy scan: /proc walk done on each screen off before proc
+ *   connector, one 128 KiB buffer per entry and g_strrstr() per pattern
+ * - rescan: update_matched(), used when proc connector is not available
+ * - indexed suspend: walk of process table fed by proc connector
+ * - event lookups: one find_process() per proc connector event
+ *
+ * Freezer internals are needed, so freezer.c is built in this unit.
+ */
+
+#include <stdlib.h>
+
+#include "../system/freezer.c"
+#include "allocations.h"
+#include "bench.h"
+
+/* One process out of FROZEN_RATIO matches freezer patterns */
+#define FROZEN_RATIO  4
+
+struct LegacyProcess {
+    pid_t pid;
+    char *cmdline;
+};
+
+/* Returns matched processes count */
+typedef guint (*ScanFunc) (Freezer *self, GList *names);
+
+struct Scan {
+    ScanFunc func;
+    struct Timings timings;
+    struct Allocations allocations;
+};
+
+static gint processes = 400;
+static gint patterns = 8;
+static gint cycles = 100;
+static gboolean keep = FALSE;
+
+static GOptionEntry entries[] = {
+    {"processes", 'p', 0, G_OPTION_ARG_INT, &processes,
+     "Number of /proc entries", "P"},
+    {"patterns", 'm', 0, G_OPTION_ARG_INT, &patterns,
+     "Number of process patterns", "M"},
+    {"cycles", 'n', 0, G_OPTION_ARG_INT, &cycles,
+     "Number of screen off", "C"},
+    {"keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+     "Do not remove generated tree", NULL},
+    {NULL}
+};
+
+static void
+legacy_process_free (gpointer user_data)
+{
+    struct LegacyProcess *process = user_data;
+
+    g_free (process->cmdline);
+    g_free (process);
+}
+
+static gboolean
+legacy_process_in_list (GList                *names,
+                        struct LegacyProcess *process)
+{
+    char *name;
+
+    if (g_strcmp0 (process->cmdline, "") == 0)
+        return FALSE;
+
+    GFOREACH (names, name) {
+        if (g_strrstr (process->cmdline, name) != NULL)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Previous get_pids(), reading /proc from root dir */
+static GList *
+legacy_get_pids (void)
+{
+    g_autofree char *proc_path = get_root_path ("/proc");
+    GList *pids = NULL;
+    g_autoptr (GDir) proc_dir = NULL;
+    const char *pid_dir;
+
+    proc_dir = g_dir_open (proc_path, 0, NULL);
+    if (proc_dir == NULL) {
+        g_warning ("%s not mounted", proc_path);
+        return NULL;
+    }
+
+    while ((pid_dir = g_dir_read_name (proc_dir)) != NULL) {
+        g_autofree char *contents = NULL;
+        g_autofree char *directory = g_build_filename (
+            proc_path, pid_dir, NULL
+        );
+
+        if ((contents = g_malloc (MAX_BUFSZ)) == NULL)
+            return NULL;
+
+        if (read_unvectored (contents,
+                             MAX_BUFSZ,
+                             AT_FDCWD,
+                             directory,
+                             "cmdline",
+                             ' ')) {
+            struct LegacyProcess *process = g_malloc (
+                sizeof (struct LegacyProcess)
+            );
+
+            process->cmdline = g_strdup (contents);
+            sscanf (pid_dir, "%d", &process->pid);
+
+            pids = g_list_prepend (pids, process);
+        }
+    }
+
+    return pids;
+}
+
+/* Previous freezer_suspend_processes() and resume, without signals */
+static guint
+legacy_scan (Freezer *self,
+             GList   *names)
+{
+    GList *pids = legacy_get_pids ();
+    struct LegacyProcess *process;
+    guint matched = 0;
+
+    GFOREACH (pids, process)
+        if (legacy_process_in_list (names, process))
+            matched++;
+
+    g_list_free_full (pids, legacy_process_free);
+
+    return matched;
+}
+
+/* freezer_suspend_processes() without proc connector, without signals */
+static guint
+rescan (Freezer *self,
+        GList   *names)
+{
+    update_matched (self);
+
+    return self->priv->matched->len;
+}
+
+/* freezer_suspend_processes() with proc connector, without signals */
+static guint
+indexed_suspend (Freezer *self,
+                 GList   *names)
+{
+    guint matched = 0;
+    guint i;
+
+    for (i = 0; i < self->priv->matched->len; i++) {
+        pid_t pid = g_array_index (self->priv->matched, struct Process, i).pid;
+
+        if (!g_hash_table_contains (self->priv->processes,
+                                    GINT_TO_POINTER (pid)))
+            matched++;
+    }
+
+    return matched;
+}
+
+/* Exec/exit events of every process, as received from proc connector */
+static guint
+event_lookups (Freezer *self,
+               GList   *names)
+{
+    guint matched = 0;
+    gint i;
+
+    for (i = 0; i < processes; i++)
+        if (find_process (self->priv->indexes, FAKE_PID_BASE + 1 + i) != -1)
+            matched++;
+
+    return matched;
+}
+
+static void
+create_tree (const char *root)
+{
+    gint i;
+
+    for (i = 0; i < processes; i++) {
+        g_autofree char *cmdline = g_strdup_printf (
+            "/usr/bin/bench-%s-%d",
+            i % FROZEN_RATIO == 0 ? "frozen" : "idle",
+            i
+        );
+
+        bench_create_process (root, FAKE_PID_BASE + 1 + i, cmdline);
+    }
+}
+
+static GList *
+get_patterns (void)
+{
+    GList *names = NULL;
+    gint i;
+
+    /* Only last pattern matches: worst case for g_strrstr() loop */
+    names = g_list_prepend (names, g_strdup ("bench-frozen"));
+    for (i = 1; i < patterns; i++)
+        names = g_list_prepend (
+            names, g_strdup_printf ("bench-pattern-%d", i)
+        );
+
+    return names;
+}
+
+static void
+run_scan (struct Scan *scan,
+          Freezer     *freezer,
+          GList       *names,
+          guint        expected)
+{
+    struct Allocations before;
+    struct Allocations after;
+    gint64 start;
+    gint64 value;
+    guint matched;
+
+    allocations_get (&before);
+    start = g_get_monotonic_time ();
+    matched = scan->func (freezer, names);
+    value = g_get_monotonic_time () - start;
+    allocations_get (&after);
+
+    g_array_append_val (scan->timings.values, value);
+    scan->allocations.count += after.count - before.count;
+    scan->allocations.bytes += after.bytes - before.bytes;
+
+    if (matched != expected)
+        g_error ("%s: %u processes matched, %u expected",
+                 scan->timings.name, matched, expected);
+}
+
+static void
+print_allocations (struct Scan *scan)
+{
+    guint runs = scan->timings.values->len;
+
+    if (runs == 0)
+        return;
+
+    g_print ("%-24s %8" G_GUINT64_FORMAT " allocations"
+             "  %10" G_GUINT64_FORMAT " bytes per screen off\n",
+             scan->timings.name,
+             scan->allocations.count / runs,
+             scan->allocations.bytes / runs);
+}
+
+gint
+main (gint argc, char * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autofree char *root = NULL;
+    struct Scan scans[] = {
+        {legacy_scan, {"legacy scan", NULL}, {0, 0}},
+        {rescan, {"rescan", NULL}, {0, 0}},
+        {indexed_suspend, {"indexed suspend", NULL}, {0, 0}},
+        {event_lookups, {"event lookups", NULL}, {0, 0}},
+    };
+    Freezer *freezer;
+    GList *names;
+    guint expected;
+    guint i;
+    gint cycle;
+
+    context = g_option_context_new ("- Mobile Power Saver freezer scan");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    root = g_dir_make_tmp ("mps-benchmark-XXXXXX", &error);
+    if (root == NULL) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    create_tree (root);
+    set_root_dir (root);
+    g_print ("Tree %s: %d processes, %d patterns\n",
+             root, processes, patterns);
+
+    /* Patterns set on matcher directly: no proc connector, nothing
+     * else than this benchmark updates process table
+     */
+    names = get_patterns ();
+    freezer = FREEZER (freezer_new ());
+    matcher_set_patterns (freezer->priv->names, names);
+    update_matched (freezer);
+    expected = (processes + FROZEN_RATIO - 1) / FROZEN_RATIO;
+
+    for (i = 0; i < G_N_ELEMENTS (scans); i++)
+        scans[i].timings.values = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+    for (cycle = 0; cycle < cycles; cycle++)
+        for (i = 0; i < G_N_ELEMENTS (scans); i++)
+            run_scan (&scans[i], freezer, names, expected);
+
+    for (i = 0; i < G_N_ELEMENTS (scans); i++)
+        bench_print_timings (&scans[i].timings);
+
+    if (allocations_supported ()) {
+        for (i = 0; i < G_N_ELEMENTS (scans); i++)
+            print_allocations (&scans[i]);
+    } else {
+        g_print ("Allocations not counted: needs glibc\n");
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (scans); i++)
+        g_array_unref (scans[i].timings.values);
+
+    g_list_free_full (names, g_free);
+    g_clear_object (&freezer);
+
+    if (keep)
+        g_print ("Tree kept in %s\n", root);
+    else
+        bench_remove_tree (root);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,456 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+/*
+ * Matcher against previous g_strrstr() loops, for each call site:
+ * - processes: freezer process_in_list(), per /proc entry
+ * - apps: settings_can_freeze_app(), per app scope, blacklist variant
+ *   parsed on each call (g_settings_get_value() itself not included)
+ * - players: mpris_can_freeze(), per app scope
+ */
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "../common/matcher.h"
+#include "../common/utils.h"
+#include "bench.h"
+
+struct Data {
+    GList *cmdlines;
+    GList *names;
+    Matcher *names_matcher;
+    GList *scopes;
+    GVariant *blacklist;
+    Matcher *blacklist_matcher;
+    GList *desktop_ids;
+    Matcher *desktop_ids_matcher;
+};
+
+/* Returns matched strings count */
+typedef guint (*MatchFunc) (struct Data *data);
+
+struct Match {
+    MatchFunc func;
+    struct Timings timings;
+    guint matched;
+};
+
+static const char * const commands[] = {
+    "/usr/lib/systemd/systemd --user",
+    "/usr/bin/dbus-daemon --session --address=systemd: --nofork",
+    "/usr/bin/pipewire",
+    "/usr/bin/pipewire-pulse",
+    "/usr/bin/wireplumber",
+    "/usr/libexec/phosh",
+    "/usr/bin/phoc -E /usr/libexec/phosh",
+    "/usr/libexec/feedbackd",
+    "/usr/libexec/evolution-source-registry",
+    "/usr/libexec/evolution-calendar-factory",
+    "/usr/libexec/evolution-addressbook-factory",
+    "/usr/libexec/tracker-miner-fs-3",
+    "/usr/libexec/goa-daemon",
+    "/usr/libexec/goa-identity-service",
+    "/usr/libexec/gsd-color",
+    "/usr/libexec/gsd-housekeeping",
+    "/usr/libexec/gsd-media-keys",
+    "/usr/libexec/gsd-power",
+    "/usr/libexec/gvfsd",
+    "/usr/libexec/gvfsd-metadata",
+    "/usr/libexec/xdg-desktop-portal",
+    "/usr/libexec/xdg-desktop-portal-gtk",
+    "/usr/libexec/geoclue",
+    "/usr/bin/gnome-calls --daemon",
+    "/usr/bin/chatty --daemon",
+    "/usr/sbin/ModemManager",
+    "/usr/sbin/NetworkManager --no-daemon",
+    "/usr/sbin/wpa_supplicant -u -s -O /run/wpa_supplicant",
+    "/usr/lib/firefox-esr/firefox-esr -contentproc -childID",
+    "/usr/bin/gnome-software --gapplication-service",
+    "[kworker/u16:2-events_unbound]",
+    "[irq/123-qcom-smp2p]",
+    NULL
+};
+
+/* As in screen-off-suspend-processes */
+static const char * const process_patterns[] = {
+    "evolution-",
+    "tracker-miner",
+    "goa-daemon",
+    "goa-identity",
+    "gsd-color",
+    "gsd-housekeeping",
+    "gvfsd-metadata",
+    "geoclue",
+    "gnome-software",
+    "packagekitd",
+    "epiphany",
+    "zeitgeist",
+    "telegram-desktop",
+    "signal-desktop",
+    "nextcloud",
+    "syncthing",
+    "kdeconnectd",
+    "gnome-weather",
+    "flatpak-session-helper",
+    "gnome-contacts --gapplication-service",
+    NULL
+};
+
+static const char * const desktop_ids[] = {
+    "org.gnome.Calls",
+    "sm.puri.Chatty",
+    "org.gnome.clocks",
+    "org.kop316.antispam",
+    "org.gnome.Maps",
+    "org.gnome.Weather",
+    "org.gnome.Contacts",
+    "org.gnome.Epiphany",
+    "firefox-esr",
+    "org.gnome.Lollypop",
+    "org.gnome.Podcasts",
+    "de.schmidhuberj.Flare",
+    "org.gnome.Calendar",
+    "org.gnome.Software",
+    "org.gnome.Settings",
+    "org.gnome.Console",
+    NULL
+};
+
+/* screen-off-suspend-apps-blacklist default, then user additions */
+static const char * const blacklist[] = {
+    "org.gnome.Calls",
+    "sm.puri.Chatty",
+    "org.gnome.clocks",
+    "org.kop316.antispam",
+    "org.gnome.Lollypop",
+    "org.gnome.Podcasts",
+    "de.schmidhuberj.Flare",
+    "org.gnome.Maps",
+    NULL
+};
+
+/* MPRIS players */
+static const char * const players[] = {
+    "org.gnome.Lollypop",
+    "org.gnome.Podcasts",
+    "firefox-esr",
+    NULL
+};
+
+static gint processes = 400;
+static gint patterns = 20;
+static gint apps = 50;
+static gint blacklisted = 8;
+static gint cycles = 1000;
+
+static GOptionEntry entries[] = {
+    {"processes", 'p', 0, G_OPTION_ARG_INT, &processes,
+     "Number of process cmdlines", "P"},
+    {"patterns", 'm', 0, G_OPTION_ARG_INT, &patterns,
+     "Number of process patterns", "M"},
+    {"apps", 'a', 0, G_OPTION_ARG_INT, &apps,
+     "Number of app scopes", "A"},
+    {"blacklist", 'b', 0, G_OPTION_ARG_INT, &blacklisted,
+     "Number of blacklisted apps", "B"},
+    {"cycles", 'n', 0, G_OPTION_ARG_INT, &cycles,
+     "Number of runs", "C"},
+    {NULL}
+};
+
+/* First count values from table, then generated ones never matching */
+static GList *
+get_list (const char * const *table,
+          gint                count)
+{
+    GList *list = NULL;
+    gint i;
+
+    for (i = 0; i < count; i++) {
+        if (table[i] == NULL)
+            break;
+        list = g_list_append (list, g_strdup (table[i]));
+    }
+    for (; i < count; i++)
+        list = g_list_append (list, g_strdup_printf ("bench-pattern-%d", i));
+
+    return list;
+}
+
+static GList *
+get_cmdlines (void)
+{
+    guint length = G_N_ELEMENTS (commands) - 1;
+    GList *cmdlines = NULL;
+    gint i;
+
+    for (i = 0; i < processes; i++)
+        cmdlines = g_list_prepend (
+            cmdlines,
+            g_strdup_printf ("%s --instance=%d", commands[i % length], i)
+        );
+
+    return cmdlines;
+}
+
+static GList *
+get_scopes (void)
+{
+    guint length = G_N_ELEMENTS (desktop_ids) - 1;
+    GList *scopes = NULL;
+    gint i;
+
+    for (i = 0; i < apps; i++)
+        scopes = g_list_prepend (
+            scopes,
+            g_strdup_printf (
+                "app-gnome-%s-%d.scope", desktop_ids[i % length], 1000 + i
+            )
+        );
+
+    return scopes;
+}
+
+static GVariant *
+get_blacklist_variant (GList *list)
+{
+    g_autoptr (GVariantBuilder) builder = g_variant_builder_new (
+        G_VARIANT_TYPE ("as")
+    );
+    const char *application;
+
+    GFOREACH (list, application)
+        g_variant_builder_add (builder, "s", application);
+
+    return g_variant_ref_sink (g_variant_builder_end (builder));
+}
+
+static Matcher *
+get_matcher (GList *list)
+{
+    Matcher *matcher = MATCHER (matcher_new ());
+
+    matcher_set_patterns (matcher, list);
+
+    return matcher;
+}
+
+static guint
+match_all (Matcher *matcher,
+           GList   *strings)
+{
+    const char *string;
+    guint matched = 0;
+
+    GFOREACH (strings, string)
+        if (matcher_match (matcher, string))
+            matched++;
+
+    return matched;
+}
+
+static guint
+lookup_all (Matcher *matcher,
+            GList   *strings)
+{
+    const char *string;
+    guint matched = 0;
+
+    GFOREACH (strings, string)
+        if (matcher_lookup (matcher, string) != -1)
+            matched++;
+
+    return matched;
+}
+
+/* Previous process_in_list() */
+static guint
+legacy_processes (struct Data *data)
+{
+    const char *cmdline;
+    guint matched = 0;
+
+    GFOREACH (data->cmdlines, cmdline) {
+        const char *name;
+
+        GFOREACH_SUB (data->names, name) {
+            if (g_strrstr (cmdline, name) != NULL) {
+                matched++;
+                break;
+            }
+        }
+    }
+
+    return matched;
+}
+
+static guint
+matcher_processes (struct Data *data)
+{
+    return match_all (data->names_matcher, data->cmdlines);
+}
+
+/* Previous settings_can_freeze_app() */
+static guint
+legacy_apps (struct Data *data)
+{
+    const char *app_scope;
+    guint matched = 0;
+
+    GFOREACH (data->scopes, app_scope) {
+        g_autoptr (GVariant) value = g_variant_ref (data->blacklist);
+        g_autoptr (GVariantIter) iter = NULL;
+        char *application;
+
+        g_variant_get (value, "as", &iter);
+        while (g_variant_iter_loop (iter, "s", &application)) {
+            if (g_strrstr (app_scope, application) != NULL) {
+                matched++;
+                g_free (application);
+                break;
+            }
+        }
+    }
+
+    return matched;
+}
+
+static guint
+matcher_apps (struct Data *data)
+{
+    return match_all (data->blacklist_matcher, data->scopes);
+}
+
+/* Previous mpris_can_freeze() */
+static guint
+legacy_players (struct Data *data)
+{
+    const char *app_scope;
+    guint matched = 0;
+
+    GFOREACH (data->scopes, app_scope) {
+        const char *desktop_id;
+
+        GFOREACH_SUB (data->desktop_ids, desktop_id) {
+            if (g_strrstr (app_scope, desktop_id) != NULL) {
+                matched++;
+                break;
+            }
+        }
+    }
+
+    return matched;
+}
+
+static guint
+matcher_players (struct Data *data)
+{
+    return lookup_all (data->desktop_ids_matcher, data->scopes);
+}
+
+static void
+run_match (struct Match *match,
+           struct Data  *data)
+{
+    gint64 start = g_get_monotonic_time ();
+    gint64 value;
+
+    match->matched = match->func (data);
+    value = g_get_monotonic_time () - start;
+    g_array_append_val (match->timings.values, value);
+}
+
+static void
+print_compile (const char *name,
+               GList      *list)
+{
+    Matcher *matcher = MATCHER (matcher_new ());
+    gint64 start = g_get_monotonic_time ();
+
+    matcher_set_patterns (matcher, list);
+    g_object_unref (matcher);
+    g_print ("%-24s %8" G_GINT64_FORMAT " µs, %u patterns\n",
+             name,
+             g_get_monotonic_time () - start,
+             g_list_length (list));
+}
+
+gint
+main (gint argc, char * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    struct Match matches[] = {
+        {legacy_processes, {"processes g_strrstr", NULL}, 0},
+        {matcher_processes, {"processes matcher", NULL}, 0},
+        {legacy_apps, {"apps g_strrstr", NULL}, 0},
+        {matcher_apps, {"apps matcher", NULL}, 0},
+        {legacy_players, {"players g_strrstr", NULL}, 0},
+        {matcher_players, {"players matcher", NULL}, 0},
+    };
+    struct Data data;
+    GList *blacklist_list;
+    guint i;
+    gint cycle;
+
+    context = g_option_context_new ("- Mobile Power Saver matcher");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    data.cmdlines = get_cmdlines ();
+    data.names = get_list (process_patterns, patterns);
+    data.names_matcher = get_matcher (data.names);
+    data.scopes = get_scopes ();
+    data.desktop_ids = get_list (players, G_N_ELEMENTS (players) - 1);
+    data.desktop_ids_matcher = get_matcher (data.desktop_ids);
+    blacklist_list = get_list (blacklist, blacklisted);
+    data.blacklist = get_blacklist_variant (blacklist_list);
+    data.blacklist_matcher = get_matcher (blacklist_list);
+    g_list_free_full (blacklist_list, g_free);
+
+    g_print ("%d processes, %d patterns, %d apps, %d blacklisted\n",
+             processes, patterns, apps, blacklisted);
+    print_compile ("processes compile", data.names);
+    print_compile ("players compile", data.desktop_ids);
+
+    for (i = 0; i < G_N_ELEMENTS (matches); i++)
+        matches[i].timings.values = g_array_new (
+            FALSE, FALSE, sizeof (gint64)
+        );
+
+    for (cycle = 0; cycle < cycles; cycle++) {
+        for (i = 0; i < G_N_ELEMENTS (matches); i++)
+            run_match (&matches[i], &data);
+
+        /* Previous and matcher paths come by pair */
+        for (i = 0; i < G_N_ELEMENTS (matches); i += 2)
+            if (matches[i].matched != matches[i + 1].matched)
+                g_error ("%s: %u matched, %s: %u matched",
+                         matches[i].timings.name,
+                         matches[i].matched,
+                         matches[i + 1].timings.name,
+                         matches[i + 1].matched);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (matches); i++) {
+        bench_print_timings (&matches[i].timings);
+        g_array_unref (matches[i].timings.values);
+    }
+
+    g_list_free_full (data.cmdlines, g_free);
+    g_list_free_full (data.names, g_free);
+    g_list_free_full (data.scopes, g_free);
+    g_list_free_full (data.desktop_ids, g_free);
+    g_variant_unref (data.blacklist);
+    g_clear_object (&data.names_matcher);
+    g_clear_object (&data.blacklist_matcher);
+    g_clear_object (&data.desktop_ids_matcher);
+
+    return EXIT_SUCCESS;
+}
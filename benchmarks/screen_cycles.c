@@ -0,0 +1,445 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../common/cgroup.h"
+#include "../common/define.h"
+#include "../common/services.h"
+#include "../common/transition.h"
+#include "../common/utils.h"
+#include "../system/cpufreq.h"
+#include "../system/devfreq.h"
+#include "../system/freezer.h"
+#include "../system/kernel_settings.h"
+#include "bench.h"
+
+/* One process out of FROZEN_RATIO matches freezer patterns */
+#define FROZEN_RATIO  4
+
+/* Milliseconds, as user manager and dozing */
+#define FREEZE_TIMEOUT 2000
+
+/* Regular files can't notify changes: report cgroups as frozen, so
+ * cgroup_freeze_async() is done after one cgroup.events read
+ */
+#define CGROUP_EVENTS "populated 1\nfrozen 1\n"
+
+/* Nodes written by kernel_settings_set_powersave() */
+static const char *kernel_nodes[] = {
+    "/sys/fs/cgroup/schedtune/schedtune.boost",
+    "/sys/fs/cgroup/schedtune/schedtune.prefer_idle",
+    "/proc/sys/kernel/sched_boost",
+    "/proc/sys/kernel/sched_walt_rotate_big_tasks",
+    "/proc/sys/vm/swappiness",
+    "/proc/sys/vm/dirty_background_ratio",
+    "/proc/sys/vm/dirty_ratio",
+    "/proc/sys/vm/dirty_writeback_centisecs",
+    "/proc/sys/vm/dirty_expire_centisecs",
+    "/proc/sys/vm/laptop_mode",
+    "/sys/module/lpm_levels/parameters/lpm_prediction",
+    NULL
+};
+
+struct System {
+    Cpufreq *cpufreq;
+    Devfreq *devfreq;
+    KernelSettings *kernel_settings;
+    Freezer *freezer;
+    Services *services;
+    Transition *transition;
+    GList *suspend_services;
+};
+
+struct User {
+    Services *services;
+    GList *suspend_services;
+};
+
+static GMainLoop *loop;
+static gint64 interactive_time;
+static guint pending_freezes;
+
+static gint policies = 8;
+static gint devfreqs = 4;
+static gint scopes = 32;
+static gint processes = 512;
+static gint cycles = 100;
+static gboolean keep = FALSE;
+
+static GOptionEntry entries[] = {
+    {"policies", 'c', 0, G_OPTION_ARG_INT, &policies,
+     "Number of cpufreq policies", "N"},
+    {"devfreq", 'd', 0, G_OPTION_ARG_INT, &devfreqs,
+     "Number of devfreq devices", "M"},
+    {"scopes", 's', 0, G_OPTION_ARG_INT, &scopes,
+     "Number of app scopes and services", "K"},
+    {"processes", 'p', 0, G_OPTION_ARG_INT, &processes,
+     "Number of /proc entries", "P"},
+    {"cycles", 'n', 0, G_OPTION_ARG_INT, &cycles,
+     "Number of screen off/on cycles", "C"},
+    {"keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+     "Do not remove generated tree", NULL},
+    {NULL}
+};
+
+static void
+create_proc_entry (const char *root,
+                   gint        index)
+{
+    g_autofree char *cmdline = g_strdup_printf (
+        "/usr/bin/bench-%s-%d",
+        index % FROZEN_RATIO == 0 ? "frozen" : "idle",
+        index
+    );
+
+    bench_create_process (root, FAKE_PID_BASE + 1 + index, cmdline);
+}
+
+static void
+create_cgroup (const char *root,
+               const char *cgroup)
+{
+    g_autofree char *freeze = g_build_filename (cgroup, "cgroup.freeze", NULL);
+    g_autofree char *events = g_build_filename (cgroup, "cgroup.events", NULL);
+
+    bench_create_node (root, freeze, "0\n", -1);
+    bench_create_node (root, events, CGROUP_EVENTS, -1);
+}
+
+static void
+create_tree (const char *root)
+{
+    g_autofree char *apps_dir = g_strdup_printf (
+        CGROUPS_APPS_FREEZE_DIR, getuid (), getuid ()
+    );
+    g_autofree char *user_services_dir = g_strdup_printf (
+        CGROUPS_USER_SERVICES_FREEZE_DIR, getuid (), getuid ()
+    );
+    gint i;
+
+    for (i = 0; i < policies; i++) {
+        g_autofree char *filename = g_strdup_printf (
+            CPUFREQ_POLICIES_DIR "policy%d/scaling_governor", i
+        );
+        bench_create_node (root, filename, "schedutil\n", -1);
+    }
+
+    for (i = 0; i < devfreqs; i++) {
+        g_autofree char *filename = g_strdup_printf (
+            DEVFREQ_DIR "bench%d.devfreq/governor", i
+        );
+        bench_create_node (root, filename, "simple_ondemand\n", -1);
+    }
+
+    for (i = 0; kernel_nodes[i] != NULL; i++)
+        bench_create_node (root, kernel_nodes[i], "0\n", -1);
+
+    for (i = 0; i < scopes; i++) {
+        g_autofree char *app = g_strdup_printf (
+            "%s/app-bench-%d.scope", apps_dir, i
+        );
+        g_autofree char *system_service = g_strdup_printf (
+            CGROUPS_SYSTEM_SERVICES_FREEZE_DIR "/bench-%d.service", i
+        );
+        g_autofree char *user_service = g_strdup_printf (
+            "%s/bench-%d.service", user_services_dir, i
+        );
+
+        create_cgroup (root, app);
+        create_cgroup (root, system_service);
+        create_cgroup (root, user_service);
+    }
+
+    for (i = 0; i < processes; i++)
+        create_proc_entry (root, i);
+}
+
+static GList *
+get_services (void)
+{
+    GList *services = NULL;
+    gint i;
+
+    for (i = 0; i < scopes; i++)
+        services = g_list_prepend (
+            services, g_strdup_printf ("bench-%d.service", i)
+        );
+
+    return services;
+}
+
+/* App scopes, as found by dozing */
+static GList *
+get_apps (void)
+{
+    g_autofree char *dirname = g_strdup_printf (
+        CGROUPS_APPS_FREEZE_DIR, getuid (), getuid ()
+    );
+    g_autofree char *path = get_root_path (dirname);
+    g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+    const char *app_dir;
+    GList *apps = NULL;
+
+    if (dir == NULL)
+        return NULL;
+
+    while ((app_dir = g_dir_read_name (dir)) != NULL) {
+        if (g_str_has_prefix (app_dir, "app-") &&
+                g_str_has_suffix (app_dir, ".scope"))
+            apps = g_list_prepend (
+                apps, g_build_filename (dirname, app_dir, NULL)
+            );
+    }
+
+    return apps;
+}
+
+static void
+on_interactive (gpointer user_data)
+{
+    interactive_time = g_get_monotonic_time ();
+}
+
+static void
+on_plan_done (gpointer user_data)
+{
+    g_main_loop_quit (loop);
+}
+
+/* Mirrors system manager screen handlers, without D-Bus */
+static void
+system_screen_off (struct System *system)
+{
+    TransitionPlan *plan = transition_plan_new ("Screen off", TRUE);
+
+    cpufreq_set_powersave (system->cpufreq, TRUE, FALSE, plan);
+    devfreq_set_powersave (system->devfreq, TRUE, FALSE, plan);
+    kernel_settings_set_powersave (system->kernel_settings, TRUE, plan);
+    services_freeze (system->services, system->suspend_services, plan);
+    transition_plan_notify (plan, on_plan_done, NULL);
+
+    transition_run (system->transition, plan);
+    freezer_suspend_processes (system->freezer);
+
+    g_main_loop_run (loop);
+}
+
+static void
+system_screen_on (struct System *system)
+{
+    TransitionPlan *plan = transition_plan_new ("Screen on", TRUE);
+
+    cpufreq_set_powersave (system->cpufreq, FALSE, TRUE, plan);
+    transition_plan_notify (plan, on_interactive, NULL);
+
+    transition_plan_next_step (plan, TRUE);
+    devfreq_set_powersave (system->devfreq, FALSE, FALSE, plan);
+    kernel_settings_set_powersave (system->kernel_settings, FALSE, plan);
+    services_unfreeze (system->services, system->suspend_services, plan);
+    transition_plan_notify (plan, on_plan_done, NULL);
+
+    transition_run (system->transition, plan);
+    freezer_resume_processes (system->freezer);
+
+    g_main_loop_run (loop);
+}
+
+static void
+freeze_done (GError *error)
+{
+    if (error != NULL)
+        g_warning ("Not frozen: %s", error->message);
+
+    pending_freezes--;
+    if (pending_freezes == 0)
+        g_main_loop_quit (loop);
+}
+
+static void
+on_services_frozen (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    services_freeze_finish (res, &error);
+    freeze_done (error);
+}
+
+static void
+on_apps_frozen (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    cgroup_freeze_finish (res, &error);
+    freeze_done (error);
+}
+
+/* Mirrors user manager and dozing screen handlers, without D-Bus:
+ * services and apps wait for kernel confirmation
+ */
+static void
+user_screen_off (struct User *user,
+                 GList       *apps)
+{
+    pending_freezes = 2;
+
+    services_freeze_async (user->services,
+                           user->suspend_services,
+                           FREEZE_TIMEOUT,
+                           NULL,
+                           on_services_frozen,
+                           NULL);
+    cgroup_freeze_async (
+        apps, TRUE, FREEZE_TIMEOUT, NULL, on_apps_frozen, NULL
+    );
+
+    g_main_loop_run (loop);
+}
+
+/* Like dozing_stop(), apps are thawed without waiting */
+static void
+user_screen_on (struct User *user,
+                GList       *apps)
+{
+    const char *app;
+
+    GFOREACH (apps, app) {
+        g_autofree char *freeze = g_build_filename (
+            app, "cgroup.freeze", NULL
+        );
+
+        write_to_file (freeze, "0");
+    }
+    services_unfreeze (user->services, user->suspend_services, NULL);
+}
+
+gint
+main (gint argc, char * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autofree char *root = NULL;
+    struct System system;
+    struct User user;
+    struct Timings timings[] = {
+        {"system screen off", NULL},
+        {"system screen on", NULL},
+        {"system interactive", NULL},
+        {"user screen off", NULL},
+        {"user screen on", NULL},
+    };
+    GList *patterns = NULL;
+    GList *apps = NULL;
+    gint64 start;
+    guint i;
+    gint cycle;
+
+    context = g_option_context_new ("- Mobile Power Saver screen cycles");
+    g_option_context_add_main_entries (context, entries, NULL);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    root = g_dir_make_tmp ("mps-benchmark-XXXXXX", &error);
+    if (root == NULL) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    start = g_get_monotonic_time ();
+    create_tree (root);
+    g_print ("Tree %s: %d policies, %d devfreq, %d scopes, %d processes"
+             " (%" G_GINT64_FORMAT " µs)\n",
+             root, policies, devfreqs, scopes, processes,
+             g_get_monotonic_time () - start);
+
+    set_root_dir (root);
+    loop = g_main_loop_new (NULL, FALSE);
+
+    start = g_get_monotonic_time ();
+    system.cpufreq = CPUFREQ (cpufreq_new ());
+    system.devfreq = DEVFREQ (devfreq_new ());
+    system.kernel_settings = KERNEL_SETTINGS (kernel_settings_new ());
+    system.freezer = FREEZER (freezer_new ());
+    system.services = SERVICES (services_new (G_BUS_TYPE_SYSTEM));
+    system.transition = TRANSITION (transition_new ());
+    system.suspend_services = get_services ();
+    user.services = SERVICES (services_new (G_BUS_TYPE_SESSION));
+    user.suspend_services = get_services ();
+    g_print ("Startup: %" G_GINT64_FORMAT " µs\n",
+             g_get_monotonic_time () - start);
+
+    patterns = g_list_append (patterns, g_strdup ("bench-frozen"));
+    freezer_set_processes (system.freezer, patterns);
+    apps = get_apps ();
+
+    /* Proc connector needs CAP_NET_ADMIN */
+    g_print ("Freezer: %s\n",
+             freezer_is_event_driven (system.freezer) ?
+                "proc connector" : "/proc rescan on each screen off");
+
+    for (i = 0; i < G_N_ELEMENTS (timings); i++)
+        timings[i].values = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+    for (cycle = 0; cycle < cycles; cycle++) {
+        gint64 value;
+
+        start = g_get_monotonic_time ();
+        system_screen_off (&system);
+        value = g_get_monotonic_time () - start;
+        g_array_append_val (timings[0].values, value);
+
+        start = g_get_monotonic_time ();
+        user_screen_off (&user, apps);
+        value = g_get_monotonic_time () - start;
+        g_array_append_val (timings[3].values, value);
+
+        start = g_get_monotonic_time ();
+        system_screen_on (&system);
+        value = g_get_monotonic_time () - start;
+        g_array_append_val (timings[1].values, value);
+        value = interactive_time - start;
+        g_array_append_val (timings[2].values, value);
+
+        start = g_get_monotonic_time ();
+        user_screen_on (&user, apps);
+        value = g_get_monotonic_time () - start;
+        g_array_append_val (timings[4].values, value);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (timings); i++) {
+        bench_print_timings (&timings[i]);
+        g_array_unref (timings[i].values);
+    }
+
+    g_list_free_full (patterns, g_free);
+    g_list_free_full (apps, g_free);
+    g_list_free_full (system.suspend_services, g_free);
+    g_list_free_full (user.suspend_services, g_free);
+    g_clear_object (&system.cpufreq);
+    g_clear_object (&system.devfreq);
+    g_clear_object (&system.kernel_settings);
+    g_clear_object (&system.freezer);
+    g_clear_object (&system.services);
+    g_clear_object (&system.transition);
+    g_clear_object (&user.services);
+    g_clear_pointer (&loop, g_main_loop_unref);
+
+    if (keep)
+        g_print ("Tree kept in %s\n", root);
+    else
+        bench_remove_tree (root);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include "cgroup.h"
+#include "trace.h"
+#include "utils.h"
+
+/* Slower scopes are logged */
+#define SLOW_FREEZE 100000
+
+struct Wait;
+
+struct Watch {
+    char *cgroup;
+    gint fd;
+    guint source_id;
+    gint64 start;
+    struct Wait *wait;
+};
+
+struct Wait {
+    GTask *task;
+    GPtrArray *watches; /* struct Watch */
+    gboolean freeze;
+    guint pending;
+    guint timeout_id;
+    gulong cancelled_id;
+};
+
+static void
+watch_free (gpointer user_data)
+{
+    struct Watch *watch = user_data;
+
+    g_clear_handle_id (&watch->source_id, g_source_remove);
+    if (watch->fd != -1)
+        close (watch->fd);
+    g_free (watch->cgroup);
+    g_free (watch);
+}
+
+static void
+wait_free (struct Wait *wait)
+{
+    g_clear_handle_id (&wait->timeout_id, g_source_remove);
+    g_cancellable_disconnect (
+        g_task_get_cancellable (wait->task), wait->cancelled_id
+    );
+    g_ptr_array_unref (wait->watches);
+    g_object_unref (wait->task);
+    g_free (wait);
+}
+
+static void
+wait_done (struct Wait *wait)
+{
+    if (g_task_return_error_if_cancelled (wait->task)) {
+        wait_free (wait);
+        return;
+    }
+
+    if (wait->pending == 0) {
+        g_task_return_boolean (wait->task, TRUE);
+    } else {
+        struct Watch *watch;
+        guint i;
+
+        for (i = 0; i < wait->watches->len; i++) {
+            watch = g_ptr_array_index (wait->watches, i);
+            if (watch->source_id != 0)
+                g_warning ("%s not %s in time",
+                           watch->cgroup,
+                           wait->freeze ? "frozen" : "thawed");
+        }
+
+        g_task_return_new_error (
+            wait->task,
+            G_IO_ERROR,
+            G_IO_ERROR_TIMED_OUT,
+            "%u cgroups not %s in time",
+            wait->pending,
+            wait->freeze ? "frozen" : "thawed"
+        );
+    }
+
+    wait_free (wait);
+}
+
+/* Returns frozen state, or a negative errno if cgroup.events can't be read */
+static gint
+get_frozen (gint fd)
+{
+    char events[256];
+    const char *frozen;
+    ssize_t len;
+
+    len = pread (fd, events, sizeof (events) - 1, 0);
+    if (len < 0)
+        return -errno;
+    events[len] = '\0';
+
+    frozen = strstr (events, "frozen ");
+    if (frozen == NULL)
+        return -EINVAL;
+
+    return frozen[7] == '1';
+}
+
+static gboolean
+watch_check (struct Watch *watch)
+{
+    g_autofree char *scope = NULL;
+    gint64 duration;
+    gint frozen = get_frozen (watch->fd);
+
+    /* Removed cgroup, nothing left to wait for */
+    if (frozen == -ENODEV || frozen == -ENOENT)
+        return TRUE;
+
+    if (frozen != watch->wait->freeze)
+        return FALSE;
+
+    duration = g_get_monotonic_time () - watch->start;
+    scope = g_path_get_basename (watch->cgroup);
+    trace_record (TRACE_CGROUP_FREEZE, watch->start, scope);
+
+    if (duration > SLOW_FREEZE)
+        g_message ("%s %s in %" G_GINT64_FORMAT " µs",
+                   scope,
+                   watch->wait->freeze ? "frozen" : "thawed",
+                   duration);
+
+    return TRUE;
+}
+
+static gboolean
+on_cgroup_events (gint         fd,
+                  GIOCondition condition,
+                  gpointer     user_data)
+{
+    struct Watch *watch = user_data;
+    struct Wait *wait = watch->wait;
+
+    /* Every change comes with POLLERR, only cgroup.events tells */
+    if (!watch_check (watch))
+        return G_SOURCE_CONTINUE;
+
+    watch->source_id = 0;
+    wait->pending--;
+    if (wait->pending == 0)
+        wait_done (wait);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+    struct Wait *wait = user_data;
+
+    wait->timeout_id = 0;
+    wait_done (wait);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_cancelled_idle (gpointer user_data)
+{
+    wait_done (user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_cancelled (GCancellable *cancellable,
+              gpointer      user_data)
+{
+    struct Wait *wait = user_data;
+
+    /* Can't disconnect from handler, finish from main loop */
+    g_clear_handle_id (&wait->timeout_id, g_source_remove);
+    wait->timeout_id = g_idle_add (on_cancelled_idle, wait);
+}
+
+static void
+add_watch (struct Wait *wait,
+           const char  *cgroup)
+{
+    g_autofree char *freeze = g_build_filename (cgroup, "cgroup.freeze", NULL);
+    g_autofree char *events = g_build_filename (cgroup, "cgroup.events", NULL);
+    g_autofree char *path = get_root_path (events);
+    struct Watch *watch;
+
+    watch = g_new0 (struct Watch, 1);
+    watch->cgroup = g_strdup (cgroup);
+    watch->start = g_get_monotonic_time ();
+    watch->wait = wait;
+    watch->fd = open (path, O_RDONLY | O_CLOEXEC);
+    g_ptr_array_add (wait->watches, watch);
+
+    /* Missing cgroup, nothing to wait for. Always write: cgroup may have
+     * been recreated or thawed by someone else
+     */
+    if (watch->fd == -1 ||
+            !write_to_file_uncached (freeze, wait->freeze ? "1" : "0"))
+        return;
+
+    if (watch_check (watch))
+        return;
+
+    /* Kernel notifies cgroup.events changes with POLLPRI | POLLERR */
+    watch->source_id = g_unix_fd_add (
+        watch->fd, G_IO_PRI | G_IO_ERR, on_cgroup_events, watch
+    );
+    wait->pending++;
+}
+
+/**
+ * cgroup_freeze_async:
+ *
+ * Freeze or thaw cgroups and wait for kernel to confirm it, from their
+ * cgroup.events. Time taken by each cgroup is traced.
+ *
+ * @param cgroups: cgroup directories
+ * @param freeze: TRUE to freeze, FALSE to thaw
+ * @param timeout: how long to wait, in milliseconds
+ * @param cancellable: (nullable): a #GCancellable
+ * @param callback: called once every cgroup is done or on timeout
+ * @param user_data: callback data
+ */
+void
+cgroup_freeze_async (GList               *cgroups,
+                     gboolean             freeze,
+                     guint                timeout,
+                     GCancellable        *cancellable,
+                     GAsyncReadyCallback  callback,
+                     gpointer             user_data)
+{
+    struct Wait *wait = g_new0 (struct Wait, 1);
+    const char *cgroup;
+
+    wait->task = g_task_new (NULL, cancellable, callback, user_data);
+    wait->watches = g_ptr_array_new_with_free_func (watch_free);
+    wait->freeze = freeze;
+    wait->pending = 0;
+
+    GFOREACH (cgroups, cgroup)
+        add_watch (wait, cgroup);
+
+    if (wait->pending == 0) {
+        wait_done (wait);
+        return;
+    }
+
+    wait->timeout_id = g_timeout_add (timeout, on_timeout, wait);
+    if (cancellable != NULL)
+        wait->cancelled_id = g_cancellable_connect (
+            cancellable, G_CALLBACK (on_cancelled), wait, NULL
+        );
+}
+
+/**
+ * cgroup_freeze_finish:
+ *
+ * Finish cgroup_freeze_async()
+ *
+ * @param result: a #GAsyncResult
+ * @param error: (nullable): G_IO_ERROR_TIMED_OUT if some cgroups were
+ * not done in time
+ *
+ * Returns: TRUE if every cgroup is done
+ */
+gboolean
+cgroup_freeze_finish (GAsyncResult  *result,
+                      GError       **error)
+{
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void            cgroup_freeze_async         (GList               *cgroups,
+                                             gboolean             freeze,
+                                             guint                timeout,
+                                             GCancellable        *cancellable,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data);
+gboolean        cgroup_freeze_finish        (GAsyncResult        *result,
+                                             GError             **error);
+
+G_END_DECLS
+
+#endif
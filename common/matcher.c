@@ -0,0 +1,290 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <gio/gio.h>
+
+#include "matcher.h"
+#include "utils.h"
+
+/* Root state is never a child, so 0 also means "no transition" */
+#define NO_STATE 0
+
+/*
+ * Aho-Corasick automaton: patterns are compiled once, then a string is
+ * checked against all of them in a single pass.
+ */
+struct State {
+    guint first_child;
+    guint next_sibling;
+    guint fail;
+    /* Lowest pattern index ending here (or in a fail state), -1 if none */
+    gint output;
+    guchar character;
+};
+
+struct _MatcherPrivate {
+    GArray *states;
+};
+
+G_DEFINE_TYPE_WITH_CODE (
+    Matcher,
+    matcher,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (Matcher)
+)
+
+#define STATE(self, index) \
+    (&g_array_index ((self)->priv->states, struct State, (index)))
+
+static guint
+get_child (Matcher *self,
+           guint    state,
+           guchar   character)
+{
+    guint child;
+
+    for (child = STATE (self, state)->first_child;
+            child != NO_STATE;
+            child = STATE (self, child)->next_sibling) {
+        if (STATE (self, child)->character == character)
+            return child;
+    }
+    return NO_STATE;
+}
+
+static guint
+add_child (Matcher *self,
+           guint    state,
+           guchar   character)
+{
+    struct State child = { 0 };
+    guint index = self->priv->states->len;
+
+    child.next_sibling = STATE (self, state)->first_child;
+    child.output = -1;
+    child.character = character;
+
+    g_array_append_val (self->priv->states, child);
+    STATE (self, state)->first_child = index;
+
+    return index;
+}
+
+static void
+add_pattern (Matcher    *self,
+             const char *pattern,
+             gint        index)
+{
+    const guchar *character;
+    guint state = 0;
+
+    for (character = (const guchar *) pattern; *character != '\0'; character++) {
+        guint child = get_child (self, state, *character);
+
+        if (child == NO_STATE)
+            child = add_child (self, state, *character);
+        state = child;
+    }
+
+    if (STATE (self, state)->output == -1)
+        STATE (self, state)->output = index;
+}
+
+static void
+build_fail_links (Matcher *self)
+{
+    g_autoptr (GArray) queue = g_array_new (FALSE, FALSE, sizeof (guint));
+    guint root = 0;
+    guint i;
+
+    g_array_append_val (queue, root);
+
+    /* Breadth first: fail states are always resolved before us */
+    for (i = 0; i < queue->len; i++) {
+        guint state = g_array_index (queue, guint, i);
+        guint child;
+
+        for (child = STATE (self, state)->first_child;
+                child != NO_STATE;
+                child = STATE (self, child)->next_sibling) {
+            guchar character = STATE (self, child)->character;
+            guint fail = STATE (self, state)->fail;
+            guint target;
+            gint output;
+
+            while (fail != 0 && get_child (self, fail, character) == NO_STATE)
+                fail = STATE (self, fail)->fail;
+
+            target = get_child (self, fail, character);
+            STATE (self, child)->fail = target != child ? target : 0;
+
+            output = STATE (self, STATE (self, child)->fail)->output;
+            if (output != -1 && (STATE (self, child)->output == -1 ||
+                                 output < STATE (self, child)->output))
+                STATE (self, child)->output = output;
+
+            g_array_append_val (queue, child);
+        }
+    }
+}
+
+static gint
+search (Matcher    *self,
+        const char *string,
+        gboolean    first)
+{
+    const guchar *character;
+    guint state = 0;
+    gint result = STATE (self, 0)->output;
+
+    if (result == 0 || (first && result != -1))
+        return result;
+
+    for (character = (const guchar *) string; *character != '\0'; character++) {
+        gint output;
+
+        while (state != 0 && get_child (self, state, *character) == NO_STATE)
+            state = STATE (self, state)->fail;
+        state = get_child (self, state, *character);
+
+        output = STATE (self, state)->output;
+        if (output != -1 && (result == -1 || output < result)) {
+            result = output;
+            if (first || result == 0)
+                break;
+        }
+    }
+
+    return result;
+}
+
+static void
+matcher_dispose (GObject *matcher)
+{
+    G_OBJECT_CLASS (matcher_parent_class)->dispose (matcher);
+}
+
+static void
+matcher_finalize (GObject *matcher)
+{
+    Matcher *self = MATCHER (matcher);
+
+    g_array_unref (self->priv->states);
+
+    G_OBJECT_CLASS (matcher_parent_class)->finalize (matcher);
+}
+
+static void
+matcher_class_init (MatcherClass *klass)
+{
+    GObjectClass *object_class;
+
+    object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = matcher_dispose;
+    object_class->finalize = matcher_finalize;
+}
+
+static void
+matcher_init (Matcher *self)
+{
+    self->priv = matcher_get_instance_private (self);
+
+    self->priv->states = g_array_new (FALSE, FALSE, sizeof (struct State));
+
+    matcher_set_patterns (self, NULL);
+}
+
+/**
+ * matcher_new:
+ *
+ * Creates a new #Matcher
+ *
+ * Returns: (transfer full): a new #Matcher
+ *
+ **/
+GObject *
+matcher_new (void)
+{
+    GObject *matcher;
+
+    matcher = g_object_new (TYPE_MATCHER, NULL);
+
+    return matcher;
+}
+
+/**
+ * matcher_set_patterns:
+ *
+ * Compile patterns, replacing previous ones
+ *
+ * @param #Matcher
+ * @param patterns: patterns list
+ */
+void
+matcher_set_patterns (Matcher *self,
+                      GList   *patterns)
+{
+    struct State root = { 0 };
+    const char *pattern;
+    gint index = 0;
+
+    root.output = -1;
+
+    g_array_set_size (self->priv->states, 0);
+    g_array_append_val (self->priv->states, root);
+
+    GFOREACH (patterns, pattern)
+        add_pattern (self, pattern, index++);
+
+    build_fail_links (self);
+}
+
+/**
+ * matcher_is_empty:
+ *
+ * Check for patterns
+ *
+ * @param #Matcher
+ *
+ * Returns: TRUE if no pattern can match
+ */
+gboolean
+matcher_is_empty (Matcher *self)
+{
+    return self->priv->states->len == 1 && STATE (self, 0)->output == -1;
+}
+
+/**
+ * matcher_match:
+ *
+ * Check if string contains any pattern
+ *
+ * @param #Matcher
+ * @param string: string to search in
+ *
+ * Returns: TRUE if a pattern is found
+ */
+gboolean
+matcher_match (Matcher    *self,
+               const char *string)
+{
+    return search (self, string, TRUE) != -1;
+}
+
+/**
+ * matcher_lookup:
+ *
+ * Find first pattern contained in string
+ *
+ * @param #Matcher
+ * @param string: string to search in
+ *
+ * Returns: lowest matching pattern index, -1 if none
+ */
+gint
+matcher_lookup (Matcher    *self,
+                const char *string)
+{
+    return search (self, string, FALSE);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#define TYPE_MATCHER \
+    (matcher_get_type ())
+#define MATCHER(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST \
+    ((obj), TYPE_MATCHER, Matcher))
+#define MATCHER_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_CAST \
+    ((cls), TYPE_MATCHER, MatcherClass))
+#define IS_MATCHER(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE \
+    ((obj), TYPE_MATCHER))
+#define IS_MATCHER_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_TYPE \
+    ((cls), TYPE_MATCHER))
+#define MATCHER_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS \
+    ((obj), TYPE_MATCHER, MatcherClass))
+
+G_BEGIN_DECLS
+
+typedef struct _Matcher Matcher;
+typedef struct _MatcherClass MatcherClass;
+typedef struct _MatcherPrivate MatcherPrivate;
+
+struct _Matcher {
+    GObject parent;
+    MatcherPrivate *priv;
+};
+
+struct _MatcherClass {
+    GObjectClass parent_class;
+};
+
+GType           matcher_get_type            (void) G_GNUC_CONST;
+
+GObject*        matcher_new                 (void);
+void            matcher_set_patterns        (Matcher    *self,
+                                             GList      *patterns);
+gboolean        matcher_is_empty            (Matcher    *self);
+gboolean        matcher_match               (Matcher    *self,
+                                             const char *string);
+gint            matcher_lookup              (Matcher    *self,
+                                             const char *string);
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,211 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <gio/gio.h>
+
+#include "sched_shaper.h"
+#include "../common/define.h"
+#include "../common/transition.h"
+#include "../common/utils.h"
+
+/*
+ * Values by #SchedShape, NULL restores value found at startup.
+ * cpu.uclamp.max is a percentage of the biggest CPU capacity: capped
+ * tasks stay on little cores and do not raise OPPs.
+ */
+struct SliceShape {
+    const char *uclamp_max[SCHED_SHAPE_LAST];
+    const char *weight[SCHED_SHAPE_LAST];
+};
+
+/* In deep doze, only media and apps exempt from freezing run in app
+ * slice: do not clamp it more, Dozing clamps exempt scopes itself */
+static const struct SliceShape apps_shape = {
+    { NULL, "50", "50" },
+    { NULL, "50", "50" }
+};
+
+static const struct SliceShape user_services_shape = {
+    { NULL, "60", "30" },
+    { NULL, NULL, "50" }
+};
+
+/* System services answer wakeups (calls, alarms): keep their share
+ * against user.slice, only cap their frequencies */
+static const struct SliceShape system_services_shape = {
+    { NULL, "80", "50" },
+    { NULL, NULL, NULL }
+};
+
+struct Node {
+    char *filename;
+    char *original;
+    const char * const *values;
+};
+
+struct _SchedShaperPrivate {
+    GList *nodes;
+    SchedShape shape;
+};
+
+G_DEFINE_TYPE_WITH_CODE (
+    SchedShaper,
+    sched_shaper,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (SchedShaper)
+)
+
+static void
+node_free (gpointer user_data)
+{
+    struct Node *node = user_data;
+
+    g_free (node->filename);
+    g_free (node->original);
+    g_free (node);
+}
+
+static void
+add_node (SchedShaper        *self,
+          const char         *dir,
+          const char         *attribute,
+          const char * const *values)
+{
+    g_autofree char *filename = g_build_filename (dir, attribute, NULL);
+    g_autofree char *path = get_root_path (filename);
+    char *original = NULL;
+    struct Node *node;
+
+    /* Kernel without uclamp or cpu controller not enabled on slice */
+    if (!g_file_get_contents (path, &original, NULL, NULL)) {
+        g_message ("Can't shape %s", filename);
+        return;
+    }
+
+    node = g_new0 (struct Node, 1);
+    node->filename = g_steal_pointer (&filename);
+    node->original = g_strchomp (original);
+    node->values = values;
+
+    self->priv->nodes = g_list_append (self->priv->nodes, node);
+}
+
+static void
+add_slice (SchedShaper             *self,
+           const char              *dir,
+           const struct SliceShape *shape)
+{
+    add_node (self, dir, "cpu.uclamp.max", shape->uclamp_max);
+    add_node (self, dir, "cpu.weight", shape->weight);
+}
+
+static void
+sched_shaper_dispose (GObject *sched_shaper)
+{
+    G_OBJECT_CLASS (sched_shaper_parent_class)->dispose (sched_shaper);
+}
+
+static void
+sched_shaper_finalize (GObject *sched_shaper)
+{
+    SchedShaper *self = SCHED_SHAPER (sched_shaper);
+
+    g_list_free_full (self->priv->nodes, node_free);
+
+    G_OBJECT_CLASS (sched_shaper_parent_class)->finalize (sched_shaper);
+}
+
+static void
+sched_shaper_class_init (SchedShaperClass *klass)
+{
+    GObjectClass *object_class;
+
+    object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = sched_shaper_dispose;
+    object_class->finalize = sched_shaper_finalize;
+}
+
+static void
+sched_shaper_init (SchedShaper *self)
+{
+    self->priv = sched_shaper_get_instance_private (self);
+
+    self->priv->nodes = NULL;
+    self->priv->shape = SCHED_SHAPE_NONE;
+}
+
+/**
+ * sched_shaper_new:
+ *
+ * Creates a new #SchedShaper
+ *
+ * @param #GBusType: target slices type (G_BUS_TYPE_SYSTEM/G_BUS_TYPE_SESSION).
+ *
+ * Returns: (transfer full): a new #SchedShaper
+ *
+ **/
+GObject *
+sched_shaper_new (GBusType bus_type)
+{
+    GObject *sched_shaper;
+    SchedShaper *self;
+
+    sched_shaper = g_object_new (TYPE_SCHED_SHAPER, NULL);
+    self = SCHED_SHAPER (sched_shaper);
+
+    if (bus_type == G_BUS_TYPE_SESSION) {
+        g_autofree char *apps_dir = g_strdup_printf (
+            CGROUPS_APPS_FREEZE_DIR, getuid (), getuid ()
+        );
+        g_autofree char *user_services_dir = g_strdup_printf (
+            CGROUPS_USER_SERVICES_FREEZE_DIR, getuid (), getuid ()
+        );
+
+        add_slice (self, apps_dir, &apps_shape);
+        add_slice (self, user_services_dir, &user_services_shape);
+    } else {
+        add_slice (
+            self, CGROUPS_SYSTEM_SERVICES_FREEZE_DIR, &system_services_shape
+        );
+    }
+
+    return sched_shaper;
+}
+
+/**
+ * sched_shaper_set_shape:
+ *
+ * Set slices utilization clamp and weight
+ *
+ * @param #SchedShaper
+ * @param shape: #SchedShape to apply
+ * @param plan: (nullable): #TransitionPlan to add writes to
+ *
+ **/
+void
+sched_shaper_set_shape (SchedShaper    *self,
+                        SchedShape      shape,
+                        TransitionPlan *plan)
+{
+    struct Node *node;
+
+    if (shape == self->priv->shape)
+        return;
+
+    self->priv->shape = shape;
+
+    GFOREACH (self->priv->nodes, node) {
+        const char *value = node->values[shape];
+
+        if (value == NULL)
+            value = node->original;
+
+        g_message ("%s -> %s", node->filename, value);
+        transition_plan_write (plan, node->filename, node->filename, value);
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef SCHED_SHAPER_H
+#define SCHED_SHAPER_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "transition.h"
+
+#define TYPE_SCHED_SHAPER \
+    (sched_shaper_get_type ())
+#define SCHED_SHAPER(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST \
+    ((obj), TYPE_SCHED_SHAPER, SchedShaper))
+#define SCHED_SHAPER_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_CAST \
+    ((cls), TYPE_SCHED_SHAPER, SchedShaperClass))
+#define IS_SCHED_SHAPER(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE \
+    ((obj), TYPE_SCHED_SHAPER))
+#define IS_SCHED_SHAPER_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_TYPE \
+    ((cls), TYPE_SCHED_SHAPER))
+#define SCHED_SHAPER_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS \
+    ((obj), TYPE_SCHED_SHAPER, SchedShaperClass))
+
+G_BEGIN_DECLS
+
+typedef enum {
+    SCHED_SHAPE_NONE,
+    /* Screen off: background work stays on efficient cores */
+    SCHED_SHAPE_BACKGROUND,
+    /* Apps frozen: only exempt apps are left running */
+    SCHED_SHAPE_DEEP,
+    SCHED_SHAPE_LAST
+} SchedShape;
+
+typedef struct _SchedShaper SchedShaper;
+typedef struct _SchedShaperClass SchedShaperClass;
+typedef struct _SchedShaperPrivate SchedShaperPrivate;
+
+struct _SchedShaper {
+    GObject parent;
+    SchedShaperPrivate *priv;
+};
+
+struct _SchedShaperClass {
+    GObjectClass parent_class;
+};
+
+GType           sched_shaper_get_type        (void) G_GNUC_CONST;
+
+GObject*        sched_shaper_new             (GBusType bus_type);
+void            sched_shaper_set_shape       (SchedShaper    *self,
+                                              SchedShape      shape,
+                                              TransitionPlan *plan);
+G_END_DECLS
+
+#endif
@@ -9,7 +9,9 @@
 
 #include "bus.h"
 #include "services.h"
+#include "../common/cgroup.h"
 #include "../common/define.h"
+#include "../common/transition.h"
 #include "../common/utils.h"
 
 struct _ServicesPrivate {
@@ -109,11 +111,13 @@ services_new (GBusType service_type)
  *
  * @param #Services
  * @param services: services to start
+ * @param plan: (nullable): #TransitionPlan to add writes to
  *
  **/
 void
-services_freeze (Services *self,
-                 GList    *services)
+services_freeze (Services       *self,
+                 GList          *services,
+                 TransitionPlan *plan)
 {
     GList *paths = get_cgroups_paths (self);
     const char *path;
@@ -124,13 +128,72 @@ services_freeze (Services *self,
             g_autofree char *filename = g_build_filename (
                 path, service, "cgroup.freeze", NULL
             );
-            if (g_file_test (filename, G_FILE_TEST_EXISTS))
-                write_to_file (filename, "1");
+            transition_plan_write (plan, filename, filename, "1");
         }
     }
     g_list_free_full (paths, g_free);
 }
 
+/**
+ * services_freeze_async:
+ *
+ * Freeze services and wait for kernel to confirm it
+ *
+ * @param #Services
+ * @param services: services to freeze
+ * @param timeout: how long to wait, in milliseconds
+ * @param cancellable: (nullable): a #GCancellable
+ * @param callback: callback, call services_freeze_finish() from it
+ * @param user_data: callback data
+ *
+ **/
+void
+services_freeze_async (Services            *self,
+                       GList               *services,
+                       guint                timeout,
+                       GCancellable        *cancellable,
+                       GAsyncReadyCallback  callback,
+                       gpointer             user_data)
+{
+    GList *paths = get_cgroups_paths (self);
+    GList *cgroups = NULL;
+    const char *path;
+    const char *service;
+
+    GFOREACH (paths, path) {
+        GFOREACH_SUB (services, service) {
+            cgroups = g_list_prepend (
+                cgroups, g_build_filename (path, service, NULL)
+            );
+        }
+    }
+
+    cgroup_freeze_async (
+        cgroups, TRUE, timeout, cancellable, callback, user_data
+    );
+
+    g_list_free_full (cgroups, g_free);
+    g_list_free_full (paths, g_free);
+}
+
+/**
+ * services_freeze_finish:
+ *
+ * Finish services_freeze_async()
+ *
+ * @param result: a #GAsyncResult
+ * @param error: (nullable): a #GError
+ *
+ * Returns: TRUE if every service is frozen
+ *
+ **/
+gboolean
+services_freeze_finish (GAsyncResult  *result,
+                        GError       **error)
+{
+    return cgroup_freeze_finish (result, error);
+}
+
 /**
  * services_unfreeze:
  *
@@ -138,11 +201,13 @@ services_freeze (Services *self,
  *
  * @param #Services
  * @param services: services to stop
+ * @param plan: (nullable): #TransitionPlan to add writes to
  *
  **/
 void
-services_unfreeze (Services *self,
-                   GList   *services)
+services_unfreeze (Services       *self,
+                   GList          *services,
+                   TransitionPlan *plan)
 {
     GList *paths = get_cgroups_paths (self);
     const char *path;
@@ -153,8 +218,7 @@ services_unfreeze (Services *self,
             g_autofree char *filename = g_build_filename (
                 path, service, "cgroup.freeze", NULL
             );
-            if (g_file_test (filename, G_FILE_TEST_EXISTS))
-                write_to_file (filename, "0");
+            transition_plan_write (plan, filename, filename, "0");
         }
     }
     g_list_free_full (paths, g_free);
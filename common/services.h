@@ -7,6 +7,9 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
+
+#include "transition.h"
 
 #define TYPE_SERVICES \
     (services_get_type ())
@@ -44,10 +47,20 @@ struct _ServicesClass {
 GType           services_get_type            (void) G_GNUC_CONST;
 
 GObject*        services_new                 (GBusType bus_type);
-void            services_freeze              (Services *self,
-                                              GList   *services);
-void            services_unfreeze            (Services *self,
-                                              GList   *services);
+void            services_freeze              (Services       *self,
+                                              GList          *services,
+                                              TransitionPlan *plan);
+void            services_freeze_async        (Services            *self,
+                                              GList               *services,
+                                              guint                timeout,
+                                              GCancellable        *cancellable,
+                                              GAsyncReadyCallback  callback,
+                                              gpointer             user_data);
+gboolean        services_freeze_finish       (GAsyncResult        *result,
+                                              GError             **error);
+void            services_unfreeze            (Services       *self,
+                                              GList          *services,
+                                              TransitionPlan *plan);
 G_END_DECLS
 
 #endif
@@ -0,0 +1,403 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "trace.h"
+
+/* Bucket n counts durations in [2^n, 2^(n+1)[ µs, last one is open */
+#define HISTOGRAM_BUCKETS 24
+#define MAX_EVENTS        256
+#define MAX_DETAIL        64
+
+struct Stats {
+    guint64 count;
+    guint64 total;
+    guint64 max;
+    guint64 histogram[HISTOGRAM_BUCKETS];
+};
+
+struct Event {
+    TracePhase phase;
+    gint64 start;
+    gint64 duration;
+    char detail[MAX_DETAIL];
+};
+
+G_LOCK_DEFINE_STATIC (trace);
+static struct Stats stats[TRACE_LAST];
+static struct Event events[MAX_EVENTS];
+static guint events_head = 0;
+static guint events_len = 0;
+
+/* Startup is done once every held dependency is released */
+static gint64 startup_time = 0;
+static guint startup_pending = 0;
+static gboolean startup_done = FALSE;
+
+static const char *phase_names[TRACE_LAST] = {
+    "idle-hint",
+    "bus-dispatch",
+    "write",
+    "freezer-scan",
+    "modem-apply",
+    "transition",
+    "interactive",
+    "startup",
+    "cgroup-freeze",
+    "modem-switch",
+    "modem-dwell",
+    "cpu-hotplug"
+};
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const char            *sender,
+                    const char            *object_path,
+                    const char            *interface_name,
+                    const char            *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+    if (g_strcmp0 (method_name, "GetStats") == 0) {
+        g_dbus_method_invocation_return_value (
+            invocation, g_variant_new ("(@a{s(tttat)})", trace_get_stats ())
+        );
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "GetEvents") == 0) {
+        g_dbus_method_invocation_return_value (
+            invocation, g_variant_new ("(@a(sxxs))", trace_get_events ())
+        );
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "Reset") == 0) {
+        trace_reset ();
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    }
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    handle_method_call,
+    NULL,
+    NULL
+};
+
+static guint
+get_bucket (guint64 duration)
+{
+    guint bucket = 0;
+
+    while (duration > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+        duration >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static struct Event *
+get_event (guint index)
+{
+    return &events[(events_head + index) % MAX_EVENTS];
+}
+
+/**
+ * trace_record:
+ *
+ * Record a phase ending now. Safe to call from any thread.
+ *
+ * @param phase: a #TracePhase
+ * @param start: phase start, from g_get_monotonic_time ()
+ * @param detail: (nullable): what the phase was about (file, method, ...)
+ */
+void
+trace_record (TracePhase  phase,
+              gint64      start,
+              const char *detail)
+{
+    trace_record_duration (
+        phase, start, g_get_monotonic_time () - start, detail
+    );
+}
+
+/**
+ * trace_record_duration:
+ *
+ * Record a phase that ended before now. Safe to call from any thread.
+ *
+ * @param phase: a #TracePhase
+ * @param start: phase start, from g_get_monotonic_time ()
+ * @param duration: phase duration in µs
+ * @param detail: (nullable): what the phase was about (file, method, ...)
+ */
+void
+trace_record_duration (TracePhase  phase,
+                       gint64      start,
+                       gint64      duration,
+                       const char *detail)
+{
+    struct Event *event;
+
+    duration = MAX (duration, 0);
+
+    G_LOCK (trace);
+
+    stats[phase].count++;
+    stats[phase].total += duration;
+    stats[phase].max = MAX (stats[phase].max, (guint64) duration);
+    stats[phase].histogram[get_bucket (duration)]++;
+
+    if (events_len < MAX_EVENTS) {
+        event = get_event (events_len);
+        events_len++;
+    } else {
+        event = get_event (0);
+        events_head = (events_head + 1) % MAX_EVENTS;
+    }
+    event->phase = phase;
+    event->start = start;
+    event->duration = duration;
+    g_strlcpy (event->detail, detail != NULL ? detail : "", MAX_DETAIL);
+
+    G_UNLOCK (trace);
+}
+
+/**
+ * trace_get_stats:
+ *
+ * Get per phase statistics
+ *
+ * Returns: (transfer floating): a{s(tttat)}: phase name to
+ * (count, total µs, max µs, log2 µs histogram)
+ */
+GVariant *
+trace_get_stats (void)
+{
+    GVariantBuilder builder;
+    guint i, j;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(tttat)}"));
+
+    G_LOCK (trace);
+
+    for (i = 0; i < TRACE_LAST; i++) {
+        GVariantBuilder histogram;
+
+        g_variant_builder_init (&histogram, G_VARIANT_TYPE ("at"));
+        for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+            g_variant_builder_add (&histogram, "t", stats[i].histogram[j]);
+
+        g_variant_builder_add (
+            &builder,
+            "{s(tttat)}",
+            phase_names[i],
+            stats[i].count,
+            stats[i].total,
+            stats[i].max,
+            &histogram
+        );
+    }
+
+    G_UNLOCK (trace);
+
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * trace_get_events:
+ *
+ * Get last recorded events, oldest first
+ *
+ * Returns: (transfer floating): a(sxxs): phase name, monotonic start µs,
+ * duration µs, detail
+ */
+GVariant *
+trace_get_events (void)
+{
+    GVariantBuilder builder;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxxs)"));
+
+    G_LOCK (trace);
+
+    for (i = 0; i < events_len; i++) {
+        struct Event *event = get_event (i);
+
+        g_variant_builder_add (
+            &builder,
+            "(sxxs)",
+            phase_names[event->phase],
+            event->start,
+            event->duration,
+            event->detail
+        );
+    }
+
+    G_UNLOCK (trace);
+
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * trace_reset:
+ *
+ * Forget statistics and events
+ */
+void
+trace_reset (void)
+{
+    G_LOCK (trace);
+
+    memset (stats, 0, sizeof (stats));
+    events_head = 0;
+    events_len = 0;
+
+    G_UNLOCK (trace);
+}
+
+/**
+ * trace_dump:
+ *
+ * Log statistics and events
+ */
+void
+trace_dump (void)
+{
+    guint i;
+
+    G_LOCK (trace);
+
+    for (i = 0; i < TRACE_LAST; i++) {
+        if (stats[i].count == 0)
+            continue;
+
+        g_message ("%s: %" G_GUINT64_FORMAT " calls, "
+                   "avg %" G_GUINT64_FORMAT " µs, "
+                   "max %" G_GUINT64_FORMAT " µs",
+                   phase_names[i],
+                   stats[i].count,
+                   stats[i].total / stats[i].count,
+                   stats[i].max);
+    }
+
+    for (i = 0; i < events_len; i++) {
+        struct Event *event = get_event (i);
+
+        g_message ("%" G_GINT64_FORMAT " %s %s: %" G_GINT64_FORMAT " µs",
+                   event->start,
+                   phase_names[event->phase],
+                   event->detail,
+                   event->duration);
+    }
+
+    G_UNLOCK (trace);
+}
+
+/**
+ * trace_startup_begin:
+ *
+ * Mark daemon start, call it first thing in main ()
+ */
+void
+trace_startup_begin (void)
+{
+    G_LOCK (trace);
+
+    startup_time = g_get_monotonic_time ();
+    startup_pending = 0;
+    startup_done = FALSE;
+
+    G_UNLOCK (trace);
+}
+
+/**
+ * trace_startup_hold:
+ *
+ * Startup is not done until a matching trace_startup_release () call.
+ * Does nothing once startup is done.
+ */
+void
+trace_startup_hold (void)
+{
+    G_LOCK (trace);
+
+    if (!startup_done)
+        startup_pending++;
+
+    G_UNLOCK (trace);
+}
+
+/**
+ * trace_startup_release:
+ *
+ * Record a dependency as ready (or failed), since daemon start
+ *
+ * @param detail: dependency name
+ */
+void
+trace_startup_release (const char *detail)
+{
+    gboolean done = FALSE;
+    gint64 start;
+
+    G_LOCK (trace);
+
+    if (startup_done || startup_pending == 0) {
+        G_UNLOCK (trace);
+        return;
+    }
+
+    startup_pending--;
+    if (startup_pending == 0) {
+        startup_done = TRUE;
+        done = TRUE;
+    }
+    start = startup_time;
+
+    G_UNLOCK (trace);
+
+    trace_record (TRACE_STARTUP, start, detail);
+
+    if (done) {
+        g_message ("Startup done in %" G_GINT64_FORMAT " µs",
+                   g_get_monotonic_time () - start);
+        trace_record (TRACE_STARTUP, start, "ready");
+    }
+}
+
+/**
+ * trace_register_object:
+ *
+ * Export statistics and events on a D-Bus object
+ *
+ * @param connection: a #GDBusConnection
+ * @param object_path: object path to register
+ * @param interface_info: org.adishatz.Mps.Stats introspection data
+ *
+ * Returns: registration id, 0 on error
+ */
+guint
+trace_register_object (GDBusConnection    *connection,
+                       const char         *object_path,
+                       GDBusInterfaceInfo *interface_info)
+{
+    return g_dbus_connection_register_object (
+        connection,
+        object_path,
+        interface_info,
+        &interface_vtable,
+        NULL,
+        NULL,
+        NULL
+    );
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    TRACE_IDLE_HINT,
+    TRACE_BUS_DISPATCH,
+    TRACE_WRITE,
+    TRACE_FREEZER_SCAN,
+    TRACE_MODEM_APPLY,
+    TRACE_TRANSITION,
+    TRACE_INTERACTIVE,
+    TRACE_STARTUP,
+    TRACE_CGROUP_FREEZE,
+    TRACE_MODEM_SWITCH,
+    TRACE_MODEM_DWELL,
+    TRACE_CPU_HOTPLUG,
+    TRACE_LAST
+} TracePhase;
+
+void            trace_record                (TracePhase  phase,
+                                             gint64      start,
+                                             const char *detail);
+void            trace_record_duration       (TracePhase  phase,
+                                             gint64      start,
+                                             gint64      duration,
+                                             const char *detail);
+GVariant*       trace_get_stats             (void);
+GVariant*       trace_get_events            (void);
+void            trace_reset                 (void);
+void            trace_dump                  (void);
+void            trace_startup_begin         (void);
+void            trace_startup_hold          (void);
+void            trace_startup_release       (const char *detail);
+guint           trace_register_object       (GDBusConnection    *connection,
+                                             const char         *object_path,
+                                             GDBusInterfaceInfo *interface_info);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,458 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <gio/gio.h>
+
+#include "trace.h"
+#include "transition.h"
+#include "utils.h"
+
+#define MAX_WORKERS 4
+
+struct Write {
+    char *filename;
+    char *value;
+};
+
+struct Group {
+    char *name;
+    GArray *writes; /* struct Write */
+    TransitionPlan *plan;
+};
+
+struct Step {
+    GPtrArray *groups; /* struct Group */
+    /* Started from an idle source, after pending events */
+    gboolean deferred;
+    TransitionFunc callback;
+    gpointer user_data;
+};
+
+struct _TransitionPlan {
+    char *name;
+    /* Steps run in order, groups of a step run in parallel */
+    GPtrArray *steps; /* struct Step */
+    guint step;
+    guint running_groups;
+    gboolean supersede;
+    gint cancelled;
+    gint64 start_time;
+    Transition *transition;
+};
+
+struct _TransitionPrivate {
+    GThreadPool *pool;
+    TransitionPlan *running;
+    GQueue *pending; /* TransitionPlan */
+};
+
+G_DEFINE_TYPE_WITH_CODE (
+    Transition,
+    transition,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (Transition)
+)
+
+static void run_step (Transition *self);
+
+static void
+write_clear (gpointer user_data)
+{
+    struct Write *node = user_data;
+
+    g_free (node->filename);
+    g_free (node->value);
+}
+
+static void
+group_free (gpointer user_data)
+{
+    struct Group *group = user_data;
+
+    g_free (group->name);
+    g_array_unref (group->writes);
+    g_free (group);
+}
+
+static void
+step_free (gpointer user_data)
+{
+    struct Step *step = user_data;
+
+    g_ptr_array_unref (step->groups);
+    g_free (step);
+}
+
+static struct Step *
+get_step (TransitionPlan *plan,
+          guint           step)
+{
+    return g_ptr_array_index (plan->steps, step);
+}
+
+static struct Group *
+get_group (TransitionPlan *plan,
+           const char     *name)
+{
+    GPtrArray *groups = get_step (plan, plan->steps->len - 1)->groups;
+    struct Group *group;
+    guint i;
+
+    for (i = 0; i < groups->len; i++) {
+        group = g_ptr_array_index (groups, i);
+        if (g_strcmp0 (group->name, name) == 0)
+            return group;
+    }
+
+    group = g_new0 (struct Group, 1);
+    group->name = g_strdup (name);
+    group->writes = g_array_new (FALSE, FALSE, sizeof (struct Write));
+    g_array_set_clear_func (group->writes, write_clear);
+    group->plan = plan;
+    g_ptr_array_add (groups, group);
+
+    return group;
+}
+
+static void
+start_next_plan (Transition *self)
+{
+    TransitionPlan *plan = g_queue_pop_head (self->priv->pending);
+
+    if (plan == NULL)
+        return;
+
+    self->priv->running = plan;
+    plan->transition = self;
+    plan->start_time = g_get_monotonic_time ();
+
+    run_step (self);
+}
+
+static void
+step_done (Transition *self)
+{
+    TransitionPlan *plan = self->priv->running;
+    struct Step *step = get_step (plan, plan->step);
+
+    if (step->callback != NULL && !g_atomic_int_get (&plan->cancelled))
+        step->callback (step->user_data);
+
+    plan->step++;
+    run_step (self);
+}
+
+static gboolean
+on_group_done (gpointer user_data)
+{
+    struct Group *group = user_data;
+    TransitionPlan *plan = group->plan;
+    Transition *self = plan->transition;
+
+    plan->running_groups--;
+    if (plan->running_groups == 0)
+        step_done (self);
+
+    g_object_unref (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_deferred_step (gpointer user_data)
+{
+    Transition *self = TRANSITION (user_data);
+
+    run_step (self);
+    g_object_unref (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+run_group (gpointer data,
+           gpointer user_data)
+{
+    struct Group *group = data;
+    guint i;
+
+    for (i = 0; i < group->writes->len; i++) {
+        struct Write *node = &g_array_index (group->writes, struct Write, i);
+
+        /* Superseded, next plan will write its own values */
+        if (g_atomic_int_get (&group->plan->cancelled))
+            break;
+
+        write_to_file (node->filename, node->value);
+    }
+
+    g_main_context_invoke (NULL, on_group_done, group);
+}
+
+static void
+run_step (Transition *self)
+{
+    TransitionPlan *plan = self->priv->running;
+    struct Step *step;
+    guint i;
+
+    /* Remaining steps of a superseded plan are dropped */
+    if (plan->step >= plan->steps->len ||
+            g_atomic_int_get (&plan->cancelled)) {
+        g_message ("%s transition %s in %" G_GINT64_FORMAT " µs",
+                   plan->name,
+                   g_atomic_int_get (&plan->cancelled) ?
+                       "superseded" : "done",
+                   g_get_monotonic_time () - plan->start_time);
+        trace_record (TRACE_TRANSITION, plan->start_time, plan->name);
+
+        transition_plan_free (plan);
+        self->priv->running = NULL;
+
+        start_next_plan (self);
+        return;
+    }
+
+    step = get_step (plan, plan->step);
+
+    if (step->deferred) {
+        step->deferred = FALSE;
+        g_idle_add_full (
+            G_PRIORITY_LOW, on_deferred_step, g_object_ref (self), NULL
+        );
+        return;
+    }
+
+    if (step->groups->len == 0) {
+        step_done (self);
+        return;
+    }
+
+    plan->running_groups = step->groups->len;
+    for (i = 0; i < step->groups->len; i++) {
+        /* Keep us alive until on_group_done() */
+        g_object_ref (self);
+        g_thread_pool_push (
+            self->priv->pool, g_ptr_array_index (step->groups, i), NULL
+        );
+    }
+}
+
+static void
+transition_dispose (GObject *transition)
+{
+    Transition *self = TRANSITION (transition);
+
+    /* Owner is going away, do not call it back */
+    if (self->priv->running != NULL)
+        g_atomic_int_set (&self->priv->running->cancelled, TRUE);
+
+    g_queue_clear_full (
+        self->priv->pending, (GDestroyNotify) transition_plan_free
+    );
+
+    G_OBJECT_CLASS (transition_parent_class)->dispose (transition);
+}
+
+static void
+transition_finalize (GObject *transition)
+{
+    Transition *self = TRANSITION (transition);
+
+    /* No group is running here, see run_step() */
+    g_thread_pool_free (self->priv->pool, TRUE, TRUE);
+    g_queue_free (self->priv->pending);
+
+    G_OBJECT_CLASS (transition_parent_class)->finalize (transition);
+}
+
+static void
+transition_class_init (TransitionClass *klass)
+{
+    GObjectClass *object_class;
+
+    object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = transition_dispose;
+    object_class->finalize = transition_finalize;
+}
+
+static void
+transition_init (Transition *self)
+{
+    self->priv = transition_get_instance_private (self);
+
+    self->priv->pool = g_thread_pool_new (
+        run_group,
+        self,
+        MIN (g_get_num_processors (), MAX_WORKERS),
+        FALSE,
+        NULL
+    );
+    self->priv->running = NULL;
+    self->priv->pending = g_queue_new ();
+}
+
+/**
+ * transition_new:
+ *
+ * Creates a new #Transition
+ *
+ * Returns: (transfer full): a new #Transition
+ *
+ **/
+GObject *
+transition_new (void)
+{
+    GObject *transition;
+
+    transition = g_object_new (TYPE_TRANSITION, NULL);
+
+    return transition;
+}
+
+/**
+ * transition_run:
+ *
+ * Run plan in worker threads once previous plans are done. A superseding
+ * plan cancels running and pending superseding plans.
+ *
+ * @param #Transition
+ * @param plan: (transfer full): plan to run
+ */
+void
+transition_run (Transition     *self,
+                TransitionPlan *plan)
+{
+    if (plan->supersede) {
+        GList *link = self->priv->pending->head;
+
+        while (link != NULL) {
+            GList *next = link->next;
+            TransitionPlan *pending = link->data;
+
+            if (pending->supersede) {
+                transition_plan_free (pending);
+                g_queue_delete_link (self->priv->pending, link);
+            }
+            link = next;
+        }
+
+        if (self->priv->running != NULL && self->priv->running->supersede)
+            g_atomic_int_set (&self->priv->running->cancelled, TRUE);
+    }
+
+    g_queue_push_tail (self->priv->pending, plan);
+
+    if (self->priv->running == NULL)
+        start_next_plan (self);
+}
+
+/**
+ * transition_plan_new:
+ *
+ * Creates a new plan with one empty step
+ *
+ * @param name: plan name, for logging
+ * @param supersede: TRUE if plan writes a full state (screen on/off):
+ * previous superseding plans do not need to complete
+ *
+ * Returns: (transfer full): a new #TransitionPlan
+ */
+TransitionPlan *
+transition_plan_new (const char *name,
+                     gboolean    supersede)
+{
+    TransitionPlan *plan = g_new0 (TransitionPlan, 1);
+
+    plan->name = g_strdup (name);
+    plan->supersede = supersede;
+    plan->steps = g_ptr_array_new_with_free_func (step_free);
+    transition_plan_next_step (plan, FALSE);
+
+    return plan;
+}
+
+/**
+ * transition_plan_free:
+ *
+ * Free plan
+ *
+ * @param plan: a #TransitionPlan
+ */
+void
+transition_plan_free (TransitionPlan *plan)
+{
+    g_ptr_array_unref (plan->steps);
+    g_free (plan->name);
+    g_free (plan);
+}
+
+/**
+ * transition_plan_next_step:
+ *
+ * Following writes will only start once previous step is done
+ *
+ * @param plan: a #TransitionPlan
+ * @param deferred: if TRUE, step waits for main loop to be idle
+ */
+void
+transition_plan_next_step (TransitionPlan *plan,
+                           gboolean        deferred)
+{
+    struct Step *step = g_new0 (struct Step, 1);
+
+    step->groups = g_ptr_array_new_with_free_func (group_free);
+    step->deferred = deferred;
+    g_ptr_array_add (plan->steps, step);
+}
+
+/**
+ * transition_plan_notify:
+ *
+ * Call callback from main loop once current step is done. Not called if
+ * plan is superseded.
+ *
+ * @param plan: a #TransitionPlan
+ * @param callback: a #TransitionFunc
+ * @param user_data: callback data
+ */
+void
+transition_plan_notify (TransitionPlan *plan,
+                        TransitionFunc  callback,
+                        gpointer        user_data)
+{
+    struct Step *step = get_step (plan, plan->steps->len - 1);
+
+    step->callback = callback;
+    step->user_data = user_data;
+}
+
+/**
+ * transition_plan_write:
+ *
+ * Add a write to plan. Writes of a group are done in order, groups of a
+ * step in parallel. If plan is NULL, write is done now.
+ *
+ * @param plan: (nullable): a #TransitionPlan
+ * @param group: group name
+ * @param filename: node path
+ * @param value: value to write
+ */
+void
+transition_plan_write (TransitionPlan *plan,
+                       const char     *group,
+                       const char     *filename,
+                       const char     *value)
+{
+    struct Write node;
+
+    if (plan == NULL) {
+        write_to_file (filename, value);
+        return;
+    }
+
+    node.filename = g_strdup (filename);
+    node.value = g_strdup (value);
+    g_array_append_val (get_group (plan, group)->writes, node);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef TRANSITION_H
+#define TRANSITION_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#define TYPE_TRANSITION \
+    (transition_get_type ())
+#define TRANSITION(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST \
+    ((obj), TYPE_TRANSITION, Transition))
+#define TRANSITION_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_CAST \
+    ((cls), TYPE_TRANSITION, TransitionClass))
+#define IS_TRANSITION(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE \
+    ((obj), TYPE_TRANSITION))
+#define IS_TRANSITION_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_TYPE \
+    ((cls), TYPE_TRANSITION))
+#define TRANSITION_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS \
+    ((obj), TYPE_TRANSITION, TransitionClass))
+
+G_BEGIN_DECLS
+
+typedef struct _Transition Transition;
+typedef struct _TransitionClass TransitionClass;
+typedef struct _TransitionPrivate TransitionPrivate;
+typedef struct _TransitionPlan TransitionPlan;
+
+typedef void (*TransitionFunc) (gpointer user_data);
+
+struct _Transition {
+    GObject parent;
+    TransitionPrivate *priv;
+};
+
+struct _TransitionClass {
+    GObjectClass parent_class;
+};
+
+GType           transition_get_type             (void) G_GNUC_CONST;
+
+GObject*        transition_new                  (void);
+void            transition_run                  (Transition     *self,
+                                                 TransitionPlan *plan);
+
+TransitionPlan* transition_plan_new             (const char     *name,
+                                                 gboolean        supersede);
+void            transition_plan_free            (TransitionPlan *plan);
+void            transition_plan_next_step       (TransitionPlan *plan,
+                                                 gboolean        deferred);
+void            transition_plan_notify          (TransitionPlan *plan,
+                                                 TransitionFunc  callback,
+                                                 gpointer        user_data);
+void            transition_plan_write           (TransitionPlan *plan,
+                                                 const char     *group,
+                                                 const char     *filename,
+                                                 const char     *value);
+G_END_DECLS
+
+#endif
@@ -2,26 +2,318 @@
  * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib.h>
 
+#include "trace.h"
 #include "utils.h"
 
-void write_to_file (const char *filename,
-                    const char *value)
+/* Enough for every sysfs node we touch, flushed when full */
+#define MAX_CACHED_FILES 512
+/* Longer values are always written */
+#define MAX_VALUE_LEN 256
+
+struct CachedFile {
+    GMutex mutex;
+    gint fd;
+};
+
+/* Only protects the table, each node has its own lock */
+G_LOCK_DEFINE_STATIC (cached_files);
+static GHashTable *cached_files = NULL;
+
+/* Set once at startup, before any thread is running */
+static char *root_dir = NULL;
+
+static void
+cached_file_clear (gpointer user_data)
+{
+    struct CachedFile *cached_file = user_data;
+
+    if (cached_file->fd != -1)
+        close (cached_file->fd);
+    g_mutex_clear (&cached_file->mutex);
+}
+
+static void
+cached_file_unref (gpointer user_data)
+{
+    g_atomic_rc_box_release_full (user_data, cached_file_clear);
+}
+
+static struct CachedFile *
+get_cached_file (const char *filename)
+{
+    struct CachedFile *cached_file;
+
+    G_LOCK (cached_files);
+
+    if (cached_files == NULL)
+        cached_files = g_hash_table_new_full (
+            g_str_hash, g_str_equal, g_free, cached_file_unref
+        );
+
+    cached_file = g_hash_table_lookup (cached_files, filename);
+    if (cached_file == NULL) {
+        if (g_hash_table_size (cached_files) >= MAX_CACHED_FILES)
+            g_hash_table_remove_all (cached_files);
+
+        cached_file = g_atomic_rc_box_new0 (struct CachedFile);
+        g_mutex_init (&cached_file->mutex);
+        cached_file->fd = -1;
+        g_hash_table_insert (cached_files, g_strdup (filename), cached_file);
+    }
+    g_atomic_rc_box_acquire (cached_file);
+
+    G_UNLOCK (cached_files);
+
+    return cached_file;
+}
+
+static void
+forget_cached_file (const char              *filename,
+                    const struct CachedFile *cached_file)
+{
+    G_LOCK (cached_files);
+
+    if (g_hash_table_lookup (cached_files, filename) == cached_file)
+        g_hash_table_remove (cached_files, filename);
+
+    G_UNLOCK (cached_files);
+}
+
+static gint
+open_file (const char *filename)
+{
+    g_autofree char *path = get_root_path (filename);
+    gint fd = open (path, O_RDWR | O_CLOEXEC);
+
+    /* Write only node, value can't be checked */
+    if (fd == -1 && errno != ENOENT)
+        fd = open (path, O_WRONLY | O_CLOEXEC);
+
+    /* Missing nodes are expected: driver, kernel or service dependent */
+    if (fd == -1 && errno != ENOENT)
+        g_warning ("Can't open %s: %s", filename, g_strerror (errno));
+
+    return fd;
+}
+
+/* Kernel, or another process, may have changed node since our last write */
+static gboolean
+has_value (gint        fd,
+           const char *value)
+{
+    char current[MAX_VALUE_LEN];
+    size_t len = strlen (value);
+    ssize_t count;
+
+    if (len >= sizeof (current))
+        return FALSE;
+
+    do {
+        count = pread (fd, current, sizeof (current) - 1, 0);
+    } while (count == -1 && errno == EINTR);
+
+    if (count == -1)
+        return FALSE;
+
+    while (count > 0 && current[count - 1] == '\n')
+        count--;
+
+    return (size_t) count == len && memcmp (current, value, len) == 0;
+}
+
+static gboolean
+write_value (gint        fd,
+             const char *value)
+{
+    size_t len = strlen (value);
+    ssize_t written;
+
+    /* sysfs and cgroupfs only accept writes at offset 0 */
+    do {
+        written = pwrite (fd, value, len, 0);
+    } while (written == -1 && errno == EINTR);
+
+    return written == (ssize_t) len;
+}
+
+/**
+ * write_to_file:
+ *
+ * Write value to a sysfs/procfs/cgroupfs node. File descriptor is kept
+ * open and value is skipped if node already holds it.
+ * Safe to call from any thread.
+ *
+ * @param filename: node path
+ * @param value: value to write
+ *
+ * Returns: TRUE if node holds value
+ */
+gboolean
+write_to_file (const char *filename,
+               const char *value)
 {
-    FILE *file;
+    struct CachedFile *cached_file = get_cached_file (filename);
+    gboolean written = TRUE;
+    gint64 start;
 
-    if (!g_file_test (filename, G_FILE_TEST_EXISTS))
-        return;
+    g_mutex_lock (&cached_file->mutex);
 
-    file = fopen(filename, "w");
+    if (cached_file->fd == -1)
+        cached_file->fd = open_file (filename);
 
-    if (file == NULL)
-        g_warning ("Can't write to %s", filename);
-    else {
-        fprintf (file, "%s", value);
-        fclose (file);
+    /* Missing node, do not flood traces */
+    if (cached_file->fd == -1) {
+        written = FALSE;
+        goto unlock;
     }
-}
\ No newline at end of file
+
+    if (has_value (cached_file->fd, value))
+        goto unlock;
+
+    start = g_get_monotonic_time ();
+
+    if (!write_value (cached_file->fd, value)) {
+        gint error = errno;
+        /* Node may have been removed and recreated (cgroups, hotplug) */
+        gint fd = open_file (filename);
+
+        if (fd != -1 && write_value (fd, value)) {
+            close (cached_file->fd);
+            cached_file->fd = fd;
+        } else {
+            if (fd != -1) {
+                g_warning ("Can't write %s to %s: %s",
+                           value, filename, g_strerror (error));
+                close (fd);
+            }
+            written = FALSE;
+        }
+    }
+
+
+    trace_record (TRACE_WRITE, start, filename);
+unlock:
+    g_mutex_unlock (&cached_file->mutex);
+
+    if (!written)
+        forget_cached_file (filename, cached_file);
+    cached_file_unref (cached_file);
+
+    return written;
+}
+
+/**
+ * write_to_file_uncached:
+ *
+ * Write value to a node without keeping it open. Use it for nodes where
+ * writing the same value twice matters (cgroup.procs, ...).
+ *
+ * @param filename: node path
+ * @param value: value to write
+ *
+ * Returns: TRUE on success
+ */
+gboolean
+write_to_file_uncached (const char *filename,
+                        const char *value)
+{
+    gint fd = open_file (filename);
+    gboolean written;
+
+    if (fd == -1)
+        return FALSE;
+
+    written = write_value (fd, value);
+    if (!written)
+        g_warning ("Can't write %s to %s: %s",
+                   value, filename, g_strerror (errno));
+
+    close (fd);
+
+    return written;
+}
+
+/**
+ * forget_file:
+ *
+ * Close cached node, use it once node is removed (cgroups, ...)
+ *
+ * @param filename: node path
+ */
+void
+forget_file (const char *filename)
+{
+    G_LOCK (cached_files);
+
+    if (cached_files != NULL)
+        g_hash_table_remove (cached_files, filename);
+
+    G_UNLOCK (cached_files);
+}
+
+/**
+ * set_root_dir:
+ *
+ * Prefix every sysfs/procfs/cgroupfs path with root. Must be called
+ * before any other function of this file.
+ *
+ * @param root: (nullable): root directory, NULL for /
+ */
+void
+set_root_dir (const char *root)
+{
+    g_free (root_dir);
+    root_dir = g_strcmp0 (root, "/") == 0 ? NULL : g_strdup (root);
+}
+
+/**
+ * get_root_path:
+ *
+ * Get path under root directory
+ *
+ * @param path: absolute path
+ *
+ * Returns: (transfer full): path to use for IO
+ */
+char *
+get_root_path (const char *path)
+{
+    if (root_dir == NULL)
+        return g_strdup (path);
+
+    return g_build_filename (root_dir, path, NULL);
+}
+
+/**
+ * get_interface_bytes:
+ *
+ * Read a network interface byte counter from sysfs
+ *
+ * @param interface: interface name
+ * @param counter: "rx_bytes" or "tx_bytes"
+ *
+ * Returns: counter value, 0 if unavailable
+ */
+guint64
+get_interface_bytes (const char *interface,
+                     const char *counter)
+{
+    g_autofree char *contents = NULL;
+    g_autofree char *filename = g_build_filename (
+        "/sys/class/net", interface, "statistics", counter, NULL
+    );
+    g_autofree char *root_path = get_root_path (filename);
+
+    if (g_file_get_contents (root_path, &contents, NULL, NULL))
+        return g_ascii_strtoull (contents, NULL, 10);
+
+    return 0;
+}
@@ -12,4 +12,12 @@
         __glist_sub && (item = __glist_sub->data, TRUE); \
         __glist_sub = __glist_sub->next)
 
-void write_to_file (const char *filename, const char *value);
+gboolean write_to_file          (const char *filename,
+                                 const char *value);
+gboolean write_to_file_uncached (const char *filename,
+                                 const char *value);
+void     forget_file            (const char *filename);
+void     set_root_dir           (const char *root);
+char    *get_root_path          (const char *path);
+guint64  get_interface_bytes    (const char *interface,
+                                 const char *counter);
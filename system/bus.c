@@ -6,10 +6,12 @@
 
 #include "bus.h"
 #include "../common/define.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define ADISHATZ_DBUS_NAME "org.adishatz.Mps"
 #define ADISHATZ_DBUS_PATH "/org/adishatz/Mps"
+#define ADISHATZ_DBUS_STATS_INTERFACE "org.adishatz.Mps.Stats"
 
 #define HADESS_DBUS_NAME "net.hadess.PowerProfiles"
 #define HADESS_DBUS_PATH "/net/hadess/PowerProfiles"
@@ -20,6 +22,7 @@ enum
     POWER_SAVING_MODE_CHANGED,
     SCREEN_OFF_POWER_SAVING_CHANGED,
     SCREEN_OFF_SUSPEND_PROCESSES_CHANGED,
+    SCREEN_OFF_SUSPEND_PROCESSES_CGROUP_CHANGED,
     SCREEN_OFF_SUSPEND_SERVICES_CHANGED,
     SCREEN_STATE_CHANGED,
     DEVFREQ_BLACKLIST_SETTED,
@@ -27,6 +30,9 @@ enum
     SUSPEND_MODEM_CHANGED,
     RADIO_POWER_SAVING_CHANGED,
     RADIO_POWER_SAVING_BLACKLIST_CHANGED,
+    RADIO_POWER_SAVING_MIN_DWELL_CHANGED,
+    SCREEN_OFF_CPU_HOTPLUG_CHANGED,
+    DEEP_DOZE_CHANGED,
     LAST_SIGNAL
 };
 
@@ -100,17 +106,11 @@ get_profiles_variant (void)
 }
 
 static void
-handle_method_call (GDBusConnection       *connection,
-                    const char           *sender,
-                    const char           *object_path,
-                    const char           *interface_name,
-                    const char           *method_name,
-                    GVariant              *parameters,
-                    GDBusMethodInvocation *invocation,
-                    gpointer               user_data)
+dispatch_method_call (Bus                   *self,
+                      const char            *method_name,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation)
 {
-    Bus *self = user_data;
-
     if (g_strcmp0 (method_name, "HoldProfile") == 0) {
         /*
          * We do not want application to change power profile, on mobile
@@ -148,6 +148,13 @@ handle_method_call (GDBusConnection       *connection,
                 0,
                 g_steal_pointer (&value)
             );
+        } else if (g_strcmp0 (setting, "screen-off-suspend-processes-cgroup") == 0) {
+            g_signal_emit(
+                self,
+                signals[SCREEN_OFF_SUSPEND_PROCESSES_CGROUP_CHANGED],
+                0,
+                g_variant_get_boolean (value)
+            );
         } else if (g_strcmp0 (setting, "screen-off-suspend-system-services") == 0) {
             g_signal_emit(
                 self,
@@ -190,6 +197,27 @@ handle_method_call (GDBusConnection       *connection,
                 0,
                 g_variant_get_int32 (value)
             );
+        } else if (g_strcmp0 (setting, "radio-power-saving-min-dwell") == 0) {
+            g_signal_emit(
+                self,
+                signals[RADIO_POWER_SAVING_MIN_DWELL_CHANGED],
+                0,
+                g_variant_get_int32 (value)
+            );
+        } else if (g_strcmp0 (setting, "screen-off-cpu-hotplug") == 0) {
+            g_signal_emit(
+                self,
+                signals[SCREEN_OFF_CPU_HOTPLUG_CHANGED],
+                0,
+                g_variant_get_boolean (value)
+            );
+        } else if (g_strcmp0 (setting, "deep-doze") == 0) {
+            g_signal_emit(
+                self,
+                signals[DEEP_DOZE_CHANGED],
+                0,
+                g_variant_get_boolean (value)
+            );
         }
 
         g_dbus_method_invocation_return_value (
@@ -218,6 +246,23 @@ handle_method_call (GDBusConnection       *connection,
     }
 }
 
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const char           *sender,
+                    const char           *object_path,
+                    const char           *interface_name,
+                    const char           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+    gint64 start = g_get_monotonic_time ();
+
+    dispatch_method_call (user_data, method_name, parameters, invocation);
+
+    trace_record (TRACE_BUS_DISPATCH, start, method_name);
+}
+
 static GVariant *
 handle_get_property (GDBusConnection *connection,
                      const char     *sender,
@@ -321,12 +366,23 @@ on_bus_acquired (GDBusConnection *connection,
         NULL
     );
 
+    g_assert (registration_id > 0);
+
+    if (is_adishatz) {
+        registration_id = trace_register_object (
+            connection,
+            dbus_path,
+            g_dbus_node_info_lookup_interface (
+                introspection_data, ADISHATZ_DBUS_STATS_INTERFACE
+            )
+        );
+        g_assert (registration_id > 0);
+    }
+
     if (is_adishatz)
         self->priv->adishatz_connection = g_object_ref (connection);
     else
         self->priv->hadess_connection = g_object_ref (connection);
-
-    g_assert (registration_id > 0);
 }
 
 static void
@@ -454,6 +510,17 @@ bus_class_init (BusClass *klass)
         G_TYPE_VARIANT
     );
 
+    signals[SCREEN_OFF_SUSPEND_PROCESSES_CGROUP_CHANGED] = g_signal_new (
+        "screen-off-suspend-processes-cgroup-changed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        1,
+        G_TYPE_BOOLEAN
+    );
+
     signals[SCREEN_OFF_SUSPEND_SERVICES_CHANGED] = g_signal_new (
         "screen-off-suspend-services-changed",
         G_OBJECT_CLASS_TYPE (object_class),
@@ -530,6 +597,39 @@ bus_class_init (BusClass *klass)
         1,
         G_TYPE_INT
     );
+
+    signals[RADIO_POWER_SAVING_MIN_DWELL_CHANGED] = g_signal_new (
+        "radio-power-saving-min-dwell-changed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        1,
+        G_TYPE_INT
+    );
+
+    signals[SCREEN_OFF_CPU_HOTPLUG_CHANGED] = g_signal_new (
+        "screen-off-cpu-hotplug-changed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        1,
+        G_TYPE_BOOLEAN
+    );
+
+    signals[DEEP_DOZE_CHANGED] = g_signal_new (
+        "deep-doze-changed",
+        G_OBJECT_CLASS_TYPE (object_class),
+        G_SIGNAL_RUN_LAST,
+        0,
+        NULL, NULL, NULL,
+        G_TYPE_NONE,
+        1,
+        G_TYPE_BOOLEAN
+    );
 }
 
 static void
@@ -620,4 +720,18 @@ bus_screen_state_changed (Bus      *self,
         g_variant_new ("(b)", enabled),
         NULL
     );
+}
+
+void
+bus_interactive (Bus *self)
+{
+    g_dbus_connection_emit_signal (
+        self->priv->adishatz_connection,
+        NULL,
+        ADISHATZ_DBUS_PATH,
+        ADISHATZ_DBUS_NAME,
+        "Interactive",
+        NULL,
+        NULL
+    );
 }
\ No newline at end of file
@@ -46,6 +46,7 @@ GObject*    bus_new                  (void);
 Bus        *bus_get_default          (void);
 void        bus_screen_state_changed (Bus      *self,
                                       gboolean  enabled);
+void        bus_interactive          (Bus      *self);
 void        bus_free_default         (void);
 
 G_END_DECLS
@@ -10,10 +10,16 @@
 #include "cpufreq.h"
 #include "cpufreq_device.h"
 #include "../common/define.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 struct _CpufreqPrivate {
     GList *cpufreq_devices;
+
+    gboolean hotplug;
+    /* Policies with every CPU offline, writes would fail */
+    GList *offline_devices;
+    GArray *offline_cpus; /* guint */
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -23,33 +29,154 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (Cpufreq)
 )
 
+static const char *tier_names[] = { "little", "big", "prime" };
+
+static gint
+compare_uint (gconstpointer a,
+              gconstpointer b)
+{
+    guint value_a = *(const guint *) a;
+    guint value_b = *(const guint *) b;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+static guint
+get_performance (CpufreqDevice *cpufreq_device,
+                 gboolean       use_capacity)
+{
+    if (use_capacity)
+        return cpufreq_device_get_capacity (cpufreq_device);
+
+    return cpufreq_device_get_max_freq (cpufreq_device);
+}
+
+/*
+ * Lowest capacity is little, highest is prime if there are at
+ * least three levels, anything else is big.
+ */
+static void
+classify_devices (Cpufreq *self)
+{
+    g_autoptr (GArray) levels = g_array_new (FALSE, FALSE, sizeof (guint));
+    CpufreqDevice *cpufreq_device;
+    gboolean use_capacity = TRUE;
+    gboolean use_max_freq = TRUE;
+    guint lowest, highest;
+
+    GFOREACH (self->priv->cpufreq_devices, cpufreq_device) {
+        if (cpufreq_device_get_capacity (cpufreq_device) == 0)
+            use_capacity = FALSE;
+        if (cpufreq_device_get_max_freq (cpufreq_device) == 0)
+            use_max_freq = FALSE;
+    }
+
+    /* No topology: assume policy0 is the little cluster */
+    if (!use_capacity && !use_max_freq) {
+        g_warning ("No CPU topology, assuming policy0 is little cluster");
+        GFOREACH (self->priv->cpufreq_devices, cpufreq_device) {
+            const char *devname = freq_device_get_name (
+                FREQ_DEVICE (cpufreq_device)
+            );
+            cpufreq_device_set_tier (
+                cpufreq_device,
+                g_strcmp0 (devname, "policy0") == 0 ?
+                    CPUFREQ_TIER_LITTLE : CPUFREQ_TIER_BIG
+            );
+        }
+        return;
+    }
+
+    GFOREACH (self->priv->cpufreq_devices, cpufreq_device) {
+        guint performance = get_performance (cpufreq_device, use_capacity);
+        guint i;
+
+        for (i = 0; i < levels->len; i++)
+            if (g_array_index (levels, guint, i) == performance)
+                break;
+        if (i == levels->len)
+            g_array_append_val (levels, performance);
+    }
+
+    g_array_sort (levels, compare_uint);
+    lowest = g_array_index (levels, guint, 0);
+    highest = g_array_index (levels, guint, levels->len - 1);
+
+    GFOREACH (self->priv->cpufreq_devices, cpufreq_device) {
+        guint performance = get_performance (cpufreq_device, use_capacity);
+        CpufreqTier tier;
+
+        if (performance == lowest)
+            tier = CPUFREQ_TIER_LITTLE;
+        else if (performance == highest && levels->len > 2)
+            tier = CPUFREQ_TIER_PRIME;
+        else
+            tier = CPUFREQ_TIER_BIG;
+
+        cpufreq_device_set_tier (cpufreq_device, tier);
+        g_message ("%s: %s cluster (%s %u)",
+                   freq_device_get_name (FREQ_DEVICE (cpufreq_device)),
+                   tier_names[tier],
+                   use_capacity ? "capacity" : "max freq",
+                   performance);
+    }
+}
+
+static gboolean
+set_cpu_online (guint    cpu,
+                gboolean online)
+{
+    g_autofree char *filename = g_strdup_printf (CPU_DIR "cpu%u/online", cpu);
+    g_autofree char *detail = g_strdup_printf (
+        "cpu%u %s", cpu, online ? "online" : "offline"
+    );
+    gint64 start = g_get_monotonic_time ();
+    gboolean written;
+
+    /* Kernel may have to migrate tasks and IRQs, can be slow */
+    written = write_to_file_uncached (filename, online ? "1" : "0");
+    if (written) {
+        g_message ("%s in %" G_GINT64_FORMAT " ms",
+                   detail, (g_get_monotonic_time () - start) / 1000);
+        trace_record (TRACE_CPU_HOTPLUG, start, detail);
+    }
+
+    return written;
+}
+
 static void
 detect_devices (Cpufreq *self)
 {
     g_autoptr (GDir) policies_dir = NULL;
+    g_autofree char *dirname = get_root_path (CPUFREQ_POLICIES_DIR);
     const char *policy_dir;
 
-    policies_dir = g_dir_open (CPUFREQ_POLICIES_DIR, 0, NULL);
+    policies_dir = g_dir_open (dirname, 0, NULL);
     if (policies_dir == NULL) {
-        g_warning ("No cpufreq sysfs dir: %s", CPUFREQ_POLICIES_DIR);
+        g_warning ("No cpufreq sysfs dir: %s", dirname);
         return;
     }
 
     while ((policy_dir = g_dir_read_name (policies_dir)) != NULL) {
-        CpufreqDevice *cpufreq_device = CPUFREQ_DEVICE (cpufreq_device_new ());
+        CpufreqDevice *cpufreq_device;
         g_autofree char *filename = g_build_filename (
-            CPUFREQ_POLICIES_DIR, policy_dir, "scaling_governor", NULL
+            dirname, policy_dir, "scaling_governor", NULL
         );
 
         if (!g_file_test (filename, G_FILE_TEST_EXISTS))
             continue;
 
+        cpufreq_device = CPUFREQ_DEVICE (cpufreq_device_new ());
         freq_device_set_name (FREQ_DEVICE (cpufreq_device), policy_dir);
+        cpufreq_device_read_topology (cpufreq_device);
 
         self->priv->cpufreq_devices = g_list_prepend (
             self->priv->cpufreq_devices, cpufreq_device
         );
     }
+
+    if (self->priv->cpufreq_devices != NULL)
+        classify_devices (self);
 }
 
 static void
@@ -63,6 +190,8 @@ cpufreq_finalize (GObject *cpufreq)
 {
     Cpufreq *self = CPUFREQ (cpufreq);
 
+    g_list_free (self->priv->offline_devices);
+    g_array_unref (self->priv->offline_cpus);
     g_list_free_full (self->priv->cpufreq_devices, g_object_unref);
 
     G_OBJECT_CLASS (cpufreq_parent_class)->finalize (cpufreq);
@@ -84,6 +213,9 @@ cpufreq_init (Cpufreq *self)
     self->priv = cpufreq_get_instance_private (self);
 
     self->priv->cpufreq_devices = NULL;
+    self->priv->hotplug = FALSE;
+    self->priv->offline_devices = NULL;
+    self->priv->offline_cpus = g_array_new (FALSE, FALSE, sizeof (guint));
 
     detect_devices (self);
 }
@@ -109,21 +241,39 @@ cpufreq_new (void)
 /**
  * cpufreq_set_powersave:
  *
- * Set cpufreq devices to powersave
+ * Cap cpufreq devices frequencies. Light powersave caps big and prime
+ * tiers to an efficient frequency, deep powersave caps every tier to
+ * its lowest frequency.
  *
  * @param #Cpufreq
  * @param powersave: True to enable powersave
- * @param little_cluster: if TRUE, apply to little cluster too
+ * @param deep: if TRUE, deep powersave
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
-cpufreq_set_powersave (Cpufreq  *cpufreq,
-                       gboolean  powersave,
-                       gboolean    little_cluster) {
+cpufreq_set_powersave (Cpufreq        *cpufreq,
+                       gboolean        powersave,
+                       gboolean        deep,
+                       TransitionPlan *plan) {
     CpufreqDevice *cpufreq_device;
 
-    GFOREACH (cpufreq->priv->cpufreq_devices, cpufreq_device)
-        if (little_cluster || !cpufreq_is_little (cpufreq_device))
-            freq_device_set_powersave (FREQ_DEVICE (cpufreq_device), powersave);
+    GFOREACH (cpufreq->priv->cpufreq_devices, cpufreq_device) {
+        FreqCap cap;
+
+        if (g_list_find (cpufreq->priv->offline_devices, cpufreq_device))
+            continue;
+
+        if (!powersave)
+            cap = FREQ_CAP_NONE;
+        else if (deep)
+            cap = FREQ_CAP_LOWEST;
+        else if (cpufreq_device_get_tier (cpufreq_device) != CPUFREQ_TIER_LITTLE)
+            cap = FREQ_CAP_EFFICIENT;
+        else
+            cap = FREQ_CAP_NONE;
+
+        freq_device_set_powersave (FREQ_DEVICE (cpufreq_device), cap, plan);
+    }
 }
 
 /**
@@ -133,12 +283,87 @@ cpufreq_set_powersave (Cpufreq  *cpufreq,
  *
  * @param #Cpufreq
  * @param governor: new governor to set
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
-cpufreq_set_governor (Cpufreq    *cpufreq,
-                      const char *governor) {
+cpufreq_set_governor (Cpufreq        *cpufreq,
+                      const char     *governor,
+                      TransitionPlan *plan) {
     CpufreqDevice *cpufreq_device;
 
     GFOREACH (cpufreq->priv->cpufreq_devices, cpufreq_device)
-        freq_device_set_governor (FREQ_DEVICE (cpufreq_device), governor);
-}
\ No newline at end of file
+        freq_device_set_governor (
+            FREQ_DEVICE (cpufreq_device), governor, plan
+        );
+}
+
+/**
+ * cpufreq_set_hotplug:
+ *
+ * Allow big and prime CPUs to be taken offline
+ *
+ * @param #Cpufreq
+ * @param hotplug: True to allow CPU hotplug
+ */
+void
+cpufreq_set_hotplug (Cpufreq  *cpufreq,
+                     gboolean  hotplug)
+{
+    cpufreq->priv->hotplug = hotplug;
+
+    if (!hotplug)
+        cpufreq_set_cpus_online (cpufreq, TRUE);
+}
+
+/**
+ * cpufreq_set_cpus_online:
+ *
+ * Take big and prime CPUs offline if hotplug is allowed, or bring
+ * back online CPUs taken offline. Little tier always stays online.
+ *
+ * @param #Cpufreq
+ * @param online: True to bring CPUs back online
+ */
+void
+cpufreq_set_cpus_online (Cpufreq  *cpufreq,
+                         gboolean  online)
+{
+    CpufreqDevice *cpufreq_device;
+    guint i;
+
+    if (online) {
+        for (i = 0; i < cpufreq->priv->offline_cpus->len; i++)
+            set_cpu_online (
+                g_array_index (cpufreq->priv->offline_cpus, guint, i), TRUE
+            );
+        g_array_set_size (cpufreq->priv->offline_cpus, 0);
+        g_clear_pointer (&cpufreq->priv->offline_devices, g_list_free);
+        return;
+    }
+
+    if (!cpufreq->priv->hotplug)
+        return;
+
+    GFOREACH (cpufreq->priv->cpufreq_devices, cpufreq_device) {
+        GArray *cpus = cpufreq_device_get_cpus (cpufreq_device);
+        gboolean offline = TRUE;
+
+        if (cpufreq_device_get_tier (cpufreq_device) == CPUFREQ_TIER_LITTLE ||
+                g_list_find (cpufreq->priv->offline_devices, cpufreq_device))
+            continue;
+
+        for (i = 0; i < cpus->len; i++) {
+            guint cpu = g_array_index (cpus, guint, i);
+
+            if (set_cpu_online (cpu, FALSE))
+                g_array_append_val (cpufreq->priv->offline_cpus, cpu);
+            else
+                offline = FALSE;
+        }
+
+        if (offline && cpus->len != 0)
+            cpufreq->priv->offline_devices = g_list_prepend (
+                cpufreq->priv->offline_devices, cpufreq_device
+            );
+    }
+}
@@ -8,6 +8,8 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "../common/transition.h"
+
 #define TYPE_CPUFREQ \
     (cpufreq_get_type ())
 #define CPUFREQ(obj) \
@@ -44,11 +46,17 @@ struct _CpufreqClass {
 GType           cpufreq_get_type            (void) G_GNUC_CONST;
 
 GObject*        cpufreq_new                 (void);
-void            cpufreq_set_powersave       (Cpufreq  *cpufreq,
-                                             gboolean  powersave,
-                                             gboolean  little_cluster);
-void            cpufreq_set_governor        (Cpufreq    *cpufreq,
-                                             const char *governor);
+void            cpufreq_set_powersave       (Cpufreq        *cpufreq,
+                                             gboolean        powersave,
+                                             gboolean        deep,
+                                             TransitionPlan *plan);
+void            cpufreq_set_governor        (Cpufreq        *cpufreq,
+                                             const char     *governor,
+                                             TransitionPlan *plan);
+void            cpufreq_set_hotplug         (Cpufreq        *cpufreq,
+                                             gboolean        hotplug);
+void            cpufreq_set_cpus_online     (Cpufreq        *cpufreq,
+                                             gboolean        online);
 
 G_END_DECLS
 
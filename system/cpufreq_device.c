@@ -9,17 +9,48 @@
 
 #include "cpufreq_device.h"
 #include "../common/define.h"
+#include "../common/utils.h"
 
-/* struct _CpufreqDevicePrivate { */
-/* }; */
+struct _CpufreqDevicePrivate {
+    GArray *cpus; /* guint, from related_cpus */
+
+    /* 0 if unknown */
+    guint capacity;
+    guint max_freq;
+
+    CpufreqTier tier;
+};
 
 G_DEFINE_TYPE_WITH_CODE (
     CpufreqDevice,
     cpufreq_device,
     TYPE_FREQ_DEVICE,
-    /* G_ADD_PRIVATE (CpufreqDevice) */
+    G_ADD_PRIVATE (CpufreqDevice)
 )
 
+static char *
+read_node (const char *filename)
+{
+    g_autofree char *path = get_root_path (filename);
+    char *contents = NULL;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return NULL;
+
+    return g_strchomp (contents);
+}
+
+static guint
+read_uint (const char *filename)
+{
+    g_autofree char *contents = read_node (filename);
+
+    if (contents == NULL)
+        return 0;
+
+    return g_ascii_strtoull (contents, NULL, 10);
+}
+
 static void
 cpufreq_device_dispose (GObject *cpufreq_device)
 {
@@ -29,6 +60,10 @@ cpufreq_device_dispose (GObject *cpufreq_device)
 static void
 cpufreq_device_finalize (GObject *cpufreq_device)
 {
+    CpufreqDevice *self = CPUFREQ_DEVICE (cpufreq_device);
+
+    g_array_unref (self->priv->cpus);
+
     G_OBJECT_CLASS (cpufreq_device_parent_class)->finalize (cpufreq_device);
 }
 
@@ -46,10 +81,20 @@ static void
 cpufreq_device_init (CpufreqDevice *self)
 {
     self->priv = cpufreq_device_get_instance_private (self);
+    self->priv->cpus = g_array_new (FALSE, FALSE, sizeof (guint));
+    self->priv->capacity = 0;
+    self->priv->max_freq = 0;
+    self->priv->tier = CPUFREQ_TIER_LITTLE;
 
     freq_device_set_sysfs_settings (
         FREQ_DEVICE (self), CPUFREQ_POLICIES_DIR, "scaling_governor"
     );
+    freq_device_set_limit_nodes (
+        FREQ_DEVICE (self),
+        "scaling_available_frequencies",
+        "scaling_min_freq",
+        "scaling_max_freq"
+    );
 }
 
 /**
@@ -71,19 +116,135 @@ cpufreq_device_new (void)
 }
 
 /**
- * cpufreq_is_little:
+ * cpufreq_device_read_topology:
  *
- * check #CpufreqDevice type
+ * Read policy CPUs, capacity and max frequency. Device name must be set.
  *
  * @param #CpufreqDevice
  *
- * Returns: True if #CpufreqDevice is little cluster
- *
  **/
-gboolean
-cpufreq_is_little (CpufreqDevice *self)
+void
+cpufreq_device_read_topology (CpufreqDevice *self)
 {
     const char *devname = freq_device_get_name (FREQ_DEVICE (self));
+    g_autofree char *related_cpus = NULL;
+    g_autofree char *filename = NULL;
+    g_auto (GStrv) cpus = NULL;
+    guint i;
+
+    filename = g_build_filename (
+        CPUFREQ_POLICIES_DIR, devname, "cpuinfo_max_freq", NULL
+    );
+    self->priv->max_freq = read_uint (filename);
+    g_free (filename);
+
+    filename = g_build_filename (
+        CPUFREQ_POLICIES_DIR, devname, "related_cpus", NULL
+    );
+    related_cpus = read_node (filename);
+    if (related_cpus == NULL)
+        return;
+
+    g_array_set_size (self->priv->cpus, 0);
+    cpus = g_strsplit (related_cpus, " ", -1);
+    for (i = 0; cpus[i] != NULL; i++) {
+        guint cpu;
+
+        if (*cpus[i] == '\0')
+            continue;
+
+        cpu = g_ascii_strtoull (cpus[i], NULL, 10);
+        g_array_append_val (self->priv->cpus, cpu);
+    }
+
+    if (self->priv->cpus->len == 0)
+        return;
+
+    /* Same for every CPU of a policy */
+    g_free (filename);
+    filename = g_strdup_printf (
+        CPU_DIR "cpu%u/cpu_capacity",
+        g_array_index (self->priv->cpus, guint, 0)
+    );
+    self->priv->capacity = read_uint (filename);
+}
+
+/**
+ * cpufreq_device_get_cpus:
+ *
+ * Get CPUs handled by #CpufreqDevice
+ *
+ * @param #CpufreqDevice
+ *
+ * Returns: (transfer none): CPUs as guint
+ *
+ **/
+GArray *
+cpufreq_device_get_cpus (CpufreqDevice *self)
+{
+    return self->priv->cpus;
+}
+
+/**
+ * cpufreq_device_get_capacity:
+ *
+ * Get #CpufreqDevice scheduler capacity
+ *
+ * @param #CpufreqDevice
+ *
+ * Returns: capacity (1024 for biggest CPUs), 0 if unknown
+ *
+ **/
+guint
+cpufreq_device_get_capacity (CpufreqDevice *self)
+{
+    return self->priv->capacity;
+}
+
+/**
+ * cpufreq_device_get_max_freq:
+ *
+ * Get #CpufreqDevice max frequency
+ *
+ * @param #CpufreqDevice
+ *
+ * Returns: max frequency in kHz, 0 if unknown
+ *
+ **/
+guint
+cpufreq_device_get_max_freq (CpufreqDevice *self)
+{
+    return self->priv->max_freq;
+}
 
-    return g_strcmp0 (devname, "policy0") == 0;
-}
\ No newline at end of file
+/**
+ * cpufreq_device_set_tier:
+ *
+ * Set #CpufreqDevice capacity tier
+ *
+ * @param #CpufreqDevice
+ * @param tier: #CpufreqTier
+ *
+ **/
+void
+cpufreq_device_set_tier (CpufreqDevice *self,
+                         CpufreqTier    tier)
+{
+    self->priv->tier = tier;
+}
+
+/**
+ * cpufreq_device_get_tier:
+ *
+ * Get #CpufreqDevice capacity tier
+ *
+ * @param #CpufreqDevice
+ *
+ * Returns: #CpufreqTier
+ *
+ **/
+CpufreqTier
+cpufreq_device_get_tier (CpufreqDevice *self)
+{
+    return self->priv->tier;
+}
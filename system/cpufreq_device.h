@@ -30,6 +30,12 @@
 
 G_BEGIN_DECLS
 
+typedef enum {
+    CPUFREQ_TIER_LITTLE,
+    CPUFREQ_TIER_BIG,
+    CPUFREQ_TIER_PRIME
+} CpufreqTier;
+
 typedef struct _CpufreqDevice CpufreqDevice;
 typedef struct _CpufreqDeviceClass CpufreqDeviceClass;
 typedef struct _CpufreqDevicePrivate CpufreqDevicePrivate;
@@ -46,7 +52,13 @@ struct _CpufreqDeviceClass {
 GType           cpufreq_device_get_type         (void) G_GNUC_CONST;
 
 GObject*        cpufreq_device_new              (void);
-gboolean        cpufreq_is_little               (CpufreqDevice *self);
+void            cpufreq_device_read_topology    (CpufreqDevice *self);
+GArray*         cpufreq_device_get_cpus         (CpufreqDevice *self);
+guint           cpufreq_device_get_capacity     (CpufreqDevice *self);
+guint           cpufreq_device_get_max_freq     (CpufreqDevice *self);
+void            cpufreq_device_set_tier         (CpufreqDevice *self,
+                                                 CpufreqTier    tier);
+CpufreqTier     cpufreq_device_get_tier         (CpufreqDevice *self);
 
 G_END_DECLS
 
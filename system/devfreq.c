@@ -27,18 +27,19 @@ static void
 detect_devices (Devfreq *self)
 {
     g_autoptr (GDir) devfreq_dir = NULL;
+    g_autofree char *dirname = get_root_path (DEVFREQ_DIR);
     const char *device_dir;
 
-    devfreq_dir = g_dir_open (DEVFREQ_DIR, 0, NULL);
+    devfreq_dir = g_dir_open (dirname, 0, NULL);
     if (devfreq_dir == NULL) {
-        g_warning ("No devfreq sysfs dir: %s", DEVFREQ_DIR);
+        g_warning ("No devfreq sysfs dir: %s", dirname);
         return;
     }
 
     while ((device_dir = g_dir_read_name (devfreq_dir)) != NULL) {
         DevfreqDevice *devfreq_device = DEVFREQ_DEVICE (devfreq_device_new ());
         g_autofree char *filename = g_build_filename (
-            DEVFREQ_DIR, device_dir, "governor", NULL
+            dirname, device_dir, "governor", NULL
         );
 
         if (!g_file_test (filename, G_FILE_TEST_EXISTS))
@@ -136,18 +137,33 @@ devfreq_blacklist (Devfreq    *self,
 /**
  * devfreq_set_powersave:
  *
- * Set devfreq devices to powersave
+ * Cap devfreq devices frequencies: efficient frequency in light
+ * powersave, lowest frequency in deep powersave.
  *
  * @param #Devfreq
  * @param powersave: True to enable powersave
+ * @param deep: if TRUE, deep powersave
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
-devfreq_set_powersave (Devfreq  *self,
-                       gboolean  powersave) {
+devfreq_set_powersave (Devfreq        *self,
+                       gboolean        powersave,
+                       gboolean        deep,
+                       TransitionPlan *plan) {
     DevfreqDevice *devfreq_device;
+    FreqCap cap;
+
+    if (!powersave)
+        cap = FREQ_CAP_NONE;
+    else if (deep)
+        cap = FREQ_CAP_LOWEST;
+    else
+        cap = FREQ_CAP_EFFICIENT;
 
     GFOREACH (self->priv->devfreq_devices, devfreq_device)
-        freq_device_set_powersave (FREQ_DEVICE (devfreq_device), powersave);
+        freq_device_set_powersave (
+            FREQ_DEVICE (devfreq_device), cap, plan
+        );
 }
 
 /**
@@ -157,12 +173,16 @@ devfreq_set_powersave (Devfreq  *self,
  *
  * @param #Devfreq
  * @param governor: new governor to set
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
-devfreq_set_governor (Devfreq    *self,
-                      const char *governor) {
+devfreq_set_governor (Devfreq        *self,
+                      const char     *governor,
+                      TransitionPlan *plan) {
     DevfreqDevice *devfreq_device;
 
     GFOREACH (self->priv->devfreq_devices, devfreq_device)
-        freq_device_set_governor (FREQ_DEVICE (devfreq_device), governor);
+        freq_device_set_governor (
+            FREQ_DEVICE (devfreq_device), governor, plan
+        );
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "../common/transition.h"
+
 #define TYPE_DEVFREQ \
     (devfreq_get_type ())
 #define DEVFREQ(obj) \
@@ -46,10 +48,13 @@ GType           devfreq_get_type            (void) G_GNUC_CONST;
 GObject*        devfreq_new                 (void);
 void            devfreq_blacklist           (Devfreq    *self,
                                              const char *device_name);
-void            devfreq_set_powersave       (Devfreq     *self,
-                                             gboolean     powersave);
-void            devfreq_set_governor        (Devfreq    *self,
-                                             const char *governor);
+void            devfreq_set_powersave       (Devfreq        *self,
+                                             gboolean        powersave,
+                                             gboolean        deep,
+                                             TransitionPlan *plan);
+void            devfreq_set_governor        (Devfreq        *self,
+                                             const char     *governor,
+                                             TransitionPlan *plan);
 G_END_DECLS
 
 #endif
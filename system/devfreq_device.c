@@ -50,6 +50,9 @@ devfreq_device_init (DevfreqDevice *self)
     freq_device_set_sysfs_settings (
         FREQ_DEVICE (self), DEVFREQ_DIR, "governor"
     );
+    freq_device_set_limit_nodes (
+        FREQ_DEVICE (self), "available_frequencies", "min_freq", "max_freq"
+    );
 }
 
 /**
@@ -2,21 +2,56 @@
  * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
  */
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
 
 #include <gio/gio.h>
+#include <glib-unix.h>
 
 #include "freezer.h"
+#include "../common/cgroup.h"
+#include "../common/define.h"
+#include "../common/matcher.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define MAX_BUFSZ (1024*64*2)
 #define PROCPATHLEN 64  // must hold /proc/2000222000/task/2000222000/cmdline
+#define CONNECTOR_BUFSZ 4096
+/* Milliseconds, kernel must reach every task of the cgroup */
+#define FREEZE_TIMEOUT 2000
 
 struct _FreezerPrivate {
-    GList *processes;
+    Matcher *names;
+
+    /* struct Process, processes matching names */
+    GArray *matched;
+    /* pid: index in matched, for proc connector events */
+    GHashTable *indexes;
+    /* pid set, suspended processes */
+    GHashTable *processes;
+
+    /* Scratch buffer for cmdline reads */
+    char *buffer;
+
+    gint proc_fd;
+    gint connector_fd;
+    guint connector_id;
+
+    /* Processes moved to CGROUPS_PROCESSES_FREEZE_DIR */
+    gboolean cgroup_mode;
+    gboolean cgroup_frozen;
+    GCancellable *cgroup_cancellable;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -29,21 +64,24 @@ G_DEFINE_TYPE_WITH_CODE (
 struct Process {
     pid_t pid;
     char *cmdline;
+    /* Original cgroup, only set when moved to our cgroup */
+    char *cgroup;
 };
 
 static void
-process_free (gpointer user_data)
+process_clear (gpointer user_data)
 {
     struct Process *process = user_data;
 
     g_free (process->cmdline);
-    g_free (process);
+    g_free (process->cgroup);
 }
 
 // From https://gitlab.com/procps-ng/procps
 //
 static int read_unvectored(char *restrict const  dst,
                            unsigned              sz,
+                           int                   dirfd,
                            const char           *whom,
                            const char           *what,
                            char                  sep)
@@ -58,7 +96,7 @@ static int read_unvectored(char *restrict const  dst,
 
     len = snprintf(path, sizeof(path), "%s/%s", whom, what);
     if(len <= 0 || (size_t)len >= sizeof(path)) return 0;
-    fd = open(path, O_RDONLY);
+    fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
     if(fd==-1) return 0;
 
     for(;;){
@@ -87,59 +125,544 @@ static int read_unvectored(char *restrict const  dst,
 }
 
 static gboolean
-process_in_list (GList          *names,
-                 struct Process *process)
+is_pid (const char *name)
+{
+    if (*name == '\0')
+        return FALSE;
+
+    for (; *name != '\0'; name++)
+        if (!g_ascii_isdigit (*name))
+            return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+process_in_list (Matcher    *names,
+                 const char *cmdline)
+{
+    if (g_strcmp0 (cmdline, "") == 0)
+        return FALSE;
+
+    return matcher_match (names, cmdline);
+}
+
+static gint
+find_process (GHashTable *indexes,
+              pid_t       pid)
+{
+    gpointer index;
+
+    if (!g_hash_table_lookup_extended (
+            indexes, GINT_TO_POINTER (pid), NULL, &index))
+        return -1;
+
+    return GPOINTER_TO_INT (index);
+}
+
+static char *
+get_process_cgroup (Freezer *self,
+                    pid_t    pid)
+{
+    char directory[PROCPATHLEN];
+    g_auto (GStrv) lines = NULL;
+    gint i;
+
+    snprintf (directory, sizeof (directory), "%d", pid);
+
+    if (!read_unvectored (self->priv->buffer,
+                          MAX_BUFSZ,
+                          self->priv->proc_fd,
+                          directory,
+                          "cgroup",
+                          '\n'))
+        return NULL;
+
+    lines = g_strsplit (self->priv->buffer, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        g_autofree char *cgroup = NULL;
+
+        /* cgroup v2 unified hierarchy */
+        if (!g_str_has_prefix (lines[i], "0::"))
+            continue;
+
+        cgroup = g_build_filename (CGROUPS_DIR, lines[i] + 3, NULL);
+
+        /* Left by a previous instance, original cgroup is lost */
+        if (g_strcmp0 (cgroup, CGROUPS_PROCESSES_FREEZE_DIR) == 0)
+            return g_strdup (CGROUPS_DIR);
+
+        return g_steal_pointer (&cgroup);
+    }
+    return NULL;
+}
+
+static gboolean
+move_process (pid_t       pid,
+              const char *cgroup)
 {
-    char *name;
+    g_autofree char *filename = g_build_filename (
+        cgroup, "cgroup.procs", NULL
+    );
+    char value[PROCPATHLEN];
+
+    snprintf (value, sizeof (value), "%d", pid);
+    return write_to_file_uncached (filename, value);
+}
+
+static gboolean
+attach_process (Freezer        *self,
+                struct Process *process)
+{
+    g_autofree char *cgroup = NULL;
+
+    if (process->cgroup != NULL)
+        return TRUE;
 
-    if (g_strcmp0 (process->cmdline, "") == 0)
+    cgroup = get_process_cgroup (self, process->pid);
+    if (cgroup == NULL ||
+            !move_process (process->pid, CGROUPS_PROCESSES_FREEZE_DIR))
         return FALSE;
 
-    GFOREACH (names, name) {
-        if (g_strrstr (process->cmdline, name) != NULL)
-            return TRUE;
+    process->cgroup = g_steal_pointer (&cgroup);
+    return TRUE;
+}
+
+static void
+detach_process (Freezer        *self,
+                struct Process *process)
+{
+    if (process->cgroup == NULL)
+        return;
+
+    move_process (process->pid, process->cgroup);
+    g_clear_pointer (&process->cgroup, g_free);
+}
+
+/* Move process to our cgroup, or stop it if it can't be moved */
+static void
+suspend_process (Freezer        *self,
+                 struct Process *process)
+{
+    gpointer pid = GINT_TO_POINTER (process->pid);
+
+    if (self->priv->cgroup_mode) {
+        if (attach_process (self, process))
+            return;
+        g_warning ("Can't move %d to %s, stopping it",
+                   process->pid,
+                   CGROUPS_PROCESSES_FREEZE_DIR);
     }
-    return FALSE;
+
+    /* Suspended twice without resume, SIGCONT it only once */
+    if (g_hash_table_contains (self->priv->processes, pid))
+        return;
+
+    if (kill (process->pid, SIGSTOP) == 0)
+        g_hash_table_add (self->priv->processes, pid);
 }
 
-static GList *
-get_pids (Freezer *self)
+static struct Process *
+add_matched (Freezer    *self,
+             pid_t       pid,
+             const char *cmdline)
 {
-    GList *processes = NULL;
-    g_autoptr (GDir) proc_dir = NULL;
-    const char *pid_dir;
+    struct Process *process;
+    gint index = find_process (self->priv->indexes, pid);
+
+    if (index == -1) {
+        struct Process new_process = { pid, NULL, NULL };
+
+        g_array_append_val (self->priv->matched, new_process);
+        index = self->priv->matched->len - 1;
+        g_hash_table_insert (
+            self->priv->indexes, GINT_TO_POINTER (pid), GINT_TO_POINTER (index)
+        );
+    }
+
+    process = &g_array_index (self->priv->matched, struct Process, index);
+    g_free (process->cmdline);
+    process->cmdline = g_strdup (cmdline);
 
-    proc_dir = g_dir_open ("/proc", 0, NULL);
+    return process;
+}
+
+static void
+remove_matched (Freezer  *self,
+                pid_t     pid,
+                gboolean  running)
+{
+    gint index = find_process (self->priv->indexes, pid);
+    guint last = self->priv->matched->len - 1;
+
+    if (index == -1)
+        return;
+
+    if (running)
+        detach_process (
+            self, &g_array_index (self->priv->matched, struct Process, index)
+        );
+
+    /* Last process takes removed process place */
+    g_hash_table_remove (self->priv->indexes, GINT_TO_POINTER (pid));
+    if ((guint) index != last)
+        g_hash_table_insert (
+            self->priv->indexes,
+            GINT_TO_POINTER (
+                g_array_index (self->priv->matched, struct Process, last).pid
+            ),
+            GINT_TO_POINTER (index)
+        );
+
+    g_array_remove_index_fast (self->priv->matched, index);
+}
+
+static GArray *
+new_processes (void)
+{
+    GArray *processes = g_array_new (FALSE, FALSE, sizeof (struct Process));
+
+    g_array_set_clear_func (processes, process_clear);
+
+    return processes;
+}
+
+static void
+update_matched (Freezer *self)
+{
+    g_autoptr (GArray) previous = NULL;
+    g_autoptr (GHashTable) previous_indexes = NULL;
+    g_autofree char *proc_path = get_root_path ("/proc");
+    DIR *proc_dir;
+    struct dirent *entry;
+    gint64 start = g_get_monotonic_time ();
+    guint i;
+
+    /* Keep current table, and moved processes, if we can't scan */
+    proc_dir = opendir (proc_path);
     if (proc_dir == NULL) {
-        g_warning ("/proc not mounted");
-        return NULL;
+        g_warning ("%s not mounted", proc_path);
+        return;
+    }
+
+    previous = self->priv->matched;
+    previous_indexes = self->priv->indexes;
+    self->priv->matched = new_processes ();
+    self->priv->indexes = g_hash_table_new (NULL, NULL);
+
+    while ((entry = readdir (proc_dir)) != NULL) {
+        struct Process *process;
+        gint index;
+        pid_t pid;
+
+        /* Skip /proc/self, /proc/sys, ... before any syscall */
+        if (!is_pid (entry->d_name))
+            continue;
+
+        if (!read_unvectored (self->priv->buffer,
+                              MAX_BUFSZ,
+                              dirfd (proc_dir),
+                              entry->d_name,
+                              "cmdline",
+                              ' '))
+            continue;
+
+        if (!process_in_list (self->priv->names, self->priv->buffer))
+            continue;
+
+        pid = g_ascii_strtoll (entry->d_name, NULL, 10);
+        process = add_matched (self, pid, self->priv->buffer);
+
+        /* Keep original cgroup of already moved processes */
+        index = find_process (previous_indexes, pid);
+        if (index != -1)
+            process->cgroup = g_steal_pointer (
+                &g_array_index (previous, struct Process, index).cgroup
+            );
     }
 
-    while ((pid_dir = g_dir_read_name (proc_dir)) != NULL) {
-        g_autofree char *contents = NULL;
-        g_autofree char *directory = g_build_filename (
-            "/proc", pid_dir, NULL
+    closedir (proc_dir);
+
+    for (i = 0; i < previous->len; i++)
+        detach_process (self, &g_array_index (previous, struct Process, i));
+
+    /* Resynced while frozen: freeze new processes too */
+    if (self->priv->cgroup_frozen)
+        for (i = 0; i < self->priv->matched->len; i++)
+            suspend_process (
+                self, &g_array_index (self->priv->matched, struct Process, i)
+            );
+
+    trace_record (TRACE_FREEZER_SCAN, start, NULL);
+}
+
+static void
+on_process_exec (Freezer *self,
+                 pid_t    pid)
+{
+    char directory[PROCPATHLEN];
+
+    snprintf (directory, sizeof (directory), "%d", pid);
+
+    if (read_unvectored (self->priv->buffer,
+                         MAX_BUFSZ,
+                         self->priv->proc_fd,
+                         directory,
+                         "cmdline",
+                         ' ') &&
+            process_in_list (self->priv->names, self->priv->buffer)) {
+        struct Process *process = add_matched (
+            self, pid, self->priv->buffer
         );
 
-        if ((contents = g_malloc (MAX_BUFSZ)) == NULL)
-            return NULL;
+        /* Started while frozen */
+        if (self->priv->cgroup_frozen)
+            suspend_process (self, process);
+    } else {
+        remove_matched (self, pid, TRUE);
+    }
+}
+
+static void
+on_process_fork (Freezer *self,
+                 pid_t    parent,
+                 pid_t    child)
+{
+    gint index = find_process (self->priv->indexes, parent);
+    g_autofree char *cmdline = NULL;
+    g_autofree char *cgroup = NULL;
+    struct Process *process;
 
-        if (read_unvectored(contents, MAX_BUFSZ, directory, "cmdline", ' ')) {
-            struct Process *process = g_malloc (sizeof (struct Process));
+    if (index == -1)
+        return;
 
-            process->cmdline = g_strdup (contents);
-            sscanf (pid_dir, "%d", &process->pid);
+    /* add_matched() may reallocate the array */
+    process = &g_array_index (self->priv->matched, struct Process, index);
+    cmdline = g_strdup (process->cmdline);
+    cgroup = g_strdup (process->cgroup);
 
-            processes = g_list_prepend (processes, process);
+    /* Child is already in parent cgroup, just remember origin */
+    process = add_matched (self, child, cmdline);
+    g_free (process->cgroup);
+    process->cgroup = g_steal_pointer (&cgroup);
+}
+
+static void
+on_process_exit (Freezer *self,
+                 pid_t    pid)
+{
+    remove_matched (self, pid, FALSE);
+
+    /* Do not send SIGCONT to a recycled pid */
+    g_hash_table_remove (self->priv->processes, GINT_TO_POINTER (pid));
+}
+
+static gboolean
+on_connector_event (gint         fd,
+                    GIOCondition condition,
+                    gpointer     user_data)
+{
+    Freezer *self = FREEZER (user_data);
+    union {
+        struct nlmsghdr header;
+        char data[CONNECTOR_BUFSZ];
+    } buffer;
+    ssize_t len;
+
+    while ((len = recv (fd, &buffer, sizeof (buffer), 0)) != 0) {
+        struct nlmsghdr *header;
+
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            /* We lost some events, get back in sync */
+            if (errno == ENOBUFS) {
+                update_matched (self);
+                continue;
+            }
+            break;
+        }
+
+        for (header = &buffer.header;
+                NLMSG_OK (header, (size_t) len);
+                header = NLMSG_NEXT (header, len)) {
+            struct cn_msg *message;
+            struct proc_event *event;
+
+            if (header->nlmsg_type == NLMSG_NOOP)
+                continue;
+            if (header->nlmsg_type == NLMSG_ERROR ||
+                    header->nlmsg_type == NLMSG_OVERRUN)
+                break;
+
+            message = NLMSG_DATA (header);
+            event = (void *) message->data;
+
+            if (event->what == PROC_EVENT_EXEC) {
+                on_process_exec (self, event->event_data.exec.process_tgid);
+            } else if (event->what == PROC_EVENT_FORK) {
+                /* Ignore new threads */
+                if (event->event_data.fork.child_pid ==
+                        event->event_data.fork.child_tgid)
+                    on_process_fork (self,
+                                     event->event_data.fork.parent_tgid,
+                                     event->event_data.fork.child_tgid);
+            } else if (event->what == PROC_EVENT_EXIT) {
+                if (event->event_data.exit.process_pid ==
+                        event->event_data.exit.process_tgid)
+                    on_process_exit (self, event->event_data.exit.process_tgid);
+            }
         }
     }
 
-    return processes;
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+connector_set_listen (gint                  fd,
+                      enum proc_cn_mcast_op op)
+{
+    union {
+        struct nlmsghdr header;
+        char data[NLMSG_SPACE (sizeof (struct cn_msg) +
+                               sizeof (enum proc_cn_mcast_op))];
+    } buffer;
+    struct cn_msg *message;
+
+    memset (&buffer, 0, sizeof (buffer));
+
+    buffer.header.nlmsg_len = NLMSG_LENGTH (
+        sizeof (struct cn_msg) + sizeof (enum proc_cn_mcast_op)
+    );
+    buffer.header.nlmsg_type = NLMSG_DONE;
+    buffer.header.nlmsg_pid = getpid ();
+
+    message = NLMSG_DATA (&buffer.header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof (enum proc_cn_mcast_op);
+    memcpy (message->data, &op, sizeof (enum proc_cn_mcast_op));
+
+    return send (fd, &buffer, buffer.header.nlmsg_len, 0) != -1;
+}
+
+static void
+connector_close (Freezer *self)
+{
+    g_clear_handle_id (&self->priv->connector_id, g_source_remove);
+
+    if (self->priv->connector_fd != -1) {
+        connector_set_listen (self->priv->connector_fd, PROC_CN_MCAST_IGNORE);
+        close (self->priv->connector_fd);
+        self->priv->connector_fd = -1;
+    }
+}
+
+static void
+connector_open (Freezer *self)
+{
+    struct sockaddr_nl address = { 0 };
+    gint fd;
+
+    if (self->priv->connector_fd != -1)
+        return;
+
+    fd = socket (
+        PF_NETLINK,
+        SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        NETLINK_CONNECTOR
+    );
+    if (fd == -1) {
+        g_warning ("Can't open proc connector: %s", g_strerror (errno));
+        return;
+    }
+
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = CN_IDX_PROC;
+    address.nl_pid = getpid ();
+
+    if (bind (fd, (struct sockaddr *) &address, sizeof (address)) == -1 ||
+            !connector_set_listen (fd, PROC_CN_MCAST_LISTEN)) {
+        g_warning ("Can't listen to proc connector: %s", g_strerror (errno));
+        close (fd);
+        return;
+    }
+
+    self->priv->connector_fd = fd;
+    self->priv->connector_id = g_unix_fd_add (
+        fd, G_IO_IN, on_connector_event, self
+    );
+}
+
+static void
+detach_processes (Freezer *self)
+{
+    guint i;
+
+    for (i = 0; i < self->priv->matched->len; i++)
+        detach_process (
+            self, &g_array_index (self->priv->matched, struct Process, i)
+        );
+}
+
+static void
+on_cgroup_frozen (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    if (!cgroup_freeze_finish (res, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Processes not frozen: %s", error->message);
+        return;
+    }
+
+    g_message ("Processes frozen");
+}
+
+static void
+cgroup_close (Freezer *self)
+{
+    g_cancellable_cancel (self->priv->cgroup_cancellable);
+
+    if (self->priv->cgroup_frozen) {
+        write_to_file (CGROUPS_PROCESSES_FREEZE_DIR "/cgroup.freeze", "0");
+        self->priv->cgroup_frozen = FALSE;
+    }
+
+    detach_processes (self);
+}
+
+static gboolean
+cgroup_open (Freezer *self)
+{
+    g_autofree char *dirname = get_root_path (CGROUPS_PROCESSES_FREEZE_DIR);
+
+    if (g_mkdir_with_parents (dirname, 0755) == -1) {
+        g_warning ("Can't create %s: %s", dirname, g_strerror (errno));
+        return FALSE;
+    }
+
+    /* May be left frozen by a previous instance */
+    write_to_file (CGROUPS_PROCESSES_FREEZE_DIR "/cgroup.freeze", "0");
+
+    return TRUE;
 }
 
 static void
 freezer_dispose (GObject *freezer)
 {
+    Freezer *self = FREEZER (freezer);
+
+    connector_close (self);
+
+    /* Do not leave processes frozen in our cgroup */
+    if (self->priv->cgroup_mode) {
+        cgroup_close (self);
+        self->priv->cgroup_mode = FALSE;
+    }
+
     G_OBJECT_CLASS (freezer_parent_class)->dispose (freezer);
 }
 
@@ -148,7 +671,15 @@ freezer_finalize (GObject *freezer)
 {
     Freezer *self = FREEZER (freezer);
 
-    g_list_free_full (self->priv->processes, process_free);
+    g_clear_object (&self->priv->names);
+    g_clear_object (&self->priv->cgroup_cancellable);
+    g_array_unref (self->priv->matched);
+    g_hash_table_destroy (self->priv->indexes);
+    g_hash_table_destroy (self->priv->processes);
+    g_free (self->priv->buffer);
+
+    if (self->priv->proc_fd != -1)
+        close (self->priv->proc_fd);
 
     G_OBJECT_CLASS (freezer_parent_class)->finalize (freezer);
 }
@@ -166,9 +697,22 @@ freezer_class_init (FreezerClass *klass)
 static void
 freezer_init (Freezer *self)
 {
+    g_autofree char *proc_path = NULL;
+
     self->priv = freezer_get_instance_private (self);
 
-    self->priv->processes = NULL;
+    self->priv->names = MATCHER (matcher_new ());
+    self->priv->matched = new_processes ();
+    self->priv->indexes = g_hash_table_new (NULL, NULL);
+    self->priv->processes = g_hash_table_new (NULL, NULL);
+    self->priv->buffer = g_malloc (MAX_BUFSZ);
+    proc_path = get_root_path ("/proc");
+    self->priv->proc_fd = open (proc_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    self->priv->connector_fd = -1;
+    self->priv->connector_id = 0;
+    self->priv->cgroup_mode = FALSE;
+    self->priv->cgroup_frozen = FALSE;
+    self->priv->cgroup_cancellable = g_cancellable_new ();
 }
 
 /**
@@ -190,25 +734,107 @@ freezer_new (void)
 }
 
 /**
- * freezer_suspend_processes:
+ * freezer_set_processes:
  *
- * Suspend processes in list
+ * Set processes to suspend
  *
  * @param #Freezer
  * @param names: processes list
  */
 void
-freezer_suspend_processes (Freezer *self,
-                           GList   *names) {
+freezer_set_processes (Freezer *self,
+                       GList   *names)
+{
+    matcher_set_patterns (self->priv->names, names);
 
-    struct Process *process;
+    if (matcher_is_empty (self->priv->names)) {
+        connector_close (self);
+        detach_processes (self);
+        g_array_set_size (self->priv->matched, 0);
+        g_hash_table_remove_all (self->priv->indexes);
+        return;
+    }
+
+    /* Listen before scanning so we do not miss any process */
+    connector_open (self);
+    update_matched (self);
+}
+
+/**
+ * freezer_set_cgroup:
+ *
+ * Freeze processes with cgroup v2 freezer instead of signals
+ *
+ * @param #Freezer
+ * @param cgroup: TRUE to move processes to a dedicated cgroup
+ */
+void
+freezer_set_cgroup (Freezer  *self,
+                    gboolean  cgroup)
+{
+    if (self->priv->cgroup_mode == cgroup)
+        return;
+
+    if (!cgroup) {
+        cgroup_close (self);
+        self->priv->cgroup_mode = FALSE;
+        return;
+    }
 
-    self->priv->processes = get_pids (self);
-    g_return_if_fail (self->priv->processes != NULL);
+    if (!cgroup_open (self))
+        return;
 
-    GFOREACH (self->priv->processes, process)
-        if (process_in_list (names, process))
-            kill (process->pid, SIGSTOP);
+    self->priv->cgroup_mode = TRUE;
+}
+
+/**
+ * freezer_suspend_processes:
+ *
+ * Suspend processes
+ *
+ * @param #Freezer
+ */
+void
+freezer_suspend_processes (Freezer *self) {
+    GList *cgroups;
+    gboolean attached = FALSE;
+    guint i;
+
+    if (matcher_is_empty (self->priv->names))
+        return;
+
+    /* Without proc connector, our table may be outdated */
+    if (self->priv->connector_fd == -1)
+        update_matched (self);
+
+    /* Processes only leave their unit while frozen */
+    for (i = 0; i < self->priv->matched->len; i++) {
+        struct Process *process = &g_array_index (
+            self->priv->matched, struct Process, i
+        );
+
+        suspend_process (self, process);
+        if (process->cgroup != NULL)
+            attached = TRUE;
+    }
+
+    if (!attached)
+        return;
+
+    /* One write freezes every process, kernel handles new children */
+    g_cancellable_cancel (self->priv->cgroup_cancellable);
+    g_clear_object (&self->priv->cgroup_cancellable);
+    self->priv->cgroup_cancellable = g_cancellable_new ();
+
+    cgroups = g_list_append (NULL, (gpointer) CGROUPS_PROCESSES_FREEZE_DIR);
+    cgroup_freeze_async (cgroups,
+                         TRUE,
+                         FREEZE_TIMEOUT,
+                         self->priv->cgroup_cancellable,
+                         on_cgroup_frozen,
+                         NULL);
+    g_list_free (cgroups);
+    self->priv->cgroup_frozen = TRUE;
 }
 
 /**
@@ -217,22 +843,41 @@ freezer_suspend_processes (Freezer *self,
  * resume processes
  *
  * @param #Freezer
- * @param names: processes list
  *
  */
 void
-freezer_resume_processes (Freezer *self,
-                          GList   *names) {
+freezer_resume_processes (Freezer *self) {
+    GHashTableIter iter;
+    gpointer pid;
+
+    if (self->priv->cgroup_frozen) {
+        g_cancellable_cancel (self->priv->cgroup_cancellable);
+        write_to_file (CGROUPS_PROCESSES_FREEZE_DIR "/cgroup.freeze", "0");
+        self->priv->cgroup_frozen = FALSE;
+    }
 
-    struct Process *process;
+    /* Back to their unit until next suspend */
+    detach_processes (self);
 
-    if (self->priv->processes == NULL)
-        return;
+    g_hash_table_iter_init (&iter, self->priv->processes);
+    while (g_hash_table_iter_next (&iter, &pid, NULL))
+        kill (GPOINTER_TO_INT (pid), SIGCONT);
 
-    GFOREACH (self->priv->processes, process)
-        if (process_in_list (names, process))
-            kill (process->pid, SIGCONT);
+    g_hash_table_remove_all (self->priv->processes);
+}
 
-    g_list_free_full (self->priv->processes, g_free);
-    self->priv->processes = NULL;
-}
\ No newline at end of file
+/**
+ * freezer_is_event_driven:
+ *
+ * Check if process table is fed by proc connector, otherwise /proc is
+ * scanned on each suspend
+ *
+ * @param #Freezer
+ *
+ * Returns: TRUE if proc connector is used
+ */
+gboolean
+freezer_is_event_driven (Freezer *self)
+{
+    return self->priv->connector_fd != -1;
+}
@@ -44,10 +44,13 @@ struct _FreezerClass {
 GType           freezer_get_type            (void) G_GNUC_CONST;
 
 GObject*        freezer_new                 (void);
-void            freezer_suspend_processes   (Freezer *freezer,
-                                             GList   *names);
-void            freezer_resume_processes    (Freezer *freezer,
+void            freezer_set_processes       (Freezer *freezer,
                                              GList   *names);
+void            freezer_set_cgroup          (Freezer  *freezer,
+                                             gboolean  cgroup);
+void            freezer_suspend_processes   (Freezer *freezer);
+void            freezer_resume_processes    (Freezer *freezer);
+gboolean        freezer_is_event_driven     (Freezer *freezer);
 G_END_DECLS
 
 #endif
@@ -5,8 +5,12 @@
 #include <gio/gio.h>
 
 #include "freq_device.h"
+#include "../common/transition.h"
 #include "../common/utils.h"
 
+/* Efficient cap: highest frequency below this share of max frequency */
+#define EFFICIENT_PERCENT 60
+
 struct _FreqDevicePrivate {
     char *sysfs_dir;
     char *device_name;
@@ -14,6 +18,18 @@ struct _FreqDevicePrivate {
 
     char *default_governor;
     char *current_governor;
+
+    char *available_node;
+    char *min_node;
+    char *max_node;
+
+    /* Sorted, empty if device can't be capped */
+    GArray *frequencies; /* guint64 */
+    /* Limits restored once uncapped */
+    char *default_min;
+    char *default_max;
+
+    FreqCap cap;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -24,19 +40,156 @@ G_DEFINE_TYPE_WITH_CODE (
 )
 
 static void
-set_governor (FreqDevice *freq_device,
-              const char *governor)
+set_governor (FreqDevice     *freq_device,
+              const char     *governor,
+              TransitionPlan *plan)
 {
-    g_autofree char *filename = g_build_filename (
+    g_autofree char *directory = g_build_filename (
         freq_device->priv->sysfs_dir,
         freq_device->priv->device_name,
-        freq_device->priv->governor_node,
         NULL
     );
+    g_autofree char *filename = g_build_filename (
+        directory, freq_device->priv->governor_node, NULL
+    );
 
     g_message ("%s -> %s", filename, governor);
 
-    write_to_file (filename, governor);
+    transition_plan_write (plan, directory, filename, governor);
+}
+
+static char *
+read_node (FreqDevice *self,
+           const char *node)
+{
+    g_autofree char *filename = g_build_filename (
+        self->priv->sysfs_dir, self->priv->device_name, node, NULL
+    );
+    g_autofree char *path = get_root_path (filename);
+    char *contents = NULL;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return NULL;
+
+    return g_strchomp (contents);
+}
+
+static gint
+compare_frequency (gconstpointer a,
+                   gconstpointer b)
+{
+    guint64 frequency_a = *(const guint64 *) a;
+    guint64 frequency_b = *(const guint64 *) b;
+
+    return (frequency_a > frequency_b) - (frequency_a < frequency_b);
+}
+
+static void
+read_frequencies (FreqDevice *self)
+{
+    g_autofree char *available = NULL;
+    g_auto (GStrv) frequencies = NULL;
+    guint i;
+
+    if (self->priv->available_node == NULL)
+        return;
+
+    available = read_node (self, self->priv->available_node);
+    if (available == NULL)
+        return;
+
+    frequencies = g_strsplit (available, " ", -1);
+    for (i = 0; frequencies[i] != NULL; i++) {
+        guint64 frequency;
+
+        if (*frequencies[i] == '\0')
+            continue;
+
+        frequency = g_ascii_strtoull (frequencies[i], NULL, 10);
+        g_array_append_val (self->priv->frequencies, frequency);
+    }
+
+    if (self->priv->frequencies->len == 0)
+        return;
+
+    g_array_sort (self->priv->frequencies, compare_frequency);
+
+    /* Limits set by vendor, thermal daemon or user, restored as is */
+    self->priv->default_min = read_node (self, self->priv->min_node);
+    self->priv->default_max = read_node (self, self->priv->max_node);
+
+    if (self->priv->default_min == NULL || self->priv->default_max == NULL) {
+        g_clear_pointer (&self->priv->default_min, g_free);
+        g_clear_pointer (&self->priv->default_max, g_free);
+        g_array_set_size (self->priv->frequencies, 0);
+        return;
+    }
+
+    g_message ("default limits: %s -> %s/%s",
+               self->priv->device_name,
+               self->priv->default_min,
+               self->priv->default_max);
+}
+
+static guint64
+get_cap_frequency (FreqDevice *self,
+                   FreqCap     cap)
+{
+    GArray *frequencies = self->priv->frequencies;
+    guint64 max = g_array_index (frequencies, guint64, frequencies->len - 1);
+    guint64 efficient = max * EFFICIENT_PERCENT / 100;
+    guint i;
+
+    if (cap == FREQ_CAP_LOWEST)
+        return g_array_index (frequencies, guint64, 0);
+
+    for (i = frequencies->len - 1; i > 0; i--)
+        if (g_array_index (frequencies, guint64, i) <= efficient)
+            break;
+
+    return g_array_index (frequencies, guint64, i);
+}
+
+static void
+set_limits (FreqDevice     *self,
+            FreqCap         cap,
+            TransitionPlan *plan)
+{
+    g_autofree char *directory = g_build_filename (
+        self->priv->sysfs_dir, self->priv->device_name, NULL
+    );
+    g_autofree char *min_filename = g_build_filename (
+        directory, self->priv->min_node, NULL
+    );
+    g_autofree char *max_filename = g_build_filename (
+        directory, self->priv->max_node, NULL
+    );
+    g_autofree char *min = NULL;
+    g_autofree char *max = NULL;
+
+    /* Min can't go above max, write in an order kernel accepts */
+    if (cap == FREQ_CAP_NONE) {
+        g_message ("%s -> %s/%s",
+                   directory,
+                   self->priv->default_min,
+                   self->priv->default_max);
+        transition_plan_write (
+            plan, directory, max_filename, self->priv->default_max
+        );
+        transition_plan_write (
+            plan, directory, min_filename, self->priv->default_min
+        );
+        return;
+    }
+
+    min = g_strdup_printf (
+        "%" G_GUINT64_FORMAT, g_array_index (self->priv->frequencies, guint64, 0)
+    );
+    max = g_strdup_printf ("%" G_GUINT64_FORMAT, get_cap_frequency (self, cap));
+
+    g_message ("%s -> %s/%s", directory, min, max);
+    transition_plan_write (plan, directory, min_filename, min);
+    transition_plan_write (plan, directory, max_filename, max);
 }
 
 static void
@@ -55,6 +208,12 @@ freq_device_finalize (GObject *freq_device)
     g_free (self->priv->device_name);
     g_free (self->priv->governor_node);
     g_free (self->priv->sysfs_dir);
+    g_free (self->priv->available_node);
+    g_free (self->priv->min_node);
+    g_free (self->priv->max_node);
+    g_free (self->priv->default_min);
+    g_free (self->priv->default_max);
+    g_array_unref (self->priv->frequencies);
 
     G_OBJECT_CLASS (freq_device_parent_class)->finalize (freq_device);
 }
@@ -79,6 +238,13 @@ freq_device_init (FreqDevice *self)
     self->priv->governor_node = NULL;
     self->priv->default_governor = NULL;
     self->priv->current_governor = NULL;
+    self->priv->available_node = NULL;
+    self->priv->min_node = NULL;
+    self->priv->max_node = NULL;
+    self->priv->default_min = NULL;
+    self->priv->default_max = NULL;
+    self->priv->frequencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+    self->priv->cap = FREQ_CAP_NONE;
 }
 
 /**
@@ -123,6 +289,29 @@ freq_device_set_sysfs_settings (FreqDevice *self,
     self->priv->governor_node = g_strdup (governor_node);
 }
 
+/**
+ * freq_device_set_limit_nodes:
+ *
+ * Set #FreqDevice frequency limits nodes, must be called before
+ * freq_device_set_name()
+ *
+ * @self: #FreqDevice
+ * @available_node: sysfs node listing available frequencies
+ * @min_node: sysfs min frequency node
+ * @max_node: sysfs max frequency node
+ *
+ **/
+void
+freq_device_set_limit_nodes (FreqDevice *self,
+                             const char *available_node,
+                             const char *min_node,
+                             const char *max_node)
+{
+    self->priv->available_node = g_strdup (available_node);
+    self->priv->min_node = g_strdup (min_node);
+    self->priv->max_node = g_strdup (max_node);
+}
+
 /**
  * freq_device_set_name:
  *
@@ -141,10 +330,11 @@ freq_device_set_name (FreqDevice *self,
     g_autofree char *filename = g_build_filename (
         self->priv->sysfs_dir, device_name, self->priv->governor_node, NULL
     );
+    g_autofree char *path = get_root_path (filename);
 
     self->priv->device_name = g_strdup (device_name);
 
-    if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+    if (g_file_get_contents (path, &contents, NULL, NULL)) {
         contents = g_strchomp (contents);
 
         if (self->priv->default_governor != NULL)
@@ -155,6 +345,8 @@ freq_device_set_name (FreqDevice *self,
                   filename,
                   self->priv->default_governor);
     }
+
+    read_frequencies (self);
 }
 
 /**
@@ -176,21 +368,31 @@ freq_device_get_name (FreqDevice  *self)
 /**
  * freq_device_set_powersave:
  *
- * Set freq device to powersave
+ * Cap freq device frequencies, governor keeps running below cap.
+ * Devices without available frequencies use powersave governor.
  *
  * @param #FreqDevice
- * @param powersave: True to enable powersave
+ * @param cap: #FreqCap to apply
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
-freq_device_set_powersave (FreqDevice *self,
-                           gboolean    powersave)
+freq_device_set_powersave (FreqDevice     *self,
+                           FreqCap         cap,
+                           TransitionPlan *plan)
 {
-    if (powersave)
-        set_governor (self, "powersave");
+    if (cap == self->priv->cap)
+        return;
+
+    self->priv->cap = cap;
+
+    if (self->priv->frequencies->len != 0)
+        set_limits (self, cap, plan);
+    else if (cap != FREQ_CAP_NONE)
+        set_governor (self, "powersave", plan);
     else if (self->priv->current_governor != NULL)
-        set_governor (self, self->priv->current_governor);
+        set_governor (self, self->priv->current_governor, plan);
     else
-        set_governor (self, self->priv->default_governor);
+        set_governor (self, self->priv->default_governor, plan);
 }
 
 /**
@@ -200,10 +402,12 @@ freq_device_set_powersave (FreqDevice *self,
  *
  * @param #FreqDevice
  * @param governor: new governor to set
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
-freq_device_set_governor (FreqDevice *self,
-                          const char *governor)
+freq_device_set_governor (FreqDevice     *self,
+                          const char     *governor,
+                          TransitionPlan *plan)
 {
     if (self->priv->current_governor != NULL)
         g_free (self->priv->current_governor);
@@ -212,5 +416,5 @@ freq_device_set_governor (FreqDevice *self,
         self->priv->current_governor = g_strdup (self->priv->default_governor);
     else
         self->priv->current_governor = g_strdup (governor);
-    set_governor (self, self->priv->current_governor);
+    set_governor (self, self->priv->current_governor, plan);
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "../common/transition.h"
+
 #define TYPE_FREQ_DEVICE \
     (freq_device_get_type ())
 #define FREQ_DEVICE(obj) \
@@ -28,6 +30,13 @@
 
 G_BEGIN_DECLS
 
+typedef enum {
+    FREQ_CAP_NONE,
+    /* Keep some headroom so background work can race to idle */
+    FREQ_CAP_EFFICIENT,
+    FREQ_CAP_LOWEST
+} FreqCap;
+
 typedef struct _FreqDevice FreqDevice;
 typedef struct _FreqDeviceClass FreqDeviceClass;
 typedef struct _FreqDevicePrivate FreqDevicePrivate;
@@ -47,13 +56,19 @@ GObject*        freq_device_new                 (void);
 void            freq_device_set_sysfs_settings  (FreqDevice *self,
                                                  const char *directory,
                                                  const char *governor_node);
+void            freq_device_set_limit_nodes     (FreqDevice *self,
+                                                 const char *available_node,
+                                                 const char *min_node,
+                                                 const char *max_node);
 void            freq_device_set_name            (FreqDevice *self,
                                                  const char *device_name);
 const char*     freq_device_get_name            (FreqDevice  *self);
-void            freq_device_set_powersave       (FreqDevice  *self,
-                                                 gboolean     powersave);
-void            freq_device_set_governor        (FreqDevice *self,
-                                                 const char *governor);
+void            freq_device_set_powersave       (FreqDevice     *self,
+                                                 FreqCap         cap,
+                                                 TransitionPlan *plan);
+void            freq_device_set_governor        (FreqDevice     *self,
+                                                 const char     *governor,
+                                                 TransitionPlan *plan);
 G_END_DECLS
 
 #endif
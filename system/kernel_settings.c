@@ -20,6 +20,15 @@ G_DEFINE_TYPE_WITH_CODE (
     /* G_ADD_PRIVATE (KernelSettings) */
 )
 
+static void
+set_value (TransitionPlan *plan,
+           const char     *filename,
+           const char     *value)
+{
+    /* Sysctls may depend on each other, keep them ordered */
+    transition_plan_write (plan, "kernel_settings", filename, value);
+}
+
 static void
 kernel_settings_dispose (GObject *kernel_settings)
 {
@@ -167,96 +176,100 @@ kernel_settings_new (void)
  *
  * @param #KernelSettings
  * @param powersave: True to enable powersave
+ * @param plan: (nullable): #TransitionPlan to add writes to
  */
 void
 kernel_settings_set_powersave (KernelSettings *kernel_settings,
-                               gboolean        powersave)
+                               gboolean        powersave,
+                               TransitionPlan *plan)
 {
     if (powersave) {
-        /* https://www.fatalerrors.org/a/schedtune-learning-notes.html */
-        write_to_file (
-            "/sys/fs/cgroup/schedtune/schedtune.boost", "0"
+        /* Legacy kernels, see SchedShaper for uclamp
+         * https://www.fatalerrors.org/a/schedtune-learning-notes.html
+         */
+        set_value (
+            plan, "/sys/fs/cgroup/schedtune/schedtune.boost", "0"
         );
-        write_to_file (
-            "/sys/fs/cgroup/schedtune/schedtune.prefer_idle", "0"
+        set_value (
+            plan, "/sys/fs/cgroup/schedtune/schedtune.prefer_idle", "0"
         );
-        write_to_file (
-            "/proc/sys/kernel/sched_boost", "0"
+        set_value (
+            plan, "/proc/sys/kernel/sched_boost", "0"
         );
 
         /* Do not move big tasks from little cluster to big cluster */
-        write_to_file (
-            "/proc/sys/kernel/sched_walt_rotate_big_tasks", "0"
+        set_value (
+            plan, "/proc/sys/kernel/sched_walt_rotate_big_tasks", "0"
         );
 
         /* Reduce memory management power usage */
-        write_to_file (
-            "/proc/sys/vm/swappiness", "5"
+        set_value (
+            plan, "/proc/sys/vm/swappiness", "5"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_background_ratio", "50"
+        set_value (
+            plan, "/proc/sys/vm/dirty_background_ratio", "50"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_ratio", "90"
+        set_value (
+            plan, "/proc/sys/vm/dirty_ratio", "90"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_writeback_centisecs", "60000"
+        set_value (
+            plan, "/proc/sys/vm/dirty_writeback_centisecs", "60000"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_expire_centisecs", "60000"
+        set_value (
+            plan, "/proc/sys/vm/dirty_expire_centisecs", "60000"
         );
 
         /* Enable laptop mode */
-        write_to_file (
-            "/proc/sys/vm/laptop_mode", "5"
+        set_value (
+            plan, "/proc/sys/vm/laptop_mode", "5"
         );
 
         /* Disable LPM predictions */
-        write_to_file (
-            "/sys/module/lpm_levels/parameters/lpm_prediction", "N"
+        set_value (
+            plan, "/sys/module/lpm_levels/parameters/lpm_prediction", "N"
         );
     } else {
         /* https://lwn.net/Articles/706374/ */
-        write_to_file (
-            "/sys/fs/cgroup/schedtune/schedtune.boost", "10"
+        set_value (
+            plan, "/sys/fs/cgroup/schedtune/schedtune.boost", "10"
         );
-        write_to_file (
-            "/sys/fs/cgroup/schedtune/schedtune.prefer_idle", "1"
+        set_value (
+            plan, "/sys/fs/cgroup/schedtune/schedtune.prefer_idle", "1"
         );
-        write_to_file (
-            "/proc/sys/kernel/sched_boost", "1"
+        set_value (
+            plan, "/proc/sys/kernel/sched_boost", "1"
         );
 
         /* Move big tasks from little cluster to big cluster */
-        write_to_file (
-            "/proc/sys/kernel/sched_walt_rotate_big_tasks", "1"
+        set_value (
+            plan, "/proc/sys/kernel/sched_walt_rotate_big_tasks", "1"
         );
 
         /* Default kernel value */
-        write_to_file (
-            "/proc/sys/vm/swappiness", "60"
+        set_value (
+            plan, "/proc/sys/vm/swappiness", "60"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_background_ratio", "10"
+        set_value (
+            plan, "/proc/sys/vm/dirty_background_ratio", "10"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_ratio", "20"
+        set_value (
+            plan, "/proc/sys/vm/dirty_ratio", "20"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_writeback_centisecs", "500"
+        set_value (
+            plan, "/proc/sys/vm/dirty_writeback_centisecs", "500"
         );
-        write_to_file (
-            "/proc/sys/vm/dirty_expire_centisecs", "3000"
+        set_value (
+            plan, "/proc/sys/vm/dirty_expire_centisecs", "3000"
         );
 
         /* Disable laptop mode */
-        write_to_file (
-            "/proc/sys/vm/laptop_mode", "0"
+        set_value (
+            plan, "/proc/sys/vm/laptop_mode", "0"
         );
 
         /* Enable LPM predictions */
-        write_to_file (
-            "/sys/module/lpm_levels/parameters/lpm_prediction", "Y"
+        set_value (
+            plan, "/sys/module/lpm_levels/parameters/lpm_prediction", "Y"
         );
     }
 }
\ No newline at end of file
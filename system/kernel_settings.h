@@ -8,6 +8,8 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "../common/transition.h"
+
 #define TYPE_KERNEL_SETTINGS \
     (kernel_settings_get_type ())
 #define KERNEL_SETTINGS(obj) \
@@ -45,7 +47,8 @@ GType           kernel_settings_get_type      (void) G_GNUC_CONST;
 
 GObject*        kernel_settings_new           (void);
 void            kernel_settings_set_powersave (KernelSettings *kernel_settings,
-                                               gboolean        powersave);
+                                               gboolean        powersave,
+                                               TransitionPlan *plan);
 
 G_END_DECLS
 
@@ -9,6 +9,7 @@
 
 #include "bus.h"
 #include "logind.h"
+#include "../common/trace.h"
 
 #define LOGIND_DBUS_NAME       "org.freedesktop.login1"
 #define LOGIND_DBUS_PATH       "/org/freedesktop/login1/seat/seat0"
@@ -25,6 +26,9 @@ static guint signals[LAST_SIGNAL];
 
 struct _LogindPrivate {
     GDBusProxy *logind_proxy;
+    GCancellable *cancellable;
+
+    gint64 idle_hint_time;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -49,12 +53,19 @@ on_logind_proxy_properties (GDBusProxy  *proxy,
     while (g_variant_iter_next (&i, "{&sv}", &property, &value)) {
         if (g_strcmp0 (property, "IdleHint") == 0) {
             gboolean idle_hint = g_variant_get_boolean (value);
+
+            self->priv->idle_hint_time = g_get_monotonic_time ();
             g_signal_emit(
                 self,
                 signals[SCREEN_STATE_CHANGED],
                 0,
                 !idle_hint
             );
+            trace_record (
+                TRACE_IDLE_HINT,
+                self->priv->idle_hint_time,
+                idle_hint ? "idle" : "active"
+            );
         }
 
         g_variant_unref (value);
@@ -62,23 +73,24 @@ on_logind_proxy_properties (GDBusProxy  *proxy,
 }
 
 static void
-connect_logind (Logind *self)
+on_logind_proxy (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
 {
     g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    Logind *self;
 
-    self->priv->logind_proxy = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SYSTEM,
-        0,
-        NULL,
-        LOGIND_DBUS_NAME,
-        LOGIND_DBUS_PATH,
-        LOGIND_DBUS_INTERFACE,
-        NULL,
-        &error
-    );
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
 
-    if (self->priv->logind_proxy == NULL)
-        g_error("Can't contact Logind: %s", error->message);
+    if (proxy == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_error ("Can't contact Logind: %s", error->message);
+    }
+
+    self = LOGIND (user_data);
+    self->priv->logind_proxy = proxy;
 
     g_signal_connect (
         self->priv->logind_proxy,
@@ -86,6 +98,26 @@ connect_logind (Logind *self)
         G_CALLBACK (on_logind_proxy_properties),
         self
     );
+
+    trace_startup_release ("logind");
+}
+
+static void
+connect_logind (Logind *self)
+{
+    trace_startup_hold ();
+
+    g_dbus_proxy_new_for_bus (
+        G_BUS_TYPE_SYSTEM,
+        0,
+        NULL,
+        LOGIND_DBUS_NAME,
+        LOGIND_DBUS_PATH,
+        LOGIND_DBUS_INTERFACE,
+        self->priv->cancellable,
+        on_logind_proxy,
+        self
+    );
 }
 
 static void
@@ -93,6 +125,8 @@ logind_dispose (GObject *logind)
 {
     Logind *self = LOGIND (logind);
 
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
     g_clear_object (&self->priv->logind_proxy);
 
     G_OBJECT_CLASS (logind_parent_class)->dispose (logind);
@@ -130,6 +164,10 @@ logind_init (Logind *self)
 {
     self->priv = logind_get_instance_private (self);
 
+    self->priv->logind_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->idle_hint_time = 0;
+
     connect_logind (self);
 }
 
@@ -151,6 +189,21 @@ logind_new (void)
     return logind;
 }
 
+/**
+ * logind_get_idle_hint_time:
+ *
+ * Get last IdleHint change time
+ *
+ * @param #Logind
+ *
+ * Returns: monotonic time in µs
+ */
+gint64
+logind_get_idle_hint_time (Logind *self)
+{
+    return self->priv->idle_hint_time;
+}
+
 static Logind *default_logind = NULL;
 /**
  * logind_get_default:
@@ -46,6 +46,7 @@ GType           logind_get_type            (void) G_GNUC_CONST;
 GObject*        logind_new                 (void);
 Logind*         logind_get_default         (void);
 void            logind_free_default        (void);
+gint64          logind_get_idle_hint_time  (Logind *self);
 
 G_END_DECLS
 
@@ -7,12 +7,15 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <gio/gio.h>
+#include <glib-unix.h>
 #include <stdlib.h>
 
 #include "bus.h"
 #include "kernel_settings.h"
 #include "logind.h"
 #include "manager.h"
+#include "../common/trace.h"
+#include "../common/utils.h"
 
 static GMainLoop *loop;
 
@@ -21,6 +24,14 @@ sigint_handler(int dummy) {
     g_main_loop_quit (loop);
 }
 
+static gboolean
+on_sigusr1 (gpointer user_data)
+{
+    trace_dump ();
+
+    return G_SOURCE_CONTINUE;
+}
+
 gint
 main (gint argc, char * argv[])
 {
@@ -28,13 +39,19 @@ main (gint argc, char * argv[])
     GResource *resource;
     g_autoptr (GOptionContext) context = NULL;
     g_autoptr (GError) error = NULL;
+    g_autofree char *sysroot = NULL;
     gboolean version = FALSE;
     GOptionEntry main_entries[] = {
         {"version", 0, 0, G_OPTION_ARG_NONE, &version, "Show version"},
+        {"sysroot", 0, 0, G_OPTION_ARG_FILENAME, &sysroot,
+         "Use sysfs/procfs/cgroupfs nodes under this directory", "DIR"},
         {NULL}
     };
 
+    trace_startup_begin ();
+
     signal(SIGINT, sigint_handler);
+    g_unix_signal_add (SIGUSR1, on_sigusr1, NULL);
 
     context = g_option_context_new ("Mobile Power Saver");
     g_option_context_add_main_entries (context, main_entries, NULL);
@@ -49,6 +66,8 @@ main (gint argc, char * argv[])
         return EXIT_SUCCESS;
     }
 
+    set_root_dir (sysroot);
+
     resource = g_resource_load (MPS_RESOURCES, NULL);
     g_resources_register (resource);
 
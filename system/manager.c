@@ -28,9 +28,10 @@
 #endif
 
 #include "../common/define.h"
+#include "../common/sched_shaper.h"
 #include "../common/services.h"
-
-#define APPLY_DELAY 500
+#include "../common/trace.h"
+#include "../common/transition.h"
 
 struct _ManagerPrivate {
     Cpufreq *cpufreq;
@@ -40,17 +41,22 @@ struct _ManagerPrivate {
     NetworkManager *network_manager;
     Modem  *modem;
     Services *services;
+    SchedShaper *sched_shaper;
+    Transition *transition;
 #ifdef WIFI_ENABLED
     WiFi *wifi;
 #endif
 
     gboolean screen_off_power_saving;
-    GList *screen_off_suspend_processes;
     GList *screen_off_suspend_services;
 
+    gboolean screen_on;
+    /* Longest doze windows, set by user daemon */
+    gboolean deep_doze;
+
     gboolean radio_power_saving;
 
-    guint apply_timeout_id;
+    gint64 screen_on_time;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -69,61 +75,109 @@ get_governor_from_power_profile (PowerProfile power_profile) {
     return NULL;
 }
 
-static gboolean
-on_apply_timeout (gpointer user_data)
+static void
+on_interactive (gpointer user_data)
 {
     Manager *self = MANAGER (user_data);
-    ModemClass *klass;
 
-    klass = MODEM_GET_CLASS (self->priv->modem);
+    g_message ("Screen on: frequency caps removed in %" G_GINT64_FORMAT " µs",
+               g_get_monotonic_time () - self->priv->screen_on_time);
+    trace_record (TRACE_INTERACTIVE, self->priv->screen_on_time, NULL);
+
+    bus_interactive (bus_get_default ());
+}
+
+static void
+set_screen_on (Manager *self)
+{
+    TransitionPlan *plan;
+
+    /* Before anything else, offline policies can't be restored */
+    cpufreq_set_cpus_online (self->priv->cpufreq, TRUE);
+
+    plan = transition_plan_new ("Screen on", TRUE);
+
+    /* Interactive step: only what user can feel */
+    cpufreq_set_powersave (self->priv->cpufreq, FALSE, TRUE, plan);
+    sched_shaper_set_shape (self->priv->sched_shaper, SCHED_SHAPE_NONE, plan);
+    transition_plan_notify (plan, on_interactive, self);
+
+    /* Background step, once pending events are dispatched */
+    transition_plan_next_step (plan, TRUE);
+    devfreq_set_powersave (self->priv->devfreq, FALSE, FALSE, plan);
+    kernel_settings_set_powersave (self->priv->kernel_settings, FALSE, plan);
+    services_unfreeze (
+        self->priv->services,
+        self->priv->screen_off_suspend_services,
+        plan
+    );
 
-    self->priv->apply_timeout_id = 0;
+    transition_run (self->priv->transition, plan);
 
+    /* Done while workers remove frequency caps */
+    freezer_resume_processes (self->priv->freezer);
+#ifdef WIFI_ENABLED
     if (self->priv->radio_power_saving)
-        klass->apply_powersave (self->priv->modem);
-    else
-        klass->reset_powersave (self->priv->modem);
+        wifi_set_powersave (self->priv->wifi, FALSE);
+#endif
+}
 
-    return FALSE;
+static void
+set_screen_off (Manager *self)
+{
+    TransitionPlan *plan = transition_plan_new ("Screen off", TRUE);
+
+    cpufreq_set_powersave (self->priv->cpufreq, TRUE, FALSE, plan);
+    devfreq_set_powersave (self->priv->devfreq, TRUE, FALSE, plan);
+    kernel_settings_set_powersave (self->priv->kernel_settings, TRUE, plan);
+    sched_shaper_set_shape (
+        self->priv->sched_shaper, SCHED_SHAPE_BACKGROUND, plan
+    );
+    services_freeze (
+        self->priv->services,
+        self->priv->screen_off_suspend_services,
+        plan
+    );
+
+    transition_run (self->priv->transition, plan);
+
+    freezer_suspend_processes (self->priv->freezer);
+#ifdef WIFI_ENABLED
+    if (self->priv->radio_power_saving) {
+        wifi_set_powersave (self->priv->wifi, TRUE);
+        /* Apps run until user daemon freezes them */
+        wifi_set_traffic_monitoring (self->priv->wifi, TRUE);
+    }
+#endif
 }
 
 static void
-on_screen_state_changed (gpointer ignore,
+on_screen_state_changed (gpointer emitter,
                          gboolean screen_on,
                          gpointer user_data)
 {
     Manager *self = MANAGER (user_data);
 
-    if (self->priv->screen_off_power_saving) {
-        bus_screen_state_changed (bus_get_default (), screen_on);
-        devfreq_set_powersave (self->priv->devfreq, !screen_on);
-        kernel_settings_set_powersave (self->priv->kernel_settings, !screen_on);
-#ifdef WIFI_ENABLED
-        if (self->priv->radio_power_saving)
-            wifi_set_powersave (self->priv->wifi, !screen_on);
-#endif
+    self->priv->screen_on = screen_on;
 
-        if (screen_on) {
-            cpufreq_set_powersave (self->priv->cpufreq, FALSE, TRUE);
-            freezer_resume_processes (
-                self->priv->freezer,
-                self->priv->screen_off_suspend_processes
-            );
-            services_unfreeze (
-                self->priv->services,
-                self->priv->screen_off_suspend_services
-            );
-        } else {
-            cpufreq_set_powersave (self->priv->cpufreq, TRUE, FALSE);
-            freezer_suspend_processes (
-                self->priv->freezer,
-                self->priv->screen_off_suspend_processes
-            );
-            services_freeze (
-                self->priv->services,
-                self->priv->screen_off_suspend_services
+    if (!self->priv->screen_off_power_saving)
+        return;
+
+    /* Let user daemon thaw apps while we remove frequency caps */
+    bus_screen_state_changed (bus_get_default (), screen_on);
+
+    if (screen_on) {
+        /* Measure from logind IdleHint, not from our signal handler */
+        if (IS_LOGIND (emitter))
+            self->priv->screen_on_time = logind_get_idle_hint_time (
+                LOGIND (emitter)
             );
-        }
+        else
+            self->priv->screen_on_time = g_get_monotonic_time ();
+
+        set_screen_on (self);
+    } else {
+        set_screen_off (self);
     }
 }
 
@@ -134,9 +188,12 @@ on_power_saving_mode_changed (Bus         *bus,
 {
     Manager *self = MANAGER (user_data);
     const char *governor = get_governor_from_power_profile (power_profile);
+    TransitionPlan *plan = transition_plan_new ("Power profile", FALSE);
+
+    cpufreq_set_governor (self->priv->cpufreq, governor, plan);
+    devfreq_set_governor (self->priv->devfreq, governor, plan);
 
-    cpufreq_set_governor (self->priv->cpufreq, governor);
-    devfreq_set_governor (self->priv->devfreq, governor);
+    transition_run (self->priv->transition, plan);
 }
 
 static void
@@ -149,8 +206,18 @@ on_screen_off_power_saving_changed (Bus      *bus,
     self->priv->screen_off_power_saving = screen_off_power_saving;
 
     if (!self->priv->screen_off_power_saving) {
-        cpufreq_set_powersave (self->priv->cpufreq, FALSE, TRUE);
-        devfreq_set_powersave (self->priv->devfreq, FALSE);
+        TransitionPlan *plan = transition_plan_new (
+            "Power saving disabled", FALSE
+        );
+
+        cpufreq_set_cpus_online (self->priv->cpufreq, TRUE);
+        cpufreq_set_powersave (self->priv->cpufreq, FALSE, TRUE, plan);
+        devfreq_set_powersave (self->priv->devfreq, FALSE, FALSE, plan);
+        sched_shaper_set_shape (
+            self->priv->sched_shaper, SCHED_SHAPE_NONE, plan
+        );
+
+        transition_run (self->priv->transition, plan);
     }
 }
 
@@ -162,20 +229,26 @@ on_screen_off_suspend_processes_changed (Bus      *bus,
     Manager *self = MANAGER (user_data);
     g_autoptr (GVariantIter) iter;
     const char *process;
-
-    g_list_free_full (
-        self->priv->screen_off_suspend_processes, g_free
-    );
-    self->priv->screen_off_suspend_processes = NULL;
+    GList *processes = NULL;
 
     g_variant_get (value, "as", &iter);
     while (g_variant_iter_loop (iter, "s", &process)) {
-        self->priv->screen_off_suspend_processes =
-            g_list_append (
-                self->priv->screen_off_suspend_processes, g_strdup (process)
-            );
+        processes = g_list_append (processes, g_strdup (process));
     }
     g_variant_unref (value);
+
+    freezer_set_processes (self->priv->freezer, processes);
+    g_list_free_full (processes, g_free);
+}
+
+static void
+on_screen_off_suspend_processes_cgroup_changed (Bus      *bus,
+                                                gboolean  cgroup,
+                                                gpointer  user_data)
+{
+    Manager *self = MANAGER (user_data);
+
+    freezer_set_cgroup (self->priv->freezer, cgroup);
 }
 
 static void
@@ -203,10 +276,7 @@ on_radio_power_saving_changed (Bus      *bus,
 
     self->priv->radio_power_saving = radio_power_saving;
 
-    g_clear_handle_id (&self->priv->apply_timeout_id, g_source_remove);
-    self->priv->apply_timeout_id = g_timeout_add (
-        APPLY_DELAY, (GSourceFunc) on_apply_timeout, self
-    );
+    modem_set_radio_power_saving (self->priv->modem, radio_power_saving);
 }
 
 static void
@@ -215,16 +285,38 @@ on_radio_power_saving_blacklist_changed (Bus      *bus,
                                          gpointer  user_data)
 {
     Manager *self = MANAGER (user_data);
-    ModemClass *klass;
 
-    klass = MODEM_GET_CLASS (self->priv->modem);
+    modem_set_blacklist (self->priv->modem, blacklist);
+}
+
+static void
+on_radio_power_saving_min_dwell_changed (Bus      *bus,
+                                         gint      min_dwell,
+                                         gpointer  user_data)
+{
+    Manager *self = MANAGER (user_data);
+
+    modem_set_min_dwell (self->priv->modem, MAX (min_dwell, 0));
+}
 
-    klass->set_blacklist (self->priv->modem, blacklist);
+static void
+on_screen_off_cpu_hotplug_changed (Bus      *bus,
+                                   gboolean  enabled,
+                                   gpointer  user_data)
+{
+    Manager *self = MANAGER (user_data);
 
-    g_clear_handle_id (&self->priv->apply_timeout_id, g_source_remove);
-    self->priv->apply_timeout_id = g_timeout_add (
-        APPLY_DELAY, (GSourceFunc) on_apply_timeout, self
-    );
+    cpufreq_set_hotplug (self->priv->cpufreq, enabled);
+}
+
+static void
+on_deep_doze_changed (Bus      *bus,
+                      gboolean  enabled,
+                      gpointer  user_data)
+{
+    Manager *self = MANAGER (user_data);
+
+    self->priv->deep_doze = enabled;
 }
 
 static void
@@ -233,21 +325,26 @@ on_suspend_modem_changed (Bus      *bus,
                           gpointer  user_data)
 {
     Manager *self = MANAGER (user_data);
-    ModemClass *klass;
-    gboolean updated;
-
-    /* Here we assume AP set with screen on/dozing off */
-    if (network_manager_has_ap (self->priv->network_manager))
-        return;
-
-    klass = MODEM_GET_CLASS (self->priv->modem);
 
-    updated = modem_set_powersave (
-        self->priv->modem, enabled, MODEM_POWERSAVE_DOZING
+    modem_set_ap (
+        self->priv->modem, network_manager_has_ap (self->priv->network_manager)
     );
+    modem_set_powersave (self->priv->modem, enabled, MODEM_POWERSAVE_DOZING);
+#ifdef WIFI_ENABLED
+    /* Only maintenance windows may transfer data */
+    if (self->priv->radio_power_saving)
+        wifi_set_traffic_monitoring (self->priv->wifi, !enabled);
+#endif
+}
+
+static void
+on_deep_powersave (gpointer user_data)
+{
+    Manager *self = MANAGER (user_data);
 
-    if (updated && self->priv->radio_power_saving)
-        klass->apply_powersave (self->priv->modem);
+    /* Frequencies are capped, policies can go offline */
+    if (!self->priv->screen_on && self->priv->deep_doze)
+        cpufreq_set_cpus_online (self->priv->cpufreq, FALSE);
 }
 
 static void
@@ -256,8 +353,28 @@ on_little_cluster_powersave_changed (Bus      *bus,
                                      gpointer  user_data)
 {
     Manager *self = MANAGER (user_data);
+    TransitionPlan *plan;
+
+    /* Sent by user daemon, may arrive after screen on */
+    if (self->priv->screen_on || !self->priv->screen_off_power_saving)
+        return;
+
+    /* Maintenance window, thawed apps need big CPUs */
+    if (!enabled)
+        cpufreq_set_cpus_online (self->priv->cpufreq, TRUE);
+
+    plan = transition_plan_new ("Little cluster", FALSE);
+    cpufreq_set_powersave (self->priv->cpufreq, TRUE, enabled, plan);
+    devfreq_set_powersave (self->priv->devfreq, TRUE, enabled, plan);
+    sched_shaper_set_shape (
+        self->priv->sched_shaper,
+        enabled ? SCHED_SHAPE_DEEP : SCHED_SHAPE_BACKGROUND,
+        plan
+    );
+    if (enabled)
+        transition_plan_notify (plan, on_deep_powersave, self);
 
-    cpufreq_set_powersave (self->priv->cpufreq, TRUE, enabled);
+    transition_run (self->priv->transition, plan);
 }
 
 static void
@@ -266,17 +383,8 @@ on_connection_type_wifi (NetworkManager *network_manager,
                          gpointer        user_data)
 {
     Manager *self = MANAGER (user_data);
-    ModemClass *klass;
-    gboolean updated;
-
-    klass = MODEM_GET_CLASS (self->priv->modem);
 
-    updated = modem_set_powersave (
-        self->priv->modem, enabled, MODEM_POWERSAVE_WIFI
-    );
-
-    if (updated && self->priv->radio_power_saving)
-        klass->apply_powersave (self->priv->modem);
+    modem_set_powersave (self->priv->modem, enabled, MODEM_POWERSAVE_WIFI);
 }
 
 static void
@@ -316,6 +424,8 @@ manager_dispose (GObject *manager)
     g_clear_object (&self->priv->network_manager);
     g_clear_object (&self->priv->modem);
     g_clear_object (&self->priv->services);
+    g_clear_object (&self->priv->sched_shaper);
+    g_clear_object (&self->priv->transition);
 #ifdef WIFI_ENABLED
     g_clear_object (&self->priv->wifi);
 #endif
@@ -328,15 +438,10 @@ manager_finalize (GObject *manager)
 {
     Manager *self = MANAGER (manager);
 
-    g_list_free_full (
-        self->priv->screen_off_suspend_processes, g_free
-    );
     g_list_free_full (
         self->priv->screen_off_suspend_services, g_free
     );
 
-    g_clear_handle_id (&self->priv->apply_timeout_id, g_source_remove);
-
     G_OBJECT_CLASS (manager_parent_class)->finalize (manager);
 }
 
@@ -366,14 +471,20 @@ manager_init (Manager *self)
     self->priv->modem = MODEM (modem_ofono_new ());
 #endif
     self->priv->services = SERVICES (services_new (G_BUS_TYPE_SYSTEM));
+    self->priv->sched_shaper = SCHED_SHAPER (
+        sched_shaper_new (G_BUS_TYPE_SYSTEM)
+    );
+    self->priv->transition = TRANSITION (transition_new ());
 #ifdef WIFI_ENABLED
     self->priv->wifi = WIFI (wifi_new ());
 #endif
 
     self->priv->screen_off_power_saving = TRUE;
+    self->priv->screen_on = TRUE;
+    self->priv->deep_doze = FALSE;
     self->priv->radio_power_saving = FALSE;
-    self->priv->apply_timeout_id = 0;
-    self->priv->screen_off_suspend_processes = NULL;
+    self->priv->screen_on_time = 0;
+    self->priv->screen_off_suspend_services = NULL;
 
     g_signal_connect (
         logind_get_default (),
@@ -408,6 +519,12 @@ manager_init (Manager *self)
         G_CALLBACK (on_screen_off_suspend_processes_changed),
         self
     );
+    g_signal_connect (
+        bus_get_default (),
+        "screen-off-suspend-processes-cgroup-changed",
+        G_CALLBACK (on_screen_off_suspend_processes_cgroup_changed),
+        self
+    );
     g_signal_connect (
         bus_get_default (),
         "screen-off-suspend-services-changed",
@@ -444,6 +561,24 @@ manager_init (Manager *self)
         G_CALLBACK (on_radio_power_saving_blacklist_changed),
         self
     );
+    g_signal_connect (
+        bus_get_default (),
+        "radio-power-saving-min-dwell-changed",
+        G_CALLBACK (on_radio_power_saving_min_dwell_changed),
+        self
+    );
+    g_signal_connect (
+        bus_get_default (),
+        "screen-off-cpu-hotplug-changed",
+        G_CALLBACK (on_screen_off_cpu_hotplug_changed),
+        self
+    );
+    g_signal_connect (
+        bus_get_default (),
+        "deep-doze-changed",
+        G_CALLBACK (on_deep_doze_changed),
+        self
+    );
     g_signal_connect (
         self->priv->network_manager,
         "connection-type-wifi",
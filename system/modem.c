@@ -9,14 +9,34 @@
 
 #include "network_manager.h"
 #include "modem.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define MODEM_DBUS_NAME                     "org.modem"
 #define MODEM_DBUS_PATH                     "/"
 #define MODEM_MANAGER_DBUS_INTERFACE        "org.modem.Manager"
 
+/* Inputs often change together (screen, Wi-Fi, dozing) */
+#define MODEM_APPLY_DELAY 1000
+#define MODEM_MIN_DWELL   60
+
 struct _ModemPrivate {
+    /* Policy inputs */
+    gboolean radio_power_saving;
     ModemPowersave modem_powersave;
+    gboolean ap;
+
+    /* Last applied target, -1 if none */
+    gint powersave;
+    /* Force next apply, new blacklist */
+    gboolean dirty;
+    guint apply_id;
+
+    /* Seconds a mode is kept before switching back */
+    guint min_dwell;
+    gint64 switch_time;
+    /* Switch held back by min_dwell since then, 0 if none */
+    gint64 dwell_time;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -26,9 +46,109 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (Modem)
 )
 
+static gboolean
+get_target (Modem *self)
+{
+    ModemPowersave modem_powersave = self->priv->modem_powersave;
+
+    if (!self->priv->radio_power_saving)
+        return FALSE;
+
+    /* Here we assume AP set with screen on/dozing off */
+    if (self->priv->ap)
+        modem_powersave &= ~MODEM_POWERSAVE_DOZING;
+
+    return modem_powersave != MODEM_POWERSAVE_NONE;
+}
+
+static gboolean on_apply (gpointer user_data);
+
+static gboolean
+hold_switch (Modem *self)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 dwell = now - self->priv->switch_time;
+    gint64 min_dwell = self->priv->min_dwell * G_USEC_PER_SEC;
+
+    /* Disabling radio power saving or a new blacklist can't wait */
+    if (self->priv->powersave == -1 ||
+            !self->priv->radio_power_saving ||
+            self->priv->dirty ||
+            dwell >= min_dwell)
+        return FALSE;
+
+    if (self->priv->dwell_time == 0)
+        self->priv->dwell_time = now;
+
+    g_debug ("Modem switch held for %" G_GINT64_FORMAT " µs",
+             min_dwell - dwell);
+    self->priv->apply_id = g_timeout_add (
+        (min_dwell - dwell) / 1000 + 1, on_apply, self
+    );
+
+    return TRUE;
+}
+
+static gboolean
+on_apply (gpointer user_data)
+{
+    Modem *self = MODEM (user_data);
+    gboolean powersave = get_target (self);
+    gint64 start;
+
+    self->priv->apply_id = 0;
+
+    /* Each mode switch forces a network re-registration */
+    if (self->priv->powersave == powersave && !self->priv->dirty) {
+        g_debug ("Modem powersave unchanged: %d", powersave);
+        /* Inputs went back before min dwell: switch avoided */
+        if (self->priv->dwell_time != 0) {
+            trace_record (TRACE_MODEM_DWELL, self->priv->dwell_time, "avoided");
+            self->priv->dwell_time = 0;
+        }
+        return G_SOURCE_REMOVE;
+    }
+
+    if (hold_switch (self))
+        return G_SOURCE_REMOVE;
+
+    if (self->priv->dwell_time != 0) {
+        trace_record (TRACE_MODEM_DWELL, self->priv->dwell_time, "delayed");
+        self->priv->dwell_time = 0;
+    }
+
+    self->priv->switch_time = g_get_monotonic_time ();
+    self->priv->powersave = powersave;
+    self->priv->dirty = FALSE;
+
+    g_debug ("Modem powersave: %d", powersave);
+
+    start = g_get_monotonic_time ();
+    if (self->priv->radio_power_saving) {
+        MODEM_GET_CLASS (self)->apply_powersave (self);
+        trace_record (TRACE_MODEM_APPLY, start, "apply");
+    } else {
+        MODEM_GET_CLASS (self)->reset_powersave (self);
+        trace_record (TRACE_MODEM_APPLY, start, "reset");
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+queue_apply (Modem *self)
+{
+    g_clear_handle_id (&self->priv->apply_id, g_source_remove);
+    self->priv->apply_id = g_timeout_add (MODEM_APPLY_DELAY, on_apply, self);
+}
+
 static void
 modem_dispose (GObject *modem)
 {
+    Modem *self = MODEM (modem);
+
+    g_clear_handle_id (&self->priv->apply_id, g_source_remove);
+
     G_OBJECT_CLASS (modem_parent_class)->dispose (modem);
 }
 
@@ -52,6 +172,16 @@ static void
 modem_init (Modem *self)
 {
     self->priv = modem_get_instance_private (self);
+
+    self->priv->radio_power_saving = FALSE;
+    self->priv->modem_powersave = MODEM_POWERSAVE_NONE;
+    self->priv->ap = FALSE;
+    self->priv->powersave = -1;
+    self->priv->dirty = FALSE;
+    self->priv->apply_id = 0;
+    self->priv->min_dwell = MODEM_MIN_DWELL;
+    self->priv->switch_time = 0;
+    self->priv->dwell_time = 0;
 }
 
 /**
@@ -72,60 +202,109 @@ modem_new (void)
     return modem;
 }
 
+/**
+ * modem_set_radio_power_saving:
+ *
+ * Allow modem devices powersave
+ *
+ * @param #Modem
+ * @param radio_power_saving: FALSE to keep default settings
+ */
+void
+modem_set_radio_power_saving (Modem    *self,
+                              gboolean  radio_power_saving)
+{
+    self->priv->radio_power_saving = radio_power_saving;
+    queue_apply (self);
+}
+
 /**
  * modem_set_powersave:
  *
- * Set modem devices to powersave
+ * Set a reason for modem devices powersave
  *
  * @param #Modem
- * @param powersave: True to enable powersave
+ * @param powersave: TRUE to add reason, FALSE to remove it
  * @param modem_powersave: #ModemPowersave flags
- *
- * Returns: TRUE if new settings should be applied
  */
-gboolean
+void
 modem_set_powersave (Modem          *self,
                      gboolean        powersave,
                      ModemPowersave  modem_powersave)
 {
-    ModemPowersave modem_powersave_tmp = self->priv->modem_powersave;
-    gboolean current_powersave = (
-        self->priv->modem_powersave & MODEM_POWERSAVE_ENABLED
-    ) == MODEM_POWERSAVE_ENABLED;
+    if (powersave)
+        self->priv->modem_powersave |= modem_powersave;
+    else
+        self->priv->modem_powersave &= ~modem_powersave;
 
-    if (powersave) {
-        modem_powersave_tmp |= modem_powersave;
-    } else {
-        modem_powersave_tmp &= ~modem_powersave;
-    }
+    queue_apply (self);
+}
 
-    if (modem_powersave_tmp == self->priv->modem_powersave ||
-            current_powersave == powersave)
-        return FALSE;
+/**
+ * modem_set_ap:
+ *
+ * Set if an access point is running: dozing is then ignored
+ *
+ * @param #Modem
+ * @param ap: TRUE if an access point is running
+ */
+void
+modem_set_ap (Modem    *self,
+              gboolean  ap)
+{
+    if (self->priv->ap == ap)
+        return;
 
-    self->priv->modem_powersave = modem_powersave_tmp;
-    if (powersave)
-        self->priv->modem_powersave |= MODEM_POWERSAVE_ENABLED;
-    else if (self->priv->modem_powersave == MODEM_POWERSAVE_ENABLED)
-        self->priv->modem_powersave &= ~MODEM_POWERSAVE_ENABLED;
+    self->priv->ap = ap;
+    queue_apply (self);
+}
 
-    g_debug("Modem powersave: %d", self->priv->modem_powersave);
+/**
+ * modem_set_blacklist:
+ *
+ * Set modes modem devices should not use, applied even if target is
+ * unchanged
+ *
+ * @param #Modem
+ * @param blacklist: MMModemMode flags
+ */
+void
+modem_set_blacklist (Modem *self,
+                     gint   blacklist)
+{
+    MODEM_GET_CLASS (self)->set_blacklist (self, blacklist);
 
-    return TRUE;
+    self->priv->dirty = TRUE;
+    queue_apply (self);
+}
+
+/**
+ * modem_set_min_dwell:
+ *
+ * Set how long a mode is kept before switching again, so Wi-Fi
+ * reconnections do not make radio ping-pong
+ *
+ * @param #Modem
+ * @param min_dwell: seconds, 0 to disable
+ */
+void
+modem_set_min_dwell (Modem *self,
+                     guint  min_dwell)
+{
+    self->priv->min_dwell = min_dwell;
 }
 
 /**
  * modem_get_powersave:
  *
- * Get modem devices powersaving flags
+ * Get if modem devices should be in powersave, for new devices
  *
  * @param #Modem
  *
- * Returns: #ModemPowersave
+ * Returns: TRUE if powersave is applied
  */
-ModemPowersave
+gboolean
 modem_get_powersave (Modem *self)
 {
-    return self->priv->modem_powersave;
-
-}
\ No newline at end of file
+    return self->priv->powersave == TRUE;
+}
@@ -11,7 +11,6 @@
 typedef enum
 {
     MODEM_POWERSAVE_NONE    = 0,
-    MODEM_POWERSAVE_ENABLED = 1 << 0,
     MODEM_POWERSAVE_WIFI    = 1 << 1,
     MODEM_POWERSAVE_DOZING  = 1 << 2
 } ModemPowersave;
@@ -53,13 +52,21 @@ struct _ModemClass {
                              gint   blacklist);
 };
 
-GType           modem_get_type        (void) G_GNUC_CONST;
+GType           modem_get_type               (void) G_GNUC_CONST;
 
-GObject*        modem_new             (void);
-gboolean        modem_set_powersave   (Modem          *self,
-                                       gboolean        powersave,
-                                       ModemPowersave  modem_powersave);
-ModemPowersave  modem_get_powersave   (Modem          *self);
+GObject*        modem_new                    (void);
+void            modem_set_radio_power_saving (Modem          *self,
+                                              gboolean        radio_power_saving);
+void            modem_set_powersave          (Modem          *self,
+                                              gboolean        powersave,
+                                              ModemPowersave  modem_powersave);
+void            modem_set_ap                 (Modem          *self,
+                                              gboolean        ap);
+void            modem_set_blacklist          (Modem          *self,
+                                              gint            blacklist);
+void            modem_set_min_dwell          (Modem          *self,
+                                              guint           min_dwell);
+gboolean        modem_get_powersave          (Modem          *self);
 
 G_END_DECLS
 
@@ -10,17 +10,42 @@
 
 #include "network_manager.h"
 #include "modem_mm.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
+/* Seconds, modem may stay registered while switching */
+#define SWITCH_TIMEOUT 30
+
 struct _ModemMMPrivate {
     GDBusConnection *connection;
     MMManager *manager;
+    GCancellable *cancellable;
 
     GList *modems;
+    GList *switches; /* struct Switch */
 
     guint blacklist;
 };
 
+/* From mode change request to modem registered again */
+struct Switch {
+    ModemMM *self;
+    MMModem *modem;
+    char *modes;
+    gint64 start;
+    /* Mode change done, modem did not unregister yet */
+    gint64 done_time;
+    gboolean unregistered;
+    gulong state_id;
+    guint timeout_id;
+    struct Request *request;
+};
+
+/* Mode change call in flight, may outlive its switch */
+struct Request {
+    struct Switch *modem_switch;
+};
+
 G_DEFINE_TYPE_WITH_CODE (
     ModemMM,
     modem_mm,
@@ -62,6 +87,141 @@ on_modem_removed (MMManager *modem_manager,
     }
 }
 
+static void
+switch_free (struct Switch *modem_switch)
+{
+    g_clear_signal_handler (&modem_switch->state_id, modem_switch->modem);
+    g_clear_handle_id (&modem_switch->timeout_id, g_source_remove);
+    if (modem_switch->request != NULL)
+        modem_switch->request->modem_switch = NULL;
+    g_clear_object (&modem_switch->modem);
+    g_free (modem_switch->modes);
+    g_free (modem_switch);
+}
+
+static void
+switch_done (struct Switch *modem_switch,
+             gint64         end)
+{
+    ModemMM *self = modem_switch->self;
+    gint64 duration = end - modem_switch->start;
+
+    g_message ("Modem switched to %s in %" G_GINT64_FORMAT " ms",
+               modem_switch->modes, duration / 1000);
+    trace_record_duration (
+        TRACE_MODEM_SWITCH, modem_switch->start, duration, modem_switch->modes
+    );
+
+    self->priv->switches = g_list_remove (self->priv->switches, modem_switch);
+    switch_free (modem_switch);
+}
+
+static void
+on_modem_state (MMModem    *modem,
+                GParamSpec *pspec,
+                gpointer    user_data)
+{
+    struct Switch *modem_switch = user_data;
+
+    if (mm_modem_get_state (modem) < MM_MODEM_STATE_REGISTERED) {
+        modem_switch->unregistered = TRUE;
+        return;
+    }
+
+    if (modem_switch->unregistered)
+        switch_done (modem_switch, g_get_monotonic_time ());
+}
+
+static gboolean
+on_switch_timeout (gpointer user_data)
+{
+    struct Switch *modem_switch = user_data;
+    ModemMM *self = modem_switch->self;
+
+    modem_switch->timeout_id = 0;
+
+    /* Switched without leaving registration */
+    if (!modem_switch->unregistered && modem_switch->done_time != 0) {
+        switch_done (modem_switch, modem_switch->done_time);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_warning ("Modem not registered %d s after switching to %s",
+               SWITCH_TIMEOUT, modem_switch->modes);
+    self->priv->switches = g_list_remove (self->priv->switches, modem_switch);
+    switch_free (modem_switch);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_current_modes (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    struct Request *request = user_data;
+    struct Switch *modem_switch = request->modem_switch;
+    ModemMM *self;
+
+    g_free (request);
+
+    /* Switch already done, timed out or disposed */
+    if (modem_switch != NULL)
+        modem_switch->request = NULL;
+
+    if (!mm_modem_set_current_modes_finish (MM_MODEM (source_object),
+                                            res,
+                                            &error)) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't set modem mode: %s", error->message);
+        if (modem_switch == NULL)
+            return;
+        self = modem_switch->self;
+        self->priv->switches = g_list_remove (
+            self->priv->switches, modem_switch
+        );
+        switch_free (modem_switch);
+        return;
+    }
+
+    if (modem_switch != NULL)
+        modem_switch->done_time = g_get_monotonic_time ();
+}
+
+static void
+start_switch (ModemMM     *self,
+              MMModem     *modem,
+              MMModemMode  allowed,
+              MMModemMode  preferred)
+{
+    struct Switch *modem_switch = g_new0 (struct Switch, 1);
+
+    modem_switch->self = self;
+    modem_switch->modem = g_object_ref (modem);
+    modem_switch->modes = g_strdup_printf ("%u/%u", allowed, preferred);
+    modem_switch->start = g_get_monotonic_time ();
+    modem_switch->state_id = g_signal_connect (
+        modem, "notify::state", G_CALLBACK (on_modem_state), modem_switch
+    );
+    modem_switch->timeout_id = g_timeout_add_seconds (
+        SWITCH_TIMEOUT, on_switch_timeout, modem_switch
+    );
+    modem_switch->request = g_new0 (struct Request, 1);
+    modem_switch->request->modem_switch = modem_switch;
+    self->priv->switches = g_list_prepend (self->priv->switches, modem_switch);
+
+    mm_modem_set_current_modes (
+        modem,
+        allowed,
+        preferred,
+        self->priv->cancellable,
+        on_current_modes,
+        modem_switch->request
+    );
+}
+
 static void
 modem_mm_set_powersave (Modem    *self,
                         gboolean  powersave)
@@ -74,8 +234,8 @@ modem_mm_set_powersave (Modem    *self,
         guint n_modes;
 
         if (mm_modem_get_supported_modes (modem, &modes, &n_modes)) {
-            guint allowed, preferred;
-            g_autoptr (GError) error = NULL;
+            MMModemMode allowed, current_allowed;
+            MMModemMode preferred, current_preferred;
 
             allowed = modes[0].allowed;
             preferred = modes[0].preferred;
@@ -95,16 +255,21 @@ modem_mm_set_powersave (Modem    *self,
                 }
             }
 
-            g_message ("Modem mode: %u %u", allowed, preferred);
+            g_free (modes);
 
-            mm_modem_set_current_modes_sync (
-                modem, allowed, preferred, NULL, &error
-            );
-            if (error != NULL) {
-                g_warning ("Can't set modem mode: %s", error->message);
+            /* Cached property, no need to wait for modem */
+            if (mm_modem_get_current_modes (modem,
+                                            &current_allowed,
+                                            &current_preferred) &&
+                    current_allowed == allowed &&
+                    current_preferred == preferred) {
+                g_debug ("Modem mode unchanged: %u %u", allowed, preferred);
+                continue;
             }
 
-            g_free (modes);
+            g_message ("Modem mode: %u %u", allowed, preferred);
+
+            start_switch (this, modem, allowed, preferred);
         }
     }
 }
@@ -112,11 +277,7 @@ modem_mm_set_powersave (Modem    *self,
 static void
 modem_mm_apply_powersave (Modem *self)
 {
-    gboolean powersave = (
-        modem_get_powersave (MODEM (self)) & MODEM_POWERSAVE_ENABLED
-    ) == MODEM_POWERSAVE_ENABLED;
-
-    modem_mm_set_powersave (self, powersave);
+    modem_mm_set_powersave (self, modem_get_powersave (self));
 }
 
 static void
@@ -139,6 +300,11 @@ modem_mm_dispose (GObject *modem_mm)
 {
     ModemMM *self = MODEM_MM (modem_mm);
 
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    g_list_free_full (
+        g_steal_pointer (&self->priv->switches), (GDestroyNotify) switch_free
+    );
     g_clear_object (&self->priv->connection);
     g_clear_object (&self->priv->manager);
 
@@ -172,35 +338,28 @@ modem_mm_class_init (ModemMMClass *klass)
 }
 
 static void
-modem_mm_init (ModemMM *self)
+on_manager (GObject      *source_object,
+            GAsyncResult *res,
+            gpointer      user_data)
 {
-    GList *modems, *l;
     g_autoptr (GError) error = NULL;
+    MMManager *manager;
+    ModemMM *self;
+    GList *modems, *l;
 
-    self->priv = modem_mm_get_instance_private (self);
-    self->priv->modems = NULL;
-
-    self->priv->connection = g_bus_get_sync (
-        G_BUS_TYPE_SYSTEM, NULL, &error
-    );
-
-    if (error != NULL) {
-        g_warning ("Can't connect to DBus: %s", error->message);
-        return;
-    }
-
-    self->priv->manager = mm_manager_new_sync (
-        self->priv->connection,
-        G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_DO_NOT_AUTO_START,
-        NULL,
-        &error
-    );
+    manager = mm_manager_new_finish (res, &error);
 
-    if (error != NULL) {
+    if (manager == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
         g_warning ("Can't connect to ModemManager: %s", error->message);
+        trace_startup_release ("modem-manager");
         return;
     }
 
+    self = MODEM_MM (user_data);
+    self->priv->manager = manager;
+
     g_signal_connect(
         self->priv->manager,
         "object-added",
@@ -220,6 +379,56 @@ modem_mm_init (ModemMM *self)
         on_modem_added(self->priv->manager, MM_OBJECT(l->data), self);
 
     g_list_free_full(modems, (GDestroyNotify) g_object_unref);
+
+    trace_startup_release ("modem-manager");
+}
+
+static void
+on_bus (GObject      *source_object,
+        GAsyncResult *res,
+        gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusConnection *connection;
+    ModemMM *self;
+
+    connection = g_bus_get_finish (res, &error);
+
+    if (connection == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't connect to DBus: %s", error->message);
+        trace_startup_release ("modem-manager");
+        return;
+    }
+
+    self = MODEM_MM (user_data);
+    self->priv->connection = connection;
+
+    mm_manager_new (
+        self->priv->connection,
+        G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_DO_NOT_AUTO_START,
+        self->priv->cancellable,
+        on_manager,
+        self
+    );
+}
+
+static void
+modem_mm_init (ModemMM *self)
+{
+    self->priv = modem_mm_get_instance_private (self);
+    self->priv->connection = NULL;
+    self->priv->manager = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->modems = NULL;
+    self->priv->switches = NULL;
+
+    trace_startup_hold ();
+
+    g_bus_get (
+        G_BUS_TYPE_SYSTEM, self->priv->cancellable, on_bus, self
+    );
 }
 
 /**
@@ -10,6 +10,7 @@
 #include "network_manager.h"
 #include "modem_ofono.h"
 #include "modem_ofono_device.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define OFONO_DBUS_NAME                     "org.ofono"
@@ -20,8 +21,12 @@
 
 struct _ModemOfonoPrivate {
     GDBusProxy *modem_ofono_manager_proxy;
+    GCancellable *cancellable;
 
     GList *modems;
+
+    /* Applied to modems found later */
+    gint blacklist;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -41,6 +46,7 @@ add_modem (ModemOfono *self,
 {
     ModemOfonoDevice *device = MODEM_OFONO_DEVICE (modem_ofono_device_new (path));
 
+    modem_ofono_device_set_blacklist (device, self->priv->blacklist);
     self->priv->modems = g_list_append (self->priv->modems, device);
     g_signal_connect (
         device,
@@ -70,11 +76,10 @@ on_modem_ofono_device_ready (ModemOfonoDevice *device,
                              gpointer          user_data)
 {
     ModemOfono *self = MODEM_OFONO (user_data);
-    gboolean powersave = (
-        modem_get_powersave (MODEM (self)) & MODEM_POWERSAVE_ENABLED
-    ) == MODEM_POWERSAVE_ENABLED;
 
-    modem_ofono_device_apply_powersave (device, powersave);
+    modem_ofono_device_apply_powersave (
+        device, modem_get_powersave (MODEM (self))
+    );
 }
 
 static void
@@ -96,14 +101,85 @@ on_modem_ofono_manager_signal (GDBusProxy *proxy,
     }
 }
 
+static void
+on_get_modems (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    g_autoptr (GVariantIter) iter = NULL;
+    g_autoptr (GVariant) value = NULL;
+    g_autoptr (GError) error = NULL;
+    ModemOfono *self;
+    const char *modem;
+
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+    if (value == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't get modem_ofono modems: %s", error->message);
+        trace_startup_release ("ofono");
+        return;
+    }
+
+    self = MODEM_OFONO (user_data);
+
+    g_variant_get (value, "(a(oa{sv}))", &iter);
+    while (g_variant_iter_loop (iter, "(&oa{sv})", &modem, NULL)) {
+        add_modem (self, modem);
+    }
+
+    trace_startup_release ("ofono");
+}
+
+static void
+on_modem_ofono_manager_proxy (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    ModemOfono *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        /* Radio power saving is optional, keep running without it */
+        g_warning ("Can't connect to modem_ofono manager: %s", error->message);
+        trace_startup_release ("ofono");
+        return;
+    }
+
+    self = MODEM_OFONO (user_data);
+    self->priv->modem_ofono_manager_proxy = proxy;
+
+    g_signal_connect_after (
+        self->priv->modem_ofono_manager_proxy,
+        "g-signal",
+        G_CALLBACK (on_modem_ofono_manager_signal),
+        self
+    );
+
+    g_dbus_proxy_call (
+        self->priv->modem_ofono_manager_proxy,
+        "GetModems",
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_get_modems,
+        self
+    );
+}
+
 static void
 modem_ofono_apply_powersave (Modem *self)
 {
     ModemOfono *this = MODEM_OFONO (self);
     ModemOfonoDevice *device;
-    gboolean powersave = (
-        modem_get_powersave (MODEM (self)) & MODEM_POWERSAVE_ENABLED
-    ) == MODEM_POWERSAVE_ENABLED;
+    gboolean powersave = modem_get_powersave (self);
 
     GFOREACH (this->priv->modems, device) {
         modem_ofono_device_apply_powersave (device, powersave);
@@ -128,6 +204,8 @@ modem_ofono_set_blacklist (Modem *self,
     ModemOfono *this = MODEM_OFONO (self);
     ModemOfonoDevice *device;
 
+    this->priv->blacklist = blacklist;
+
     GFOREACH (this->priv->modems, device) {
         modem_ofono_device_set_blacklist (
             device, blacklist
@@ -140,6 +218,8 @@ modem_ofono_dispose (GObject *modem_ofono)
 {
     ModemOfono *self = MODEM_OFONO (modem_ofono);
 
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
     g_clear_object (&self->priv->modem_ofono_manager_proxy);
 
     G_OBJECT_CLASS (modem_ofono_parent_class)->dispose (modem_ofono);
@@ -174,55 +254,26 @@ modem_ofono_class_init (ModemOfonoClass *klass)
 static void
 modem_ofono_init (ModemOfono *self)
 {
-    g_autoptr (GVariantIter) iter = NULL;
-    g_autoptr (GVariant) value = NULL;
-    g_autoptr (GError) error = NULL;
-    const char *modem;
-
     self->priv = modem_ofono_get_instance_private (self);
 
+    self->priv->modem_ofono_manager_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
     self->priv->modems = NULL;
+    self->priv->blacklist = 0;
 
-    self->priv->modem_ofono_manager_proxy = g_dbus_proxy_new_for_bus_sync (
+    trace_startup_hold ();
+
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SYSTEM,
         0,
         NULL,
         OFONO_DBUS_NAME,
         OFONO_DBUS_PATH,
         OFONO_MANAGER_DBUS_INTERFACE,
-        NULL,
-        &error
-    );
-
-    if (self->priv->modem_ofono_manager_proxy == NULL)
-        g_error("Can't connect to modem_ofono manager: %s", error->message);
-
-    g_signal_connect_after (
-        self->priv->modem_ofono_manager_proxy,
-        "g-signal",
-        G_CALLBACK (on_modem_ofono_manager_signal),
+        self->priv->cancellable,
+        on_modem_ofono_manager_proxy,
         self
     );
-
-    value = g_dbus_proxy_call_sync (
-        self->priv->modem_ofono_manager_proxy,
-        "GetModems",
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_warning ("Can't get modem_ofono modems: %s", error->message);
-        return;
-    }
-
-    g_variant_get (value, "(a(oa{sv}))", &iter);
-    while (g_variant_iter_loop (iter, "(&oa{sv})", &modem, NULL)) {
-        add_modem (self, modem);
-    }
 }
 
 /**
@@ -10,12 +10,17 @@
 #include "network_manager.h"
 #include "modem_ofono_device.h"
 #include "../common/define.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define OFONO_DBUS_NAME                     "org.ofono"
 #define OFONO_MODEM_DBUS_INTERFACE          "org.ofono.Modem"
 #define OFONO_RADIO_SETTINGS_DBUS_INTERFACE "org.ofono.RadioSettings"
 
+/* Seconds, doubled on each retry */
+#define RETRY_DELAY                         1
+#define MAX_RETRIES                         5
+
 
 /* props */
 enum {
@@ -35,10 +40,19 @@ static guint signals[LAST_SIGNAL];
 struct _ModemOfonoDevicePrivate {
     GDBusProxy *modem_ofono_device_modem_proxy;
     GDBusProxy *modem_ofono_device_radio_proxy;
+    GCancellable *cancellable;
 
     char *device_path;
 
+    gboolean powersave;
+
     guint blacklist;
+
+    /* One apply at a time, later ones are coalesced */
+    gboolean busy;
+    gboolean pending;
+    guint retries;
+    guint retry_id;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -55,56 +69,164 @@ on_modem_proxy_signal (GDBusProxy *proxy,
                        GVariant   *parameters,
                        gpointer    user_data);
 
+struct Switch {
+    ModemOfonoDevice *self;
+    char *technology;
+    gint64 start;
+};
+
+static void run_apply (ModemOfonoDevice *self);
+
 static void
-set_technology_preference (ModemOfonoDevice *self,
-                           const char       *technology)
+apply_done (ModemOfonoDevice *self)
+{
+    self->priv->busy = FALSE;
+    self->priv->retries = 0;
+
+    if (self->priv->pending)
+        run_apply (self);
+}
+
+static gboolean
+on_retry (gpointer user_data)
+{
+    ModemOfonoDevice *self = MODEM_OFONO_DEVICE (user_data);
+
+    self->priv->retry_id = 0;
+    run_apply (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+apply_failed (ModemOfonoDevice *self,
+              const char       *message)
+{
+    guint delay;
+
+    self->priv->busy = FALSE;
+
+    /* Newer settings, retrying old ones is useless */
+    if (self->priv->pending) {
+        self->priv->retries = 0;
+        run_apply (self);
+        return;
+    }
+
+    if (self->priv->retries == MAX_RETRIES) {
+        g_warning ("%s: %s, giving up", self->priv->device_path, message);
+        self->priv->retries = 0;
+        return;
+    }
+
+    delay = RETRY_DELAY << self->priv->retries;
+    self->priv->retries++;
+    g_warning ("%s: %s, retrying in %u s",
+               self->priv->device_path, message, delay);
+    self->priv->retry_id = g_timeout_add_seconds (delay, on_retry, self);
+}
+
+static void
+on_technology_preference (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
 {
     g_autoptr (GError) error = NULL;
     g_autoptr (GVariant) value = NULL;
+    g_autofree struct Switch *modem_switch = user_data;
+    g_autofree char *technology = modem_switch->technology;
+    g_autofree char *message = NULL;
+    ModemOfonoDevice *self;
+
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+    if (value == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        self = modem_switch->self;
+        message = g_strdup_printf (
+            "Can't set modem technology: %s", error->message
+        );
+        apply_failed (self, message);
+        return;
+    }
+
+    self = modem_switch->self;
 
-    g_return_if_fail (self->priv->modem_ofono_device_radio_proxy != NULL);
+    /* oFono replies once modem applied the new technology */
+    g_message ("Modem switched to %s in %" G_GINT64_FORMAT " ms",
+               technology,
+               (g_get_monotonic_time () - modem_switch->start) / 1000);
+    trace_record (TRACE_MODEM_SWITCH, modem_switch->start, technology);
+
+    apply_done (self);
+}
+
+static void
+set_technology_preference (ModemOfonoDevice *self,
+                           const char       *technology)
+{
+    struct Switch *modem_switch;
 
     g_message ("Technology preference: %s", technology);
 
-    value = g_dbus_proxy_call_sync (
+    modem_switch = g_new0 (struct Switch, 1);
+    modem_switch->self = self;
+    modem_switch->technology = g_strdup (technology);
+    modem_switch->start = g_get_monotonic_time ();
+
+    g_dbus_proxy_call (
         self->priv->modem_ofono_device_radio_proxy,
         "SetProperty",
         g_variant_new ("(sv)", "TechnologyPreference", g_variant_new ("s", technology)),
         G_DBUS_CALL_FLAGS_NONE,
         -1,
-        NULL,
-        &error
+        self->priv->cancellable,
+        on_technology_preference,
+        modem_switch
     );
+}
 
-    if (error != NULL) {
-        g_warning (
-            "Can't set modem technology: %s, %s", technology, error->message
-        );
+static void
+on_radio_proxy (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    ModemOfonoDevice *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't connect to OFono radio settings: %s",
+                       error->message);
+        return;
     }
+
+    self = MODEM_OFONO_DEVICE (user_data);
+
+    g_clear_object (&self->priv->modem_ofono_device_radio_proxy);
+    self->priv->modem_ofono_device_radio_proxy = proxy;
+
+    g_signal_emit_by_name(self, "device-ready", NULL);
 }
 
 static void
 init_radio (ModemOfonoDevice *self)
 {
-    g_autoptr (GError) error = NULL;
-
-    self->priv->modem_ofono_device_radio_proxy = g_dbus_proxy_new_for_bus_sync (
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SYSTEM,
         0,
         NULL,
         OFONO_DBUS_NAME,
         self->priv->device_path,
         OFONO_RADIO_SETTINGS_DBUS_INTERFACE,
-        NULL,
-        &error
+        self->priv->cancellable,
+        on_radio_proxy,
+        self
     );
-
-    if (error != NULL) {
-        g_error("Can't connect to OFono radio settings: %s", error->message);
-        return;
-    }
-
-    g_signal_emit_by_name(self, "device-ready", NULL);
 }
 
 static gboolean
@@ -162,6 +284,90 @@ on_modem_proxy_signal (GDBusProxy *proxy,
     }
 }
 
+static void
+on_radio_properties (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GVariant) value = NULL;
+    g_autoptr (GVariantIter) iter = NULL;
+    const char *property_name = NULL;
+    g_autoptr (GVariant) property_value = NULL;
+    g_autofree char *technology = NULL;
+    g_autofree char *current_technology = NULL;
+    ModemOfonoDevice *self;
+
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+    if (value == NULL) {
+        g_autofree char *message = NULL;
+
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        self = MODEM_OFONO_DEVICE (user_data);
+        message = g_strdup_printf (
+            "Can't get modem properties: %s", error->message
+        );
+        apply_failed (self, message);
+        return;
+    }
+
+    self = MODEM_OFONO_DEVICE (user_data);
+
+    g_variant_get (value, "(a{sv})", &iter);
+    while (g_variant_iter_loop (iter, "{&sv}", &property_name, &property_value)) {
+        if (g_strcmp0 (property_name, "TechnologyPreference") == 0) {
+            current_technology = g_variant_dup_string (property_value, NULL);
+        } else if (g_strcmp0 (property_name, "AvailableTechnologies") == 0) {
+            g_autoptr (GVariantIter) tech_iter;
+            const char *tech_value;
+
+            g_variant_get (property_value, "as", &tech_iter);
+            while (g_variant_iter_loop (tech_iter, "&s", &tech_value, NULL)) {
+                if (is_technology_blacklisted (self, tech_value))
+                    continue;
+                g_free (technology);
+                technology = g_strdup (tech_value);
+                if (self->priv->powersave)
+                    break;
+            }
+        }
+    }
+
+    if (technology == NULL) {
+        apply_done (self);
+        return;
+    }
+
+    /* Each change forces a network re-registration */
+    if (g_strcmp0 (technology, current_technology) == 0) {
+        g_debug ("Technology preference unchanged: %s", technology);
+        apply_done (self);
+        return;
+    }
+
+    set_technology_preference (self, technology);
+}
+
+static void
+run_apply (ModemOfonoDevice *self)
+{
+    self->priv->busy = TRUE;
+    self->priv->pending = FALSE;
+
+    g_dbus_proxy_call (
+        self->priv->modem_ofono_device_radio_proxy,
+        "GetProperties",
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_radio_properties,
+        self
+    );
+}
+
 static void
 modem_ofono_device_set_property (GObject      *object,
                                  guint         property_id,
@@ -200,31 +406,62 @@ modem_ofono_device_get_property (GObject    *object,
 }
 
 static void
-modem_ofono_device_constructed (GObject *modem_ofono_device)
+on_modem_properties (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
 {
-    ModemOfonoDevice *self = MODEM_OFONO_DEVICE (modem_ofono_device);
     g_autoptr (GVariantIter) iter = NULL;
     g_autoptr (GError) error = NULL;
     g_autoptr (GVariant) value = NULL;
     g_autoptr (GVariant) property_value = NULL;
     const char *property_name = NULL;
+    ModemOfonoDevice *self;
 
-    self->priv->modem_ofono_device_modem_proxy = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SYSTEM,
-        0,
-        NULL,
-        OFONO_DBUS_NAME,
-        self->priv->device_path,
-        OFONO_MODEM_DBUS_INTERFACE,
-        NULL,
-        &error
-    );
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
 
-    if (error != NULL) {
-        g_error("Can't connect to OFono modem interface: %s", error->message);
+    if (value == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get modem online status: %s", error->message);
         return;
     }
 
+    self = MODEM_OFONO_DEVICE (user_data);
+
+    g_variant_get (value, "(a{sv})", &iter);
+    while (g_variant_iter_loop (iter, "{&sv}", &property_name, &property_value)) {
+        if (g_strcmp0 (property_name, "Interfaces") == 0) {
+            on_modem_proxy_signal (
+                self->priv->modem_ofono_device_modem_proxy,
+                NULL,
+                "PropertyChanged",
+                g_variant_new ("(sv)", property_name, property_value),
+                self
+            );
+        }
+    }
+}
+
+static void
+on_modem_proxy (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    ModemOfonoDevice *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't connect to OFono modem interface: %s",
+                       error->message);
+        return;
+    }
+
+    self = MODEM_OFONO_DEVICE (user_data);
+    self->priv->modem_ofono_device_modem_proxy = proxy;
+
     g_signal_connect (
         self->priv->modem_ofono_device_modem_proxy,
         "g-signal",
@@ -232,33 +469,34 @@ modem_ofono_device_constructed (GObject *modem_ofono_device)
         self
     );
 
-    value = g_dbus_proxy_call_sync (
+    g_dbus_proxy_call (
         self->priv->modem_ofono_device_modem_proxy,
         "GetProperties",
         NULL,
         G_DBUS_CALL_FLAGS_NONE,
-       -1,
-        NULL,
-        &error
+        -1,
+        self->priv->cancellable,
+        on_modem_properties,
+        self
     );
+}
 
-    if (error != NULL) {
-        g_warning ("Can't get modem online status: %s", error->message);
-        return;
-    }
+static void
+modem_ofono_device_constructed (GObject *modem_ofono_device)
+{
+    ModemOfonoDevice *self = MODEM_OFONO_DEVICE (modem_ofono_device);
 
-    g_variant_get (value, "(a{sv})", &iter);
-    while (g_variant_iter_loop (iter, "{&sv}", &property_name, &property_value)) {
-        if (g_strcmp0 (property_name, "Interfaces") == 0) {
-            on_modem_proxy_signal (
-                self->priv->modem_ofono_device_modem_proxy,
-                NULL,
-                "PropertyChanged",
-                g_variant_new ("(sv)", property_name, property_value),
-                self
-            );
-        }
-    }
+    g_dbus_proxy_new_for_bus (
+        G_BUS_TYPE_SYSTEM,
+        0,
+        NULL,
+        OFONO_DBUS_NAME,
+        self->priv->device_path,
+        OFONO_MODEM_DBUS_INTERFACE,
+        self->priv->cancellable,
+        on_modem_proxy,
+        self
+    );
 
     G_OBJECT_CLASS (modem_ofono_device_parent_class)->constructed (modem_ofono_device);
 }
@@ -268,6 +506,9 @@ modem_ofono_device_dispose (GObject *modem_ofono_device)
 {
     ModemOfonoDevice *self = MODEM_OFONO_DEVICE (modem_ofono_device);
 
+    g_clear_handle_id (&self->priv->retry_id, g_source_remove);
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
     g_clear_object (&self->priv->modem_ofono_device_modem_proxy);
     g_clear_object (&self->priv->modem_ofono_device_radio_proxy);
 
@@ -325,6 +566,15 @@ static void
 modem_ofono_device_init (ModemOfonoDevice *self)
 {
     self->priv = modem_ofono_device_get_instance_private (self);
+
+    self->priv->modem_ofono_device_modem_proxy = NULL;
+    self->priv->modem_ofono_device_radio_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->powersave = FALSE;
+    self->priv->busy = FALSE;
+    self->priv->pending = FALSE;
+    self->priv->retries = 0;
+    self->priv->retry_id = 0;
 }
 
 /**
@@ -378,47 +628,21 @@ void
 modem_ofono_device_apply_powersave (ModemOfonoDevice *self,
                                     gboolean          powersave)
 {
-    g_autoptr (GError) error = NULL;
-    g_autoptr (GVariant) value = NULL;
-    g_autoptr (GVariantIter) iter = NULL;
-    const char *property_name = NULL;
-    g_autoptr (GVariant) property_value = NULL;
-    g_autofree char *technology = NULL;
-
-    g_return_if_fail (self->priv->modem_ofono_device_radio_proxy != NULL);
+    self->priv->powersave = powersave;
 
-    value = g_dbus_proxy_call_sync (
-        self->priv->modem_ofono_device_radio_proxy,
-        "GetProperties",
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
+    /* Applied once device is ready */
+    if (self->priv->modem_ofono_device_radio_proxy == NULL)
+        return;
 
-    if (error != NULL) {
-        g_warning ("Can't get modem properties: %s", error->message);
+    /* Current apply will be followed by this one */
+    if (self->priv->busy) {
+        self->priv->pending = TRUE;
         return;
     }
 
-    g_variant_get (value, "(a{sv})", &iter);
-    while (g_variant_iter_loop (iter, "{&sv}", &property_name, &property_value)) {
-        if (g_strcmp0 (property_name, "AvailableTechnologies") == 0) {
-            g_autoptr (GVariantIter) tech_iter;
-            const char *tech_value;
-
-            g_variant_get (property_value, "as", &tech_iter);
-            while (g_variant_iter_loop (tech_iter, "&s", &tech_value, NULL)) {
-                if (is_technology_blacklisted (self, tech_value))
-                    continue;
-                technology = g_strdup (tech_value);
-                if (powersave)
-                    break;
-            }
-        }
-    }
-    set_technology_preference (self, technology);
+    g_clear_handle_id (&self->priv->retry_id, g_source_remove);
+    self->priv->retries = 0;
+    run_apply (self);
 }
 
 /**
@@ -8,6 +8,7 @@
 #include <gio/gio.h>
 
 #include "network_manager.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define NETWORK_MANAGER_DBUS_NAME        "org.freedesktop.NetworkManager"
@@ -15,7 +16,6 @@
 #define NETWORK_MANAGER_DBUS_INTERFACE   "org.freedesktop.NetworkManager"
 #define NETWORK_MANAGER_DBUS_DEVICE      "org.freedesktop.NetworkManager.Device"
 #define NETWORK_MANAGER_DBUS_WIRELESS    "org.freedesktop.NetworkManager.Device.Wireless"
-#define DBUS_PROPERTIES_INTERFACE        "org.freedesktop.DBus.Properties"
 
 /* signals */
 enum
@@ -28,6 +28,7 @@ static guint signals[LAST_SIGNAL];
 
 struct _NetworkManagerPrivate {
     GDBusProxy *network_manager_proxy;
+    GCancellable *cancellable;
 
     GList *devices;
 
@@ -49,87 +50,95 @@ on_network_manager_proxy_properties (GDBusProxy  *proxy,
                                      gpointer     user_data);
 
 static void
-add_device (NetworkManager *self,
-            const char     *device_path)
+on_wireless_proxy (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
 {
-    GDBusProxy *network_manager_proxy = NULL;
-    g_autoptr (GVariant) value = NULL;
     g_autoptr (GError) error = NULL;
-    GVariant *inner_value = NULL;
-    guint device_type;
+    GDBusProxy *network_wireless_proxy;
+    NetworkManager *self;
 
-    network_manager_proxy = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SYSTEM,
-        0,
-        NULL,
-        NETWORK_MANAGER_DBUS_NAME,
-        device_path,
-        DBUS_PROPERTIES_INTERFACE,
-        NULL,
-        &error
-    );
+    network_wireless_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
 
-    if (error != NULL) {
-        g_error("Can't get network device properties: %s", error->message);
-        g_clear_object (&network_manager_proxy);
+    if (network_wireless_proxy == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get wireless device: %s", error->message);
         return;
     }
 
-    value = g_dbus_proxy_call_sync (
-        network_manager_proxy,
-        "Get",
-        g_variant_new ("(ss)",
-                       NETWORK_MANAGER_DBUS_DEVICE,
-                       "DeviceType"
-        ),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
+    self = NETWORK_MANAGER (user_data);
+
+    self->priv->devices = g_list_append (
+        self->priv->devices, network_wireless_proxy
     );
 
-    g_clear_object (&network_manager_proxy);
+    g_signal_connect (
+        network_wireless_proxy,
+        "g-properties-changed",
+        G_CALLBACK (on_network_manager_proxy_properties),
+        self
+    );
+}
 
-    if (error != NULL) {
-        g_error (
-            "Can't read DeviceType: %s",
-            error->message
-        );
+static void
+on_device_proxy (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+    g_autoptr (GDBusProxy) network_device_proxy = NULL;
+    g_autoptr (GVariant) value = NULL;
+    g_autoptr (GError) error = NULL;
+    NetworkManager *self;
+
+    network_device_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (network_device_proxy == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get network device: %s", error->message);
         return;
     }
 
-    g_variant_get (value, "(v)", &inner_value);
-    g_variant_get (inner_value, "u", &device_type);
+    self = NETWORK_MANAGER (user_data);
 
-    if (device_type != 2) { /* NM_DEVICE_TYPE_WIFI */
+    value = g_dbus_proxy_get_cached_property (
+        network_device_proxy, "DeviceType"
+    );
+
+    if (value == NULL) {
+        g_warning ("Can't read DeviceType");
         return;
     }
 
-    network_manager_proxy = g_dbus_proxy_new_for_bus_sync (
+    if (g_variant_get_uint32 (value) != 2) { /* NM_DEVICE_TYPE_WIFI */
+        return;
+    }
+
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SYSTEM,
         0,
         NULL,
         NETWORK_MANAGER_DBUS_NAME,
-        device_path,
+        g_dbus_proxy_get_object_path (network_device_proxy),
         NETWORK_MANAGER_DBUS_WIRELESS,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_error("Can't get wireless device: %s", error->message);
-        g_clear_object (&network_manager_proxy);
-        return;
-    }
-
-    self->priv->devices = g_list_append (
-        self->priv->devices, network_manager_proxy
+        self->priv->cancellable,
+        on_wireless_proxy,
+        self
     );
+}
 
-    g_signal_connect (
-        network_manager_proxy,
-        "g-properties-changed",
-        G_CALLBACK (on_network_manager_proxy_properties),
+static void
+add_device (NetworkManager *self,
+            const char     *device_path)
+{
+    g_dbus_proxy_new_for_bus (
+        G_BUS_TYPE_SYSTEM,
+        0,
+        NULL,
+        NETWORK_MANAGER_DBUS_NAME,
+        device_path,
+        NETWORK_MANAGER_DBUS_DEVICE,
+        self->priv->cancellable,
+        on_device_proxy,
         self
     );
 }
@@ -151,58 +160,6 @@ del_device (NetworkManager *self,
     }
 }
 
-static GVariant *
-get_connection_type (NetworkManager *self)
-{
-    g_autoptr (GDBusProxy) properties_bus_proxy;
-    g_autoptr (GVariant) value = NULL;
-    g_autoptr (GError) error = NULL;
-    GVariant *inner_value = NULL;
-
-    properties_bus_proxy = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SYSTEM,
-        0,
-        NULL,
-        NETWORK_MANAGER_DBUS_NAME,
-        NETWORK_MANAGER_DBUS_PATH,
-        DBUS_PROPERTIES_INTERFACE,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_error (
-            "Can't read properties from NetworkManager: %s", error->message
-        );
-        return NULL;
-    }
-
-    value = g_dbus_proxy_call_sync (
-        properties_bus_proxy,
-        "Get",
-        g_variant_new ("(ss)",
-                       NETWORK_MANAGER_DBUS_INTERFACE,
-                       "PrimaryConnectionType"
-        ),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_error (
-            "Can't read PrimaryConnectionType from NetworkManager: %s",
-            error->message
-        );
-        return NULL;
-    }
-
-    g_variant_get (value, "(v)", &inner_value);
-
-    return inner_value;
-}
-
 static void
 set_connection_type (NetworkManager *self,
                      GVariant       *value)
@@ -265,11 +222,98 @@ on_network_manager_proxy_properties (GDBusProxy  *proxy,
     }
 }
 
+static void
+on_get_devices (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    g_autoptr (GVariantIter) iter = NULL;
+    g_autoptr (GVariant) value = NULL;
+    g_autoptr (GError) error = NULL;
+    NetworkManager *self;
+    const char *device_path;
+
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+    if (value == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't get network devices: %s", error->message);
+        trace_startup_release ("network-manager");
+        return;
+    }
+
+    self = NETWORK_MANAGER (user_data);
+
+    /* Devices are looked up in parallel */
+    g_variant_get (value, "(ao)", &iter);
+    while (g_variant_iter_loop (iter, "&o", &device_path, NULL)) {
+        add_device (self, device_path);
+    }
+
+    trace_startup_release ("network-manager");
+}
+
+static void
+on_network_manager_proxy (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    NetworkManager *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't contact NetworkManager: %s", error->message);
+        trace_startup_release ("network-manager");
+        return;
+    }
+
+    self = NETWORK_MANAGER (user_data);
+    self->priv->network_manager_proxy = proxy;
+
+    g_signal_connect (
+        self->priv->network_manager_proxy,
+        "g-properties-changed",
+        G_CALLBACK (on_network_manager_proxy_properties),
+        self
+    );
+
+    g_signal_connect (
+        self->priv->network_manager_proxy,
+        "g-signal",
+        G_CALLBACK (on_network_manager_proxy_signal),
+        self
+    );
+
+    network_manager_check_wifi (self);
+
+    g_dbus_proxy_call (
+        self->priv->network_manager_proxy,
+        "GetDevices",
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_get_devices,
+        self
+    );
+}
+
 static void
 network_manager_dispose (GObject *network_manager)
 {
     NetworkManager *self = NETWORK_MANAGER (network_manager);
 
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    g_list_free_full (
+        g_steal_pointer (&self->priv->devices), g_object_unref
+    );
     g_clear_object (&self->priv->network_manager_proxy);
 
     G_OBJECT_CLASS (network_manager_parent_class)->dispose (network_manager);
@@ -278,10 +322,6 @@ network_manager_dispose (GObject *network_manager)
 static void
 network_manager_finalize (GObject *network_manager)
 {
-    NetworkManager *self = NETWORK_MANAGER (network_manager);
-
-    g_list_free (self->priv->devices);
-
     G_OBJECT_CLASS (network_manager_parent_class)->finalize (network_manager);
 }
 
@@ -309,65 +349,26 @@ network_manager_class_init (NetworkManagerClass *klass)
 static void
 network_manager_init (NetworkManager *self)
 {
-    g_autoptr (GVariantIter) iter = NULL;
-    g_autoptr (GVariant) value = NULL;
-    g_autoptr (GError) error = NULL;
-    const char *device_path;
-
     self->priv = network_manager_get_instance_private (self);
 
+    self->priv->network_manager_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
     self->priv->devices = NULL;
     self->priv->access_point = FALSE;
 
-    self->priv->network_manager_proxy = g_dbus_proxy_new_for_bus_sync (
+    trace_startup_hold ();
+
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SYSTEM,
         0,
         NULL,
         NETWORK_MANAGER_DBUS_NAME,
         NETWORK_MANAGER_DBUS_PATH,
         NETWORK_MANAGER_DBUS_INTERFACE,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_error("Can't contact NetworkManager: %s", error->message);
-        return;
-    }
-
-    g_signal_connect (
-        self->priv->network_manager_proxy,
-        "g-properties-changed",
-        G_CALLBACK (on_network_manager_proxy_properties),
-        self
-    );
-
-    g_signal_connect (
-        self->priv->network_manager_proxy,
-        "g-signal",
-        G_CALLBACK (on_network_manager_proxy_signal),
+        self->priv->cancellable,
+        on_network_manager_proxy,
         self
     );
-
-    value = g_dbus_proxy_call_sync (
-        self->priv->network_manager_proxy,
-        "GetDevices",
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_warning ("Can't get network devices: %s", error->message);
-        return;
-    }
-
-    g_variant_get (value, "(ao)", &iter);
-    while (g_variant_iter_loop (iter, "&o", &device_path, NULL)) {
-        add_device (self, device_path);
-    }
 }
 
 /**
@@ -401,7 +402,13 @@ network_manager_check_wifi (NetworkManager *self)
 {
     g_autoptr (GVariant) value = NULL;
 
-    value = get_connection_type (self);
+    /* Checked again once connected */
+    if (self->priv->network_manager_proxy == NULL)
+        return;
+
+    value = g_dbus_proxy_get_cached_property (
+        self->priv->network_manager_proxy, "PrimaryConnectionType"
+    );
     if (value != NULL)
         set_connection_type (self, value);
 }
@@ -4,7 +4,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <net/if.h>
+#include <errno.h>
 #include <stdint.h>
 #include <netlink/errno.h>
 #include <netlink/netlink.h>
@@ -13,15 +13,45 @@
 #include <linux/nl80211.h>
 
 #include <gio/gio.h>
+#include <glib-unix.h>
 
 #include "wifi.h"
 #include "../common/utils.h"
 
+/* Sampled while apps can use the network */
+#define TRAFFIC_INTERVAL      2
+/* Bytes per second, above this powersave hurts throughput */
+#define TRAFFIC_THRESHOLD     100000
+/* Idle samples before powersave is enabled back */
+#define TRAFFIC_IDLE_SAMPLES  3
+
+struct Interface {
+    gint ifindex;
+    char *ifname;
+    /* Driver can't do powersave, don't ask again */
+    gboolean unsupported;
+};
+
 struct _WiFiPrivate {
+    /* Commands, replies are read synchronously */
     struct nl_sock *socket;
+    /* nl80211 "config" multicast group */
+    struct nl_sock *events;
+    guint events_id;
 
-    gint ifindex;
     gint genl_family_id;
+
+    GHashTable *interfaces; /* ifindex -> struct Interface */
+
+    /* -1 until first request */
+    gint powersave;
+
+    /* Powersave held off by an active transfer */
+    gboolean busy;
+    guint idle_samples;
+    guint traffic_id;
+    guint64 traffic_bytes;
+    gint64 traffic_time;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -31,6 +61,13 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (WiFi)
 )
 
+static void
+interface_free (struct Interface *interface)
+{
+    g_free (interface->ifname);
+    g_free (interface);
+}
+
 static int finish_handler (struct nl_msg *msg,
                            void          *arg)
 {
@@ -39,16 +76,30 @@ static int finish_handler (struct nl_msg *msg,
     return NL_SKIP;
 }
 
-/* Yes, we only handle one WiFi interface */
-static int get_wifi_interface (struct nl_msg *msg,
-                               void          *arg)
+static int ack_handler (struct nl_msg *msg,
+                        void          *arg)
 {
-    WiFi *self = WIFI (arg);
+    int *ret = arg;
+    *ret = 0;
+    return NL_STOP;
+}
+
+static int error_handler (struct sockaddr_nl *nla,
+                          struct nlmsgerr    *err,
+                          void               *arg)
+{
+    int *ret = arg;
+    *ret = err->error;
+    return NL_STOP;
+}
+
+static int get_powersave_handler (struct nl_msg *msg,
+                                  void          *arg)
+{
+    gint *powersave = arg;
     struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
     struct genlmsghdr *gnlh = nlmsg_data (nlmsg_hdr (msg));
 
-    g_return_val_if_fail (self->priv->ifindex == -1, NL_SKIP);
-
     nla_parse(
         tb_msg,
         NL80211_ATTR_MAX,
@@ -57,17 +108,17 @@ static int get_wifi_interface (struct nl_msg *msg,
         NULL
     );
 
-    if (tb_msg[NL80211_ATTR_IFNAME]) {
-        char *ifname = nla_get_string(tb_msg[NL80211_ATTR_IFNAME]);
-        if (g_str_has_prefix (ifname, "wl"))
-            self->priv->ifindex = if_nametoindex (ifname);
-    }
+    if (tb_msg[NL80211_ATTR_PS_STATE])
+        *powersave = nla_get_u32 (
+            tb_msg[NL80211_ATTR_PS_STATE]
+        ) == NL80211_PS_ENABLED;
 
     return NL_SKIP;
 }
 
 static struct nl_msg *
 nl80211_alloc_msg(WiFi    *self,
+                  gint     ifindex,
                   uint8_t  cmd)
 {
     struct nl_msg *msg = NULL;
@@ -77,46 +128,351 @@ nl80211_alloc_msg(WiFi    *self,
     g_return_val_if_fail (msg != NULL, NULL);
 
     genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, self->priv->genl_family_id, 0, 0, cmd, 0);
-    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, self->priv->ifindex);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
     return msg;
 
 nla_put_failure:
+    nlmsg_free (msg);
     g_return_val_if_reached(NULL);
 }
 
-static void
-init_wifi_interfaces(WiFi *self)
+/* Returns 0 or a negative errno */
+static gint
+send_and_recv (WiFi               *self,
+               struct nl_msg      *msg,
+               nl_recvmsg_msg_cb_t handler,
+               void               *arg)
 {
-    struct nl_msg *msg;
     struct nl_cb *cb;
-    gint err = 1;
-
-    msg = nlmsg_alloc();
-    g_return_if_fail (msg != NULL);
+    gint err;
 
     cb = nl_cb_alloc (NL_CB_DEFAULT);
     if (cb == NULL) {
         nlmsg_free (msg);
+        return -ENOMEM;
+    }
+
+    err = nl_send_auto (self->priv->socket, msg);
+    nlmsg_free (msg);
+    if (err < 0) {
+        nl_cb_put (cb);
+        return -EIO;
+    }
+
+    err = 1;
+    nl_cb_err (cb, NL_CB_CUSTOM, error_handler, &err);
+    nl_cb_set (cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
+    nl_cb_set (cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
+    if (handler != NULL)
+        nl_cb_set (cb, NL_CB_VALID, NL_CB_CUSTOM, handler, arg);
+
+    while (err > 0) {
+        if (nl_recvmsgs (self->priv->socket, cb) < 0) {
+            err = -EIO;
+            break;
+        }
+    }
+
+    nl_cb_put (cb);
+
+    return err;
+}
+
+static void
+apply_interface (WiFi             *self,
+                 struct Interface *interface)
+{
+    struct nl_msg *msg;
+    gint powersave = -1;
+    gint wanted;
+    gint err;
+
+    if (self->priv->powersave == -1 || interface->unsupported)
+        return;
+
+    wanted = self->priv->powersave && !self->priv->busy;
+
+    /* Kernel keeps the state, no need to reach the driver */
+    msg = nl80211_alloc_msg (
+        self, interface->ifindex, NL80211_CMD_GET_POWER_SAVE
+    );
+    if (msg == NULL)
+        return;
+
+    err = send_and_recv (self, msg, get_powersave_handler, &powersave);
+    if (err == -EOPNOTSUPP) {
+        g_message ("%s: powersave not supported", interface->ifname);
+        interface->unsupported = TRUE;
+        return;
+    }
+
+    if (powersave == wanted) {
+        g_debug ("%s: powersave unchanged", interface->ifname);
         return;
     }
 
-    nl_cb_set (cb, NL_CB_VALID, NL_CB_CUSTOM, get_wifi_interface, self);
+    msg = nl80211_alloc_msg (
+        self, interface->ifindex, NL80211_CMD_SET_POWER_SAVE
+    );
+    if (msg == NULL)
+        return;
+
+    nla_put_u32(msg,
+                NL80211_ATTR_PS_STATE,
+                wanted ? NL80211_PS_ENABLED : NL80211_PS_DISABLED);
+
+    err = send_and_recv (self, msg, NULL, NULL);
+    if (err < 0)
+        g_warning ("%s: can't set powersave: %s",
+                   interface->ifname, g_strerror (-err));
+    else
+        g_message ("%s: powersave %s",
+                   interface->ifname,
+                   wanted ? "enabled" : "disabled");
+}
+
+/* Interface dump, new or changed interface. Returns added interface */
+static struct Interface *
+update_interface (WiFi          *self,
+                  struct nl_msg *msg)
+{
+    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+    struct genlmsghdr *gnlh = nlmsg_data (nlmsg_hdr (msg));
+    struct Interface *interface;
+    enum nl80211_iftype iftype;
+    gint ifindex;
+
+    nla_parse(
+        tb_msg,
+        NL80211_ATTR_MAX,
+        genlmsg_attrdata (gnlh, 0),
+        genlmsg_attrlen(gnlh, 0),
+        NULL
+    );
+
+    /* P2P device has no netdev */
+    if (!tb_msg[NL80211_ATTR_IFINDEX] || !tb_msg[NL80211_ATTR_IFNAME] ||
+            !tb_msg[NL80211_ATTR_IFTYPE])
+        return NULL;
+
+    ifindex = nla_get_u32 (tb_msg[NL80211_ATTR_IFINDEX]);
+    iftype = nla_get_u32 (tb_msg[NL80211_ATTR_IFTYPE]);
+
+    /* Powersave only makes sense for clients */
+    if (iftype != NL80211_IFTYPE_STATION &&
+            iftype != NL80211_IFTYPE_P2P_CLIENT) {
+        g_hash_table_remove (self->priv->interfaces, GINT_TO_POINTER (ifindex));
+        return NULL;
+    }
+
+    if (g_hash_table_contains (self->priv->interfaces, GINT_TO_POINTER (ifindex)))
+        return NULL;
+
+    interface = g_new0 (struct Interface, 1);
+    interface->ifindex = ifindex;
+    interface->ifname = g_strdup (nla_get_string (tb_msg[NL80211_ATTR_IFNAME]));
+    interface->unsupported = FALSE;
+    g_hash_table_insert (
+        self->priv->interfaces, GINT_TO_POINTER (ifindex), interface
+    );
+
+    g_message ("WiFi interface: %s", interface->ifname);
+
+    return interface;
+}
+
+static int get_wifi_interface (struct nl_msg *msg,
+                               void          *arg)
+{
+    WiFi *self = WIFI (arg);
+
+    update_interface (self, msg);
+
+    return NL_SKIP;
+}
+
+static void
+apply_interfaces (WiFi *self)
+{
+    GHashTableIter iter;
+    struct Interface *interface;
+
+    g_hash_table_iter_init (&iter, self->priv->interfaces);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &interface))
+        apply_interface (self, interface);
+}
+
+static guint64
+get_traffic_bytes (WiFi *self)
+{
+    GHashTableIter iter;
+    struct Interface *interface;
+    guint64 bytes = 0;
+
+    g_hash_table_iter_init (&iter, self->priv->interfaces);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &interface)) {
+        bytes += get_interface_bytes (interface->ifname, "rx_bytes");
+        bytes += get_interface_bytes (interface->ifname, "tx_bytes");
+    }
+
+    return bytes;
+}
+
+static void
+set_busy (WiFi     *self,
+          gboolean  busy)
+{
+    if (self->priv->busy == busy)
+        return;
+
+    self->priv->busy = busy;
+    self->priv->idle_samples = 0;
+
+    g_message ("WiFi traffic %s", busy ? "active" : "idle");
+    apply_interfaces (self);
+}
+
+static gboolean
+on_traffic_timeout (gpointer user_data)
+{
+    WiFi *self = WIFI (user_data);
+    guint64 bytes = get_traffic_bytes (self);
+    gint64 now = g_get_monotonic_time ();
+    guint64 throughput = 0;
+
+    /* Counters restart with interfaces */
+    if (bytes >= self->priv->traffic_bytes && now > self->priv->traffic_time)
+        throughput = (bytes - self->priv->traffic_bytes) * G_USEC_PER_SEC /
+            (now - self->priv->traffic_time);
+
+    self->priv->traffic_bytes = bytes;
+    self->priv->traffic_time = now;
+
+    g_debug ("WiFi throughput: %" G_GUINT64_FORMAT, throughput);
+
+    if (throughput > TRAFFIC_THRESHOLD)
+        set_busy (self, TRUE);
+    else if (self->priv->busy &&
+            ++self->priv->idle_samples >= TRAFFIC_IDLE_SAMPLES)
+        set_busy (self, FALSE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+init_wifi_interfaces(WiFi *self)
+{
+    struct nl_msg *msg;
+    gint err;
+
+    msg = nlmsg_alloc();
+    g_return_if_fail (msg != NULL);
+
     genlmsg_put (msg, 0, 0, self->priv->genl_family_id , 0,
                 NLM_F_DUMP, NL80211_CMD_GET_INTERFACE, 0);
-    nl_send_auto_complete(self->priv->socket, msg);
 
-    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
+    g_hash_table_remove_all (self->priv->interfaces);
 
-    while (err > 0)
-        nl_recvmsgs(self->priv->socket, cb);
+    err = send_and_recv (self, msg, get_wifi_interface, self);
+    if (err < 0)
+        g_warning ("Can't get WiFi interfaces: %s", g_strerror (-err));
 
-    nlmsg_free (msg);
-    nl_cb_put (cb);
+    /* Command socket is free again */
+    apply_interfaces (self);
+}
+
+static int on_wifi_event (struct nl_msg *msg,
+                          void          *arg)
+{
+    WiFi *self = WIFI (arg);
+    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+    struct genlmsghdr *gnlh = nlmsg_data (nlmsg_hdr (msg));
+    struct Interface *interface;
+
+    /* Also sent when driver is reloaded */
+    if (gnlh->cmd == NL80211_CMD_NEW_INTERFACE ||
+            gnlh->cmd == NL80211_CMD_SET_INTERFACE) {
+        interface = update_interface (self, msg);
+        if (interface != NULL)
+            apply_interface (self, interface);
+    } else if (gnlh->cmd == NL80211_CMD_DEL_INTERFACE) {
+        nla_parse(
+            tb_msg,
+            NL80211_ATTR_MAX,
+            genlmsg_attrdata (gnlh, 0),
+            genlmsg_attrlen(gnlh, 0),
+            NULL
+        );
+        if (tb_msg[NL80211_ATTR_IFINDEX])
+            g_hash_table_remove (
+                self->priv->interfaces,
+                GINT_TO_POINTER (nla_get_u32 (tb_msg[NL80211_ATTR_IFINDEX]))
+            );
+    }
+
+    return NL_SKIP;
+}
+
+static gboolean
+on_wifi_events (gint         fd,
+                GIOCondition condition,
+                gpointer     user_data)
+{
+    WiFi *self = WIFI (user_data);
+    gint err;
+
+    while ((err = nl_recvmsgs_default (self->priv->events)) >= 0);
+
+    /* We lost some events, get back in sync */
+    if (err == -NLE_NOMEM)
+        init_wifi_interfaces (self);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+init_wifi_events (WiFi *self)
+{
+    gint group;
+
+    self->priv->events = nl_socket_alloc ();
+    g_return_if_fail (self->priv->events != NULL);
+
+    /* Multicast events are not sequenced */
+    nl_socket_disable_seq_check (self->priv->events);
+    nl_socket_modify_cb (
+        self->priv->events, NL_CB_VALID, NL_CB_CUSTOM, on_wifi_event, self
+    );
+
+    if (genl_connect (self->priv->events))
+        goto error;
+
+    group = genl_ctrl_resolve_grp (
+        self->priv->socket, "nl80211", NL80211_MULTICAST_GROUP_CONFIG
+    );
+    if (group < 0 || nl_socket_add_membership (self->priv->events, group))
+        goto error;
+
+    nl_socket_set_nonblocking (self->priv->events);
+
+    self->priv->events_id = g_unix_fd_add (
+        nl_socket_get_fd (self->priv->events), G_IO_IN, on_wifi_events, self
+    );
+    return;
+
+error:
+    g_warning ("Can't listen to nl80211 events");
+    g_clear_pointer (&self->priv->events, nl_socket_free);
 }
 
 static void
 wifi_dispose (GObject *wifi)
 {
+    WiFi *self = WIFI (wifi);
+
+    g_clear_handle_id (&self->priv->events_id, g_source_remove);
+    g_clear_handle_id (&self->priv->traffic_id, g_source_remove);
+
     G_OBJECT_CLASS (wifi_parent_class)->dispose (wifi);
 }
 
@@ -125,7 +481,9 @@ wifi_finalize (GObject *wifi)
 {
     WiFi *self = WIFI (wifi);
 
-    nl_socket_free (self->priv->socket);
+    g_clear_pointer (&self->priv->events, nl_socket_free);
+    g_clear_pointer (&self->priv->socket, nl_socket_free);
+    g_hash_table_destroy (self->priv->interfaces);
 
     G_OBJECT_CLASS (wifi_parent_class)->finalize (wifi);
 }
@@ -144,7 +502,17 @@ static void
 wifi_init (WiFi *self)
 {
     self->priv = wifi_get_instance_private (self);
-    self->priv->ifindex = -1;
+    self->priv->events = NULL;
+    self->priv->events_id = 0;
+    self->priv->powersave = -1;
+    self->priv->busy = FALSE;
+    self->priv->idle_samples = 0;
+    self->priv->traffic_id = 0;
+    self->priv->traffic_bytes = 0;
+    self->priv->traffic_time = 0;
+    self->priv->interfaces = g_hash_table_new_full (
+        g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) interface_free
+    );
 
     self->priv->socket = nl_socket_alloc ();
 
@@ -153,13 +521,17 @@ wifi_init (WiFi *self)
     nl_socket_set_buffer_size(self->priv->socket, 8192, 8192);
 
     if (genl_connect (self->priv->socket)) {
-        nl_socket_free (self->priv->socket);
+        g_clear_pointer (&self->priv->socket, nl_socket_free);
         return;
     }
 
     self->priv->genl_family_id = genl_ctrl_resolve(
         self->priv->socket, "nl80211"
     );
+
+    /* Subscribe first so no interface is missed */
+    init_wifi_events (self);
+    init_wifi_interfaces (self);
 }
 
 /**
@@ -183,7 +555,8 @@ wifi_new (void)
 /**
  * wifi_set_powersave:
  *
- * Set wifi devices to powersave
+ * Set wifi devices to powersave, interfaces appearing later
+ * get the same state.
  *
  * @param #WiFi
  * @param powersave: True to enable powersave
@@ -192,21 +565,49 @@ void
 wifi_set_powersave (WiFi     *self,
                     gboolean  powersave)
 {
-    struct nl_msg *msg  = NULL;
-
     g_return_if_fail (self->priv->socket != NULL);
 
-    if (self->priv->ifindex == -1) {
-        init_wifi_interfaces (self);
+    self->priv->powersave = powersave;
+
+    if (!powersave) {
+        g_clear_handle_id (&self->priv->traffic_id, g_source_remove);
+        self->priv->busy = FALSE;
     }
 
-    g_return_if_fail (self->priv->ifindex != -1);
+    apply_interfaces (self);
+}
 
-    msg = nl80211_alloc_msg(self, NL80211_CMD_SET_POWER_SAVE);
-    nla_put_u32(msg,
-                NL80211_ATTR_PS_STATE,
-                powersave == 1 ? NL80211_PS_ENABLED : NL80211_PS_DISABLED);
-    nl_send_auto(self->priv->socket, msg);
+/**
+ * wifi_set_traffic_monitoring:
+ *
+ * Sample WiFi traffic and hold off powersave while a transfer is
+ * running. Enable it only while apps can use the network, ignored
+ * if powersave is not enabled.
+ *
+ * @param #WiFi
+ * @param monitoring: True to sample traffic
+ */
+void
+wifi_set_traffic_monitoring (WiFi     *self,
+                             gboolean  monitoring)
+{
+    /* No nl80211, powersave never enabled */
+    if (self->priv->socket == NULL)
+        return;
 
-    nlmsg_free(msg);
-}
\ No newline at end of file
+    if (!monitoring) {
+        g_clear_handle_id (&self->priv->traffic_id, g_source_remove);
+        set_busy (self, FALSE);
+        return;
+    }
+
+    /* Nothing to hold off */
+    if (self->priv->powersave != TRUE || self->priv->traffic_id != 0)
+        return;
+
+    self->priv->traffic_bytes = get_traffic_bytes (self);
+    self->priv->traffic_time = g_get_monotonic_time ();
+    self->priv->traffic_id = g_timeout_add_seconds (
+        TRAFFIC_INTERVAL, on_traffic_timeout, self
+    );
+}
@@ -41,11 +41,13 @@ struct _WiFiClass {
     GObjectClass parent_class;
 };
 
-GType           wifi_get_type      (void) G_GNUC_CONST;
+GType           wifi_get_type               (void) G_GNUC_CONST;
 
-GObject*        wifi_new           (void);
-void            wifi_set_powersave (WiFi     *wifi,
-                                    gboolean  powersave);
+GObject*        wifi_new                    (void);
+void            wifi_set_powersave          (WiFi     *wifi,
+                                             gboolean  powersave);
+void            wifi_set_traffic_monitoring (WiFi     *wifi,
+                                             gboolean  monitoring);
 
 G_END_DECLS
 
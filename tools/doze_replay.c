@@ -0,0 +1,259 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../user/doze_scheduler.h"
+
+/* Same ladder as Dozing: 4 light, 3 medium, then full cycles */
+#define LADDER_MEDIUM 4
+#define LADDER_FULL   7
+
+/* No maintenance window can be that far apart: screen was on */
+#define SESSION_GAP   (4 * 1200 + 120)
+
+struct Score {
+    guint thaws;
+    guint events;
+    guint late_events;
+    gint64 doze_time;
+    gint64 total_delay;
+    gint64 max_delay;
+};
+
+static gint passes = 2;
+static gint max_delay = 900;
+
+static GOptionEntry entries[] = {
+    {"passes", 'p', 0, G_OPTION_ARG_INT, &passes,
+     "Replay trace this many times, only last pass is scored", "N"},
+    {"max-delay", 'd', 0, G_OPTION_ARG_INT, &max_delay,
+     "Events delayed more than this are late", "SECONDS"},
+    {NULL}
+};
+
+static GArray *
+load_trace (const char  *filename,
+            GError     **error)
+{
+    g_autofree char *contents = NULL;
+    g_auto (GStrv) lines = NULL;
+    GArray *times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    gint64 previous = G_MININT64;
+    guint i;
+
+    if (!g_file_get_contents (filename, &contents, NULL, error)) {
+        g_array_unref (times);
+        return NULL;
+    }
+
+    /* One "<unix time> <active>" line per maintenance window */
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        gint64 time;
+        gint active;
+
+        if (sscanf (lines[i], "%" G_GINT64_FORMAT " %d", &time, &active) != 2)
+            continue;
+
+        /* Windows are recorded in order, ignore clock jumps */
+        if (time < previous)
+            continue;
+        previous = time;
+
+        /* Inactive windows only tell us the screen was off */
+        if (!active)
+            time = -time;
+        g_array_append_val (times, time);
+    }
+
+    return times;
+}
+
+static DozeTier
+get_tier (guint type)
+{
+    if (type < LADDER_MEDIUM)
+        return DOZE_TIER_LIGHT;
+    else if (type < LADDER_FULL)
+        return DOZE_TIER_MEDIUM;
+    else
+        return DOZE_TIER_FULL;
+}
+
+static void
+add_delay (struct Score *score,
+           gint64        delay)
+{
+    score->events++;
+    score->total_delay += delay;
+    score->max_delay = MAX (score->max_delay, delay);
+    if (delay > max_delay)
+        score->late_events++;
+}
+
+/* Replay a doze session, screen off at start, on at end */
+static void
+replay_session (DozeScheduler *doze_scheduler,
+                GArray        *times,
+                guint          first,
+                guint          last,
+                struct Score  *score)
+{
+    gint64 start = ABS (g_array_index (times, gint64, first));
+    gint64 end = ABS (g_array_index (times, gint64, last));
+    gint64 now = start;
+    guint type = 0;
+    guint i = first;
+
+    score->doze_time += end - start;
+
+    while (TRUE) {
+        DozeTier tier = get_tier (type);
+        gint64 wake = now + doze_scheduler_get_sleep (doze_scheduler, tier, now);
+        gint64 window_end;
+        gboolean active = FALSE;
+
+        if (wake > end)
+            break;
+
+        window_end = wake + doze_scheduler_get_maintenance (
+            doze_scheduler, tier, wake
+        );
+        score->thaws++;
+
+        /* Events while frozen wait for this window */
+        for (; i <= last; i++) {
+            gint64 time = g_array_index (times, gint64, i);
+
+            if (ABS (time) > window_end)
+                break;
+            if (time < 0)
+                continue;
+
+            add_delay (score, MAX (wake - time, 0));
+            active = TRUE;
+        }
+
+        doze_scheduler_record (doze_scheduler, window_end, active);
+
+        now = window_end;
+        type = MIN (type + 1, LADDER_FULL);
+    }
+
+    /* Remaining events wait for screen on */
+    for (; i <= last; i++) {
+        gint64 time = g_array_index (times, gint64, i);
+
+        if (time > 0)
+            add_delay (score, end - time);
+    }
+}
+
+static struct Score
+replay (GArray   *times,
+        gboolean  adaptive)
+{
+    DozeScheduler *doze_scheduler;
+    struct Score score = { 0 };
+    gint pass;
+
+    doze_scheduler = DOZE_SCHEDULER (doze_scheduler_new (NULL));
+    doze_scheduler_set_adaptive (doze_scheduler, adaptive);
+
+    for (pass = 0; pass < passes; pass++) {
+        guint first = 0;
+        guint i;
+
+        memset (&score, 0, sizeof (score));
+
+        for (i = 1; i <= times->len; i++) {
+            if (i < times->len &&
+                    ABS (g_array_index (times, gint64, i)) -
+                    ABS (g_array_index (times, gint64, i - 1)) < SESSION_GAP)
+                continue;
+
+            replay_session (doze_scheduler, times, first, i - 1, &score);
+            first = i;
+        }
+    }
+
+    g_clear_object (&doze_scheduler);
+
+    return score;
+}
+
+static void
+print_score (const char   *name,
+             struct Score *score)
+{
+    gdouble hours = score->doze_time / 3600.0;
+
+    g_print ("%-9s thaws %6u (%5.1f/h)  events %5u  "
+             "mean delay %6" G_GINT64_FORMAT " s  "
+             "max delay %6" G_GINT64_FORMAT " s  late %5u\n",
+             name,
+             score->thaws,
+             hours > 0 ? score->thaws / hours : 0.0,
+             score->events,
+             score->events > 0 ? score->total_delay / score->events : 0,
+             score->max_delay,
+             score->late_events);
+}
+
+gint
+main (gint argc, char * argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GArray) times = NULL;
+    struct Score fixed, adaptive;
+
+    context = g_option_context_new (
+        "TRACE - score doze schedules against a recorded trace"
+    );
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_set_description (
+        context,
+        "TRACE is the doze-trace file kept in $XDG_STATE_HOME/mps.\n"
+        "The screen is assumed on between recorded doze sessions."
+    );
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (argc != 2 || passes < 1) {
+        g_autofree char *help = g_option_context_get_help (
+            context, TRUE, NULL
+        );
+        g_printerr ("%s", help);
+        return EXIT_FAILURE;
+    }
+
+    times = load_trace (argv[1], &error);
+    if (times == NULL) {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (times->len == 0) {
+        g_printerr ("Empty trace: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    fixed = replay (times, FALSE);
+    adaptive = replay (times, TRUE);
+
+    print_score ("fixed", &fixed);
+    print_score ("adaptive", &adaptive);
+
+    return EXIT_SUCCESS;
+}
@@ -8,10 +8,12 @@
 #include "config.h"
 #include "bus.h"
 #include "settings.h"
+#include "../common/trace.h"
 
 #define DBUS_MPS_NAME                "org.adishatz.Mps"
 #define DBUS_MPS_PATH                "/org/adishatz/Mps"
 #define DBUS_MPS_INTERFACE           "org.adishatz.Mps"
+#define DBUS_MPS_STATS_INTERFACE     "org.adishatz.Mps.Stats"
 
 /* signals */
 enum
@@ -24,6 +26,14 @@ static guint signals[LAST_SIGNAL];
 
 struct _BusPrivate {
     GDBusProxy *mps_proxy;
+    GCancellable *cancellable;
+
+    /* Values set before proxy is ready, key to value */
+    GHashTable *pending_values;
+
+    /* Stats exported on session bus */
+    GDBusNodeInfo *introspection_data;
+    guint owner_id;
 };
 
 G_DEFINE_TYPE_WITH_CODE (Bus, bus, G_TYPE_OBJECT,
@@ -52,12 +62,159 @@ on_mps_proxy_signal (GDBusProxy  *proxy,
     }
 }
 
+static void
+on_set_value (GObject      *source_object,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GVariant) result = NULL;
+
+    result = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+    if (result == NULL &&
+            !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_warning ("Error setting value: %s", error->message);
+    }
+}
+
+static void
+set_value (Bus        *self,
+           const char *key,
+           GVariant   *value)
+{
+    g_dbus_proxy_call (
+        self->priv->mps_proxy,
+        "Set",
+        g_variant_new ("(&sv)", key, value),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_set_value,
+        NULL
+    );
+}
+
+static void
+on_mps_proxy (GObject      *source_object,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    GHashTableIter iter;
+    gpointer key, value;
+    Bus *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't contact Mobile Power Saver: %s", error->message);
+        trace_startup_release ("mps");
+        return;
+    }
+
+    self = BUS (user_data);
+    self->priv->mps_proxy = proxy;
+
+    g_signal_connect (
+        self->priv->mps_proxy,
+        "g-signal",
+        G_CALLBACK (on_mps_proxy_signal),
+        self
+    );
+
+    g_hash_table_iter_init (&iter, self->priv->pending_values);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        set_value (self, key, value);
+    g_hash_table_remove_all (self->priv->pending_values);
+
+    trace_startup_release ("mps");
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const char      *name,
+                 gpointer         user_data)
+{
+    Bus *self = BUS (user_data);
+    guint registration_id;
+
+    registration_id = trace_register_object (
+        connection,
+        DBUS_MPS_PATH,
+        g_dbus_node_info_lookup_interface (
+            self->priv->introspection_data, DBUS_MPS_STATS_INTERFACE
+        )
+    );
+
+    if (registration_id == 0)
+        g_warning ("Can't export statistics on session bus");
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+              const char      *name,
+              gpointer         user_data)
+{
+    /* Statistics are still logged on SIGUSR1 */
+    g_warning ("Cannot own D-Bus name: %s", name);
+}
+
+static void
+export_stats (Bus *self)
+{
+    GBytes *bytes;
+
+    bytes = g_resources_lookup_data (
+        "/org/adishatz/Mps/org.adishatz.Mps.xml",
+        G_RESOURCE_LOOKUP_FLAGS_NONE,
+        NULL
+    );
+    if (bytes == NULL) {
+        g_warning ("Can't find D-Bus introspection data");
+        return;
+    }
+
+    self->priv->introspection_data = g_dbus_node_info_new_for_xml (
+        g_bytes_get_data (bytes, NULL),
+        NULL
+    );
+    g_bytes_unref (bytes);
+
+    g_assert (self->priv->introspection_data != NULL);
+
+    self->priv->owner_id = g_bus_own_name (
+        G_BUS_TYPE_SESSION,
+        DBUS_MPS_NAME,
+        G_BUS_NAME_OWNER_FLAGS_NONE,
+        on_bus_acquired,
+        NULL,
+        on_name_lost,
+        self,
+        NULL
+    );
+}
+
 static void
 bus_dispose (GObject *bus)
 {
     Bus *self = BUS (bus);
 
+    if (self->priv->owner_id != 0) {
+        g_bus_unown_name (self->priv->owner_id);
+        self->priv->owner_id = 0;
+    }
+    g_clear_pointer (
+        &self->priv->introspection_data, g_dbus_node_info_unref
+    );
+
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
     g_clear_object (&self->priv->mps_proxy);
+    g_clear_pointer (&self->priv->pending_values, g_hash_table_unref);
 
     G_OBJECT_CLASS (bus_parent_class)->dispose (bus);
 }
@@ -95,21 +252,27 @@ bus_init (Bus *self)
 {
     self->priv = bus_get_instance_private (self);
 
-    self->priv->mps_proxy = g_dbus_proxy_new_for_bus_sync (
+    self->priv->mps_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->pending_values = g_hash_table_new_full (
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref
+    );
+    self->priv->introspection_data = NULL;
+    self->priv->owner_id = 0;
+
+    export_stats (self);
+
+    trace_startup_hold ();
+
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SYSTEM,
         0,
         NULL,
         DBUS_MPS_NAME,
         DBUS_MPS_PATH,
         DBUS_MPS_INTERFACE,
-        NULL,
-        NULL
-    );
-
-    g_signal_connect (
-        self->priv->mps_proxy,
-        "g-signal",
-        G_CALLBACK (on_mps_proxy_signal),
+        self->priv->cancellable,
+        on_mps_proxy,
         self
     );
 }
@@ -138,7 +301,8 @@ bus_new (void)
 /**
  * bus_set_value:
  *
- * Set value on the bus.
+ * Set value on the bus, without waiting for a reply. Values set before
+ * service is contacted are sent once it is.
  *
  * @self: a #Bus
  * @key: a setting key
@@ -149,21 +313,16 @@ bus_set_value (Bus        *self,
                const char *key,
                GVariant   *value)
 {
-    g_autoptr (GError) error = NULL;
-    g_autoptr (GVariant) result = NULL;
-
-    result = g_dbus_proxy_call_sync (
-        self->priv->mps_proxy,
-        "Set",
-        g_variant_new ("(&sv)", key, value),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
+    if (self->priv->mps_proxy == NULL) {
+        g_hash_table_replace (
+            self->priv->pending_values,
+            g_strdup (key),
+            g_variant_ref_sink (value)
+        );
+        return;
+    }
 
-    if (error != NULL)
-        g_warning ("Error setting value: %s", error->message);
+    set_value (self, key, value);
 }
 
 static Bus *default_bus = NULL;
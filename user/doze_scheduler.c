@@ -0,0 +1,329 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#include <stdio.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "doze_scheduler.h"
+
+#define HOURS              24
+
+/* Activity is an EWMA of maintenance windows that saw activity */
+#define ACTIVITY_ALPHA     0.1
+#define ACTIVITY_NEUTRAL   0.5
+
+/* Sleep is stretched up to 4x when idle, shrunk to 0.5x when busy */
+#define MAX_SLEEP_FACTOR   4.0
+#define MIN_SLEEP_FACTOR   0.5
+#define MIN_MAINTENANCE    15
+
+#define STATE_FILE         "doze.ini"
+#define STATE_GROUP        "Activity"
+#define TRACE_FILE         "doze-trace"
+#define MAX_TRACE_SIZE     (1024 * 1024)
+
+static const guint base_sleep[DOZE_TIER_LAST] = { 300, 600, 1200 };
+static const guint base_maintenance[DOZE_TIER_LAST] = { 30, 50, 80 };
+
+struct _DozeSchedulerPrivate {
+    /* NULL if state is not persisted */
+    char *state_dir;
+
+    gdouble activity[HOURS];
+    guint samples[HOURS];
+
+    gboolean adaptive;
+};
+
+G_DEFINE_TYPE_WITH_CODE (
+    DozeScheduler,
+    doze_scheduler,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (DozeScheduler)
+)
+
+static guint
+get_hour (gint64 now)
+{
+    g_autoptr (GDateTime) datetime = g_date_time_new_from_unix_local (now);
+
+    if (datetime == NULL)
+        return 0;
+
+    return g_date_time_get_hour (datetime);
+}
+
+static gdouble
+get_activity (DozeScheduler *self,
+              gint64         now)
+{
+    if (!self->priv->adaptive)
+        return ACTIVITY_NEUTRAL;
+
+    return self->priv->activity[get_hour (now)];
+}
+
+static gdouble
+get_sleep_factor (gdouble activity)
+{
+    if (activity < ACTIVITY_NEUTRAL)
+        return 1.0 + (ACTIVITY_NEUTRAL - activity) / ACTIVITY_NEUTRAL *
+            (MAX_SLEEP_FACTOR - 1.0);
+
+    return 1.0 - (activity - ACTIVITY_NEUTRAL) / (1.0 - ACTIVITY_NEUTRAL) *
+        (1.0 - MIN_SLEEP_FACTOR);
+}
+
+static void
+load_state (DozeScheduler *self)
+{
+    g_autoptr (GKeyFile) key_file = g_key_file_new ();
+    g_autoptr (GError) error = NULL;
+    g_autofree char *filename = NULL;
+    g_autofree gdouble *activity = NULL;
+    g_autofree gint *samples = NULL;
+    gsize activity_len = 0;
+    gsize samples_len = 0;
+    guint i;
+
+    if (self->priv->state_dir == NULL)
+        return;
+
+    filename = g_build_filename (self->priv->state_dir, STATE_FILE, NULL);
+    if (!g_key_file_load_from_file (key_file, filename, 0, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Can't load %s: %s", filename, error->message);
+        return;
+    }
+
+    activity = g_key_file_get_double_list (
+        key_file, STATE_GROUP, "activity", &activity_len, NULL
+    );
+    samples = g_key_file_get_integer_list (
+        key_file, STATE_GROUP, "samples", &samples_len, NULL
+    );
+
+    if (activity_len != HOURS || samples_len != HOURS) {
+        g_warning ("Ignoring invalid doze state: %s", filename);
+        return;
+    }
+
+    for (i = 0; i < HOURS; i++) {
+        self->priv->activity[i] = CLAMP (activity[i], 0.0, 1.0);
+        self->priv->samples[i] = MAX (samples[i], 0);
+    }
+}
+
+static void
+save_state (DozeScheduler *self)
+{
+    g_autoptr (GKeyFile) key_file = g_key_file_new ();
+    g_autoptr (GError) error = NULL;
+    g_autofree char *filename = NULL;
+    gint samples[HOURS];
+    guint i;
+
+    if (self->priv->state_dir == NULL)
+        return;
+
+    for (i = 0; i < HOURS; i++)
+        samples[i] = MIN (self->priv->samples[i], G_MAXINT);
+
+    g_key_file_set_double_list (
+        key_file, STATE_GROUP, "activity", self->priv->activity, HOURS
+    );
+    g_key_file_set_integer_list (
+        key_file, STATE_GROUP, "samples", samples, HOURS
+    );
+
+    g_mkdir_with_parents (self->priv->state_dir, 0700);
+    filename = g_build_filename (self->priv->state_dir, STATE_FILE, NULL);
+    if (!g_key_file_save_to_file (key_file, filename, &error))
+        g_warning ("Can't save %s: %s", filename, error->message);
+}
+
+static void
+append_trace (DozeScheduler *self,
+              gint64         now,
+              gboolean       active)
+{
+    g_autofree char *filename = NULL;
+    GStatBuf stat_buf;
+    FILE *file;
+
+    if (self->priv->state_dir == NULL)
+        return;
+
+    filename = g_build_filename (self->priv->state_dir, TRACE_FILE, NULL);
+
+    /* Keep one previous trace around */
+    if (g_stat (filename, &stat_buf) == 0 && stat_buf.st_size > MAX_TRACE_SIZE) {
+        g_autofree char *old = g_strconcat (filename, ".old", NULL);
+
+        g_rename (filename, old);
+    }
+
+    file = g_fopen (filename, "a");
+    if (file == NULL)
+        return;
+
+    fprintf (file, "%" G_GINT64_FORMAT " %d\n", now, active);
+    fclose (file);
+}
+
+static void
+doze_scheduler_dispose (GObject *doze_scheduler)
+{
+    G_OBJECT_CLASS (doze_scheduler_parent_class)->dispose (doze_scheduler);
+}
+
+static void
+doze_scheduler_finalize (GObject *doze_scheduler)
+{
+    DozeScheduler *self = DOZE_SCHEDULER (doze_scheduler);
+
+    g_free (self->priv->state_dir);
+
+    G_OBJECT_CLASS (doze_scheduler_parent_class)->finalize (doze_scheduler);
+}
+
+static void
+doze_scheduler_class_init (DozeSchedulerClass *klass)
+{
+    GObjectClass *object_class;
+
+    object_class = G_OBJECT_CLASS (klass);
+    object_class->dispose = doze_scheduler_dispose;
+    object_class->finalize = doze_scheduler_finalize;
+}
+
+static void
+doze_scheduler_init (DozeScheduler *self)
+{
+    guint i;
+
+    self->priv = doze_scheduler_get_instance_private (self);
+
+    self->priv->state_dir = NULL;
+    self->priv->adaptive = TRUE;
+
+    for (i = 0; i < HOURS; i++) {
+        self->priv->activity[i] = ACTIVITY_NEUTRAL;
+        self->priv->samples[i] = 0;
+    }
+}
+
+/**
+ * doze_scheduler_new:
+ *
+ * Creates a new #DozeScheduler
+ *
+ * @param state_dir: (nullable): where learned state and activity trace
+ * are kept, NULL to not persist them
+ *
+ * Returns: (transfer full): a new #DozeScheduler
+ *
+ **/
+GObject *
+doze_scheduler_new (const char *state_dir)
+{
+    GObject *doze_scheduler;
+
+    doze_scheduler = g_object_new (TYPE_DOZE_SCHEDULER, NULL);
+
+    DOZE_SCHEDULER (doze_scheduler)->priv->state_dir = g_strdup (state_dir);
+    load_state (DOZE_SCHEDULER (doze_scheduler));
+
+    return doze_scheduler;
+}
+
+/**
+ * doze_scheduler_set_adaptive:
+ *
+ * Use learned activity or fixed windows
+ *
+ * @param #DozeScheduler
+ * @param adaptive: TRUE to use learned activity
+ */
+void
+doze_scheduler_set_adaptive (DozeScheduler *self,
+                             gboolean       adaptive)
+{
+    self->priv->adaptive = adaptive;
+}
+
+/**
+ * doze_scheduler_get_sleep:
+ *
+ * Get how long apps should stay frozen
+ *
+ * @param #DozeScheduler
+ * @param tier: current #DozeTier
+ * @param now: unix time in seconds
+ *
+ * Returns: sleep duration in seconds
+ */
+guint
+doze_scheduler_get_sleep (DozeScheduler *self,
+                          DozeTier       tier,
+                          gint64         now)
+{
+    gdouble factor = get_sleep_factor (get_activity (self, now));
+
+    return (guint) (base_sleep[tier] * factor + 0.5);
+}
+
+/**
+ * doze_scheduler_get_maintenance:
+ *
+ * Get how long apps should stay thawed. Busy hours get longer windows
+ * so pending messages can be fetched.
+ *
+ * @param #DozeScheduler
+ * @param tier: current #DozeTier
+ * @param now: unix time in seconds
+ *
+ * Returns: maintenance duration in seconds
+ */
+guint
+doze_scheduler_get_maintenance (DozeScheduler *self,
+                                DozeTier       tier,
+                                gint64         now)
+{
+    gdouble activity = get_activity (self, now);
+    gdouble factor = 0.5 + activity;
+
+    return MAX (MIN_MAINTENANCE, (guint) (base_maintenance[tier] * factor + 0.5));
+}
+
+/**
+ * doze_scheduler_record:
+ *
+ * Record if a maintenance window saw activity (network traffic,
+ * playback, ...)
+ *
+ * @param #DozeScheduler
+ * @param now: unix time in seconds
+ * @param active: TRUE if window was not idle
+ */
+void
+doze_scheduler_record (DozeScheduler *self,
+                       gint64         now,
+                       gboolean       active)
+{
+    guint hour = get_hour (now);
+    guint samples = self->priv->samples[hour];
+    /* Learn fast until we have enough samples */
+    gdouble alpha = MAX (ACTIVITY_ALPHA, 1.0 / (samples + 2));
+    gdouble value = active ? 1.0 : 0.0;
+
+    self->priv->activity[hour] += alpha * (value - self->priv->activity[hour]);
+    if (samples < G_MAXUINT)
+        self->priv->samples[hour]++;
+
+    save_state (self);
+    append_trace (self, now, active);
+}
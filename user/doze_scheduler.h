@@ -0,0 +1,67 @@
+/*
+ * Copyright Cedric Bellegarde <cedric.bellegarde@adishatz.org>
+ */
+
+#ifndef DOZE_SCHEDULER_H
+#define DOZE_SCHEDULER_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#define TYPE_DOZE_SCHEDULER \
+    (doze_scheduler_get_type ())
+#define DOZE_SCHEDULER(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST \
+    ((obj), TYPE_DOZE_SCHEDULER, DozeScheduler))
+#define DOZE_SCHEDULER_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_CAST \
+    ((cls), TYPE_DOZE_SCHEDULER, DozeSchedulerClass))
+#define IS_DOZE_SCHEDULER(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE \
+    ((obj), TYPE_DOZE_SCHEDULER))
+#define IS_DOZE_SCHEDULER_CLASS(cls) \
+    (G_TYPE_CHECK_CLASS_TYPE \
+    ((cls), TYPE_DOZE_SCHEDULER))
+#define DOZE_SCHEDULER_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS \
+    ((obj), TYPE_DOZE_SCHEDULER, DozeSchedulerClass))
+
+G_BEGIN_DECLS
+
+typedef enum {
+    DOZE_TIER_LIGHT,
+    DOZE_TIER_MEDIUM,
+    DOZE_TIER_FULL,
+    DOZE_TIER_LAST
+} DozeTier;
+
+typedef struct _DozeScheduler DozeScheduler;
+typedef struct _DozeSchedulerClass DozeSchedulerClass;
+typedef struct _DozeSchedulerPrivate DozeSchedulerPrivate;
+
+struct _DozeScheduler {
+    GObject parent;
+    DozeSchedulerPrivate *priv;
+};
+
+struct _DozeSchedulerClass {
+    GObjectClass parent_class;
+};
+
+GType           doze_scheduler_get_type        (void) G_GNUC_CONST;
+
+GObject*        doze_scheduler_new             (const char    *state_dir);
+void            doze_scheduler_set_adaptive    (DozeScheduler *doze_scheduler,
+                                                gboolean       adaptive);
+guint           doze_scheduler_get_sleep       (DozeScheduler *doze_scheduler,
+                                                DozeTier       tier,
+                                                gint64         now);
+guint           doze_scheduler_get_maintenance (DozeScheduler *doze_scheduler,
+                                                DozeTier       tier,
+                                                gint64         now);
+void            doze_scheduler_record          (DozeScheduler *doze_scheduler,
+                                                gint64         now,
+                                                gboolean       active);
+G_END_DECLS
+
+#endif
@@ -10,20 +10,37 @@
 #include <gio/gio.h>
 
 #include "bus.h"
+#include "doze_scheduler.h"
 #include "dozing.h"
 #include "mpris.h"
 #include "network_manager.h"
 #include "settings.h"
+#include "../common/cgroup.h"
 #include "../common/define.h"
+#include "../common/sched_shaper.h"
 #include "../common/utils.h"
 
 #define DOZING_PRE_SLEEP          60
-#define DOZING_LIGHT_SLEEP        300
-#define DOZING_LIGHT_MAINTENANCE  30
-#define DOZING_MEDIUM_SLEEP       600
-#define DOZING_MEDIUM_MAINTENANCE 50
-#define DOZING_FULL_SLEEP         1200
-#define DOZING_FULL_MAINTENANCE   80
+/* Milliseconds, apps left running after that are logged */
+#define DOZING_FREEZE_TIMEOUT     2000
+
+/* Apps are thawed by groups, spread over first third of window */
+#define DOZING_THAW_GROUP         2
+#define DOZING_THAW_INTERVAL      2000
+#define DOZING_THAW_MIN_INTERVAL  100
+
+/* Per app budget for a maintenance window */
+#define DOZING_BUDGET_CHECK       5
+#define DOZING_CPU_BUDGET         (2 * G_USEC_PER_SEC)
+#define DOZING_IO_BUDGET          (8 * 1024 * 1024)
+
+/* cpu.max quotas of apps not frozen, in µs per period */
+#define DOZING_CPU_PERIOD         100000
+#define DOZING_MEDIA_QUOTA        50000
+#define DOZING_EXEMPT_QUOTA       20000
+
+/* cpu.uclamp.max of exempt apps not playing media */
+#define DOZING_EXEMPT_UCLAMP      "20"
 
 enum DozingType {
     DOZING_LIGHT,
@@ -36,13 +53,52 @@ enum DozingType {
     DOZING_FULL
 };
 
+enum AppState {
+    APP_FROZEN,
+    APP_THAWED,
+    /* Over budget, stays frozen until next window */
+    APP_REFROZEN,
+    /* Blacklisted or playing media, left running */
+    APP_EXEMPT
+};
+
+struct App {
+    char *cgroup;
+    char *freeze;
+    char *cpu_stat;
+    char *io_stat;
+    char *cpu_max;
+    char *uclamp_max;
+    enum AppState state;
+    gboolean clamped;
+    /* cpu.max before throttling, NULL if not throttled */
+    char *default_cpu_max;
+    guint64 quota;
+    /* Usage when thawed */
+    guint64 cpu_usage;
+    guint64 io_bytes;
+};
+
 struct _DozingPrivate {
-    GList *apps;
+    /* Live app scopes, updated from apps_monitor */
+    GHashTable *apps; /* scope name: struct App */
+    GFileMonitor *apps_monitor;
+    char *apps_dir;
     NetworkManager *network_manager;
     Mpris *mpris;
+    DozeScheduler *doze_scheduler;
+    SchedShaper *sched_shaper;
 
     guint type;
     guint timeout_id;
+    guint thaw_id;
+    guint budget_id;
+
+    gboolean throttle;
+
+    /* Data used or apps active in last maintenance window */
+    gboolean phone_active;
+    GCancellable *cancellable;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -55,33 +111,174 @@ G_DEFINE_TYPE_WITH_CODE (
 static gboolean freeze_apps (Dozing *self);
 static gboolean unfreeze_apps (Dozing *self);
 
-static guint
-get_maintenance (Dozing *self)
+static void
+app_free (gpointer user_data)
+{
+    struct App *app = user_data;
+
+    /* Scope is gone, drop its cached fd */
+    forget_file (app->freeze);
+    forget_file (app->cpu_max);
+    forget_file (app->uclamp_max);
+
+    g_free (app->cgroup);
+    g_free (app->freeze);
+    g_free (app->cpu_stat);
+    g_free (app->io_stat);
+    g_free (app->cpu_max);
+    g_free (app->uclamp_max);
+    g_free (app->default_cpu_max);
+    g_free (app);
+}
+
+static guint64
+get_cpu_usage (struct App *app)
+{
+    g_autofree char *contents = NULL;
+    g_autofree char *path = get_root_path (app->cpu_stat);
+    g_auto (GStrv) lines = NULL;
+    guint i;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return 0;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        if (g_str_has_prefix (lines[i], "usage_usec "))
+            return g_ascii_strtoull (lines[i] + 11, NULL, 10);
+    }
+
+    return 0;
+}
+
+static guint64
+get_io_bytes (struct App *app)
+{
+    g_autofree char *contents = NULL;
+    g_autofree char *path = get_root_path (app->io_stat);
+    g_auto (GStrv) fields = NULL;
+    guint64 bytes = 0;
+    guint i;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return 0;
+
+    /* One "MAJ:MIN rbytes=X wbytes=Y rios=Z ..." line per device */
+    fields = g_strsplit_set (contents, " \n", -1);
+    for (i = 0; fields[i] != NULL; i++) {
+        if (g_str_has_prefix (fields[i], "rbytes="))
+            bytes += g_ascii_strtoull (fields[i] + 7, NULL, 10);
+        else if (g_str_has_prefix (fields[i], "wbytes="))
+            bytes += g_ascii_strtoull (fields[i] + 7, NULL, 10);
+    }
+
+    return bytes;
+}
+
+static void
+throttle_app (struct App *app,
+              guint64     quota)
+{
+    g_autofree char *value = NULL;
+
+    if (quota == app->quota)
+        return;
+
+    if (quota == 0) {
+        g_message ("Unthrottling %s", app->cgroup);
+        write_to_file (app->cpu_max, app->default_cpu_max);
+        g_clear_pointer (&app->default_cpu_max, g_free);
+        app->quota = 0;
+        return;
+    }
+
+    if (app->default_cpu_max == NULL) {
+        g_autofree char *path = get_root_path (app->cpu_max);
+
+        /* cpu controller not enabled on app slice */
+        if (!g_file_get_contents (path, &app->default_cpu_max, NULL, NULL))
+            return;
+        g_strchomp (app->default_cpu_max);
+    }
+
+    value = g_strdup_printf (
+        "%" G_GUINT64_FORMAT " %d", quota, DOZING_CPU_PERIOD
+    );
+    g_message ("Throttling %s: %s", app->cgroup, value);
+    write_to_file (app->cpu_max, value);
+    app->quota = quota;
+}
+
+static void
+clamp_app (struct App *app,
+           gboolean    clamp)
+{
+    if (clamp == app->clamped)
+        return;
+
+    /* Effective clamp is the lowest of scope and app slice ones */
+    if (write_to_file (app->uclamp_max, clamp ? DOZING_EXEMPT_UCLAMP : "max"))
+        app->clamped = clamp;
+}
+
+static void
+unthrottle_apps (Dozing *self)
+{
+    GHashTableIter iter;
+    struct App *app;
+
+    g_hash_table_iter_init (&iter, self->priv->apps);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+        throttle_app (app, 0);
+}
+
+static gboolean
+can_freeze (Dozing     *self,
+            struct App *app)
+{
+    return mpris_can_freeze (self->priv->mpris, app->freeze) &&
+        settings_can_freeze_app (settings_get_default (), app->freeze);
+}
+
+static DozeTier
+get_tier (Dozing *self)
 {
     if (self->priv->type < DOZING_MEDIUM)
-        return DOZING_LIGHT_MAINTENANCE;
+        return DOZE_TIER_LIGHT;
     else if (self->priv->type < DOZING_FULL)
-        return DOZING_MEDIUM_MAINTENANCE;
+        return DOZE_TIER_MEDIUM;
     else
-        return DOZING_FULL_MAINTENANCE;
+        return DOZE_TIER_FULL;
+}
+
+static gint64
+get_now (void)
+{
+    return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static guint
+get_maintenance (Dozing *self)
+{
+    return doze_scheduler_get_maintenance (
+        self->priv->doze_scheduler, get_tier (self), get_now ()
+    );
 }
 
 static guint
 get_sleep (Dozing *self)
 {
-    if (self->priv->type < DOZING_MEDIUM)
-        return DOZING_LIGHT_SLEEP;
-    else if (self->priv->type < DOZING_FULL)
-        return DOZING_MEDIUM_SLEEP;
-    else
-        return DOZING_FULL_SLEEP;
+    return doze_scheduler_get_sleep (
+        self->priv->doze_scheduler, get_tier (self), get_now ()
+    );
 }
 
 static void
-queue_next_freeze (Dozing *self)
+queue_next_freeze (Dozing *self,
+                   guint   maintenance)
 {
     self->priv->timeout_id = g_timeout_add_seconds (
-        get_maintenance (self),
+        maintenance,
         (GSourceFunc) freeze_apps,
         self
     );
@@ -90,34 +287,41 @@ queue_next_freeze (Dozing *self)
         self->priv->type += 1;
 }
 
-static gboolean
-freeze_apps (Dozing *self)
+static void
+on_apps_frozen (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
 {
+    g_autoptr (GError) error = NULL;
     Bus *bus = bus_get_default ();
-    const char *app;
-    gboolean data_used;
-    gboolean apps_active = FALSE;
+    Dozing *self;
 
-    network_manager_stop_modem_monitoring (self->priv->network_manager);
+    if (!cgroup_freeze_finish (res, &error)) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Apps not frozen: %s", error->message);
+    }
 
-    data_used = network_manager_data_used (self->priv->network_manager);
+    self = DOZING (user_data);
 
-    if (self->priv->apps != NULL) {
-        g_message("Freezing apps");
-        GFOREACH (self->priv->apps, app) {
-            if (!mpris_can_freeze (self->priv->mpris, app)) {
-                apps_active = TRUE;
-                continue;
-            }
-            if (settings_can_freeze_app (settings_get_default (), app))
-                write_to_file (app, "1");
-        }
-    }
+    /* Only apps exempt from freezing are left running */
+    sched_shaper_set_shape (self->priv->sched_shaper, SCHED_SHAPE_DEEP, NULL);
 
-    if (data_used || apps_active) {
+    /* First freeze follows screen off, not a maintenance window */
+    if (self->priv->type > DOZING_LIGHT)
+        doze_scheduler_record (
+            self->priv->doze_scheduler, get_now (), self->priv->phone_active
+        );
+
+    /* Apps are now frozen, nothing will wake the modem back */
+    if (self->priv->phone_active) {
         g_message ("Phone active: no modem suspend");
     } else {
         bus_set_value (bus, "suspend-modem", g_variant_new ("b", TRUE));
+        /* Before little cluster powersave, read once caps are applied */
+        bus_set_value (bus,
+                       "deep-doze",
+                       g_variant_new ("b", get_tier (self) == DOZE_TIER_FULL));
         bus_set_value (bus,
                        "little-cluster-powersave",
                        g_variant_new ("b", TRUE));
@@ -128,61 +332,284 @@ freeze_apps (Dozing *self)
         (GSourceFunc) unfreeze_apps,
         self
     );
+}
+
+static gboolean
+freeze_apps (Dozing *self)
+{
+    GHashTableIter iter;
+    struct App *app;
+    GList *cgroups = NULL;
+    gboolean apps_active = FALSE;
+
+    self->priv->timeout_id = 0;
+    g_clear_handle_id (&self->priv->thaw_id, g_source_remove);
+    g_clear_handle_id (&self->priv->budget_id, g_source_remove);
+
+    network_manager_stop_monitoring (self->priv->network_manager);
+
+    if (g_hash_table_size (self->priv->apps) != 0) {
+        g_message("Freezing apps");
+        g_hash_table_iter_init (&iter, self->priv->apps);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app)) {
+            guint64 quota = 0;
+            gboolean clamp = FALSE;
+
+            app->state = APP_EXEMPT;
+            if (!mpris_can_freeze (self->priv->mpris, app->freeze)) {
+                /* Must not underrun, keeps app slice shape */
+                apps_active = TRUE;
+                quota = DOZING_MEDIA_QUOTA;
+            } else if (settings_can_freeze_app (settings_get_default (),
+                                                app->freeze)) {
+                app->state = APP_FROZEN;
+                cgroups = g_list_prepend (cgroups, app->cgroup);
+            } else {
+                quota = DOZING_EXEMPT_QUOTA;
+                clamp = TRUE;
+            }
+
+            clamp_app (app, clamp);
+
+            /* Media may have stopped since last window */
+            throttle_app (app, self->priv->throttle ? quota : 0);
+        }
+    }
+
+    self->priv->phone_active = apps_active ||
+        network_manager_data_used (self->priv->network_manager);
+
+    cgroup_freeze_async (cgroups,
+                         TRUE,
+                         DOZING_FREEZE_TIMEOUT,
+                         self->priv->cancellable,
+                         on_apps_frozen,
+                         self);
+    g_list_free (cgroups);
 
     return FALSE;
 }
 
+static gboolean
+thaw_apps (Dozing *self)
+{
+    GHashTableIter iter;
+    struct App *app;
+    guint thawed = 0;
+
+    g_hash_table_iter_init (&iter, self->priv->apps);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app)) {
+        if (app->state != APP_FROZEN)
+            continue;
+
+        if (thawed == DOZING_THAW_GROUP)
+            return G_SOURCE_CONTINUE;
+
+        app->cpu_usage = get_cpu_usage (app);
+        app->io_bytes = get_io_bytes (app);
+        app->state = APP_THAWED;
+        write_to_file (app->freeze, "0");
+        thawed++;
+    }
+
+    self->priv->thaw_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+check_budgets (Dozing *self)
+{
+    GHashTableIter iter;
+    struct App *app;
+
+    g_hash_table_iter_init (&iter, self->priv->apps);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app)) {
+        guint64 cpu_usage;
+        guint64 io_bytes;
+
+        if (app->state != APP_THAWED || !can_freeze (self, app))
+            continue;
+
+        /* Counters restart if scope was recreated */
+        cpu_usage = get_cpu_usage (app);
+        cpu_usage = cpu_usage > app->cpu_usage ? cpu_usage - app->cpu_usage : 0;
+        io_bytes = get_io_bytes (app);
+        io_bytes = io_bytes > app->io_bytes ? io_bytes - app->io_bytes : 0;
+
+        if (cpu_usage > DOZING_CPU_BUDGET || io_bytes > DOZING_IO_BUDGET) {
+            g_message ("Refreezing %s: %" G_GUINT64_FORMAT " µs CPU, "
+                       "%" G_GUINT64_FORMAT " bytes IO",
+                       app->freeze, cpu_usage, io_bytes);
+            app->state = APP_REFROZEN;
+            write_to_file (app->freeze, "1");
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static guint
+count_frozen (Dozing *self)
+{
+    GHashTableIter iter;
+    struct App *app;
+    guint frozen = 0;
+
+    g_hash_table_iter_init (&iter, self->priv->apps);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+        if (app->state == APP_FROZEN)
+            frozen++;
+
+    return frozen;
+}
+
 static gboolean
 unfreeze_apps (Dozing *self)
 {
     Bus *bus = bus_get_default ();
-    const char *app;
+    guint maintenance;
+    guint frozen;
+    guint groups;
+    guint interval;
+
+    self->priv->timeout_id = 0;
 
+    /* Maintenance window: efficient frequencies instead of lowest */
     bus_set_value (bus, "suspend-modem", g_variant_new ("b", FALSE));
+    bus_set_value (bus, "little-cluster-powersave", g_variant_new ("b", FALSE));
+    bus_set_value (bus, "deep-doze", g_variant_new ("b", FALSE));
+    sched_shaper_set_shape (
+        self->priv->sched_shaper, SCHED_SHAPE_BACKGROUND, NULL
+    );
 
-    if (self->priv->apps == NULL)
+    maintenance = get_maintenance (self);
+
+    /* Apps may be started before next window, always keep cycling */
+    queue_next_freeze (self, maintenance);
+
+    /* Measure traffic of this maintenance window only */
+    network_manager_start_monitoring (self->priv->network_manager);
+
+    /* Exempt apps are running already, only stagger frozen ones */
+    frozen = count_frozen (self);
+    if (frozen == 0)
         return FALSE;
 
-    g_message("Unfreezing apps");
-    GFOREACH (self->priv->apps, app)
-        write_to_file (app, "0");
+    groups = (frozen + DOZING_THAW_GROUP - 1) / DOZING_THAW_GROUP;
+    interval = CLAMP (maintenance * 1000 / 3 / groups,
+                      DOZING_THAW_MIN_INTERVAL,
+                      DOZING_THAW_INTERVAL);
 
-    queue_next_freeze (self);
+    g_message("Unfreezing apps");
+    if (thaw_apps (self))
+        self->priv->thaw_id = g_timeout_add (
+            interval, (GSourceFunc) thaw_apps, self
+        );
+    self->priv->budget_id = g_timeout_add_seconds (
+        DOZING_BUDGET_CHECK, (GSourceFunc) check_budgets, self
+    );
 
     return FALSE;
 }
 
-static GList *
-get_apps (Dozing *self)
+static void
+add_app (Dozing     *self,
+         const char *scope)
 {
-    g_autoptr (GDir) sys_dir = NULL;
-    g_autofree char *dirname = g_strdup_printf(
-        CGROUPS_APPS_FREEZE_DIR, getuid(), getuid()
+    g_autofree char *freeze = NULL;
+    g_autofree char *path = NULL;
+    struct App *app;
 
+    if (!g_str_has_prefix (scope, "app-") || !g_str_has_suffix (scope, ".scope"))
+        return;
+
+    if (g_hash_table_contains (self->priv->apps, scope))
+        return;
+
+    freeze = g_build_filename (
+        self->priv->apps_dir, scope, "cgroup.freeze", NULL
+    );
+    path = get_root_path (freeze);
+    if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        return;
+
+    app = g_new0 (struct App, 1);
+    app->cgroup = g_build_filename (self->priv->apps_dir, scope, NULL);
+    app->freeze = g_steal_pointer (&freeze);
+    app->cpu_stat = g_build_filename (
+        self->priv->apps_dir, scope, "cpu.stat", NULL
     );
-    const char *app_dir;
-    GList *apps = NULL;
+    app->io_stat = g_build_filename (
+        self->priv->apps_dir, scope, "io.stat", NULL
+    );
+    app->cpu_max = g_build_filename (
+        self->priv->apps_dir, scope, "cpu.max", NULL
+    );
+    app->uclamp_max = g_build_filename (
+        self->priv->apps_dir, scope, "cpu.uclamp.max", NULL
+    );
+    /* Running until next freeze */
+    app->state = APP_THAWED;
 
-    sys_dir = g_dir_open (dirname, 0, NULL);
-    if (sys_dir == NULL) {
-        g_warning ("Can't find cgroups user app slice: %s", dirname);
-        return NULL;
-    }
+    g_hash_table_insert (self->priv->apps, g_strdup (scope), app);
+}
 
-    while ((app_dir = g_dir_read_name (sys_dir)) != NULL) {
-        if (g_str_has_prefix (app_dir, "app-") &&
-                g_str_has_suffix (app_dir, ".scope")) {
-            char *app = g_build_filename (
-                dirname, app_dir, "cgroup.freeze", NULL
-            );
+static void
+on_apps_changed (GFileMonitor      *monitor,
+                 GFile             *file,
+                 GFile             *other_file,
+                 GFileMonitorEvent  event_type,
+                 gpointer           user_data)
+{
+    Dozing *self = DOZING (user_data);
+    g_autofree char *scope = NULL;
+
+    if (event_type == G_FILE_MONITOR_EVENT_CREATED ||
+            event_type == G_FILE_MONITOR_EVENT_MOVED_IN) {
+        scope = g_file_get_basename (file);
+        add_app (self, scope);
+    } else if (event_type == G_FILE_MONITOR_EVENT_DELETED ||
+            event_type == G_FILE_MONITOR_EVENT_MOVED_OUT) {
+        scope = g_file_get_basename (file);
+        g_hash_table_remove (self->priv->apps, scope);
+    }
+}
 
-            if (!g_file_test (app, G_FILE_TEST_EXISTS))
-                continue;
+static void
+monitor_apps (Dozing *self)
+{
+    g_autoptr (GDir) sys_dir = NULL;
+    g_autoptr (GFile) file = NULL;
+    g_autoptr (GError) error = NULL;
+    g_autofree char *path = get_root_path (self->priv->apps_dir);
+    const char *scope;
+
+    /* Monitor first, scopes created while listing are not missed */
+    file = g_file_new_for_path (path);
+    self->priv->apps_monitor = g_file_monitor_directory (
+        file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error
+    );
+    if (self->priv->apps_monitor == NULL) {
+        g_warning ("Can't monitor cgroups user app slice: %s",
+                   error->message);
+    } else {
+        g_signal_connect (
+            self->priv->apps_monitor,
+            "changed",
+            G_CALLBACK (on_apps_changed),
+            self
+        );
+    }
 
-            apps = g_list_prepend (apps, app);
-        }
+    sys_dir = g_dir_open (path, 0, NULL);
+    if (sys_dir == NULL) {
+        g_warning ("Can't find cgroups user app slice: %s",
+                   self->priv->apps_dir);
+        return;
     }
-    return apps;
+
+    while ((scope = g_dir_read_name (sys_dir)) != NULL)
+        add_app (self, scope);
 }
 
 static void
@@ -190,8 +617,18 @@ dozing_dispose (GObject *dozing)
 {
     Dozing *self = DOZING (dozing);
 
+    g_clear_handle_id (&self->priv->timeout_id, g_source_remove);
+    g_clear_handle_id (&self->priv->thaw_id, g_source_remove);
+    g_clear_handle_id (&self->priv->budget_id, g_source_remove);
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    if (self->priv->apps_monitor != NULL)
+        g_signal_handlers_disconnect_by_data (self->priv->apps_monitor, self);
+    g_clear_object (&self->priv->apps_monitor);
     g_clear_object (&self->priv->network_manager);
     g_clear_object (&self->priv->mpris);
+    g_clear_object (&self->priv->doze_scheduler);
+    g_clear_object (&self->priv->sched_shaper);
 
     G_OBJECT_CLASS (dozing_parent_class)->dispose (dozing);
 }
@@ -201,7 +638,8 @@ dozing_finalize (GObject *dozing)
 {
     Dozing *self = DOZING (dozing);
 
-    g_list_free_full (self->priv->apps, g_free);
+    g_hash_table_destroy (self->priv->apps);
+    g_free (self->priv->apps_dir);
 
     G_OBJECT_CLASS (dozing_parent_class)->finalize (dozing);
 }
@@ -219,13 +657,35 @@ dozing_class_init (DozingClass *klass)
 static void
 dozing_init (Dozing *self)
 {
+    g_autofree char *state_dir = g_build_filename (
+        g_get_user_state_dir (), "mps", NULL
+    );
+
     self->priv = dozing_get_instance_private (self);
 
     self->priv->network_manager = NETWORK_MANAGER (network_manager_new ());
     self->priv->mpris = MPRIS (mpris_new ());
+    self->priv->doze_scheduler = DOZE_SCHEDULER (doze_scheduler_new (state_dir));
+    self->priv->sched_shaper = SCHED_SHAPER (
+        sched_shaper_new (G_BUS_TYPE_SESSION)
+    );
 
-    self->priv->apps = NULL;
+    self->priv->apps = g_hash_table_new_full (
+        g_str_hash, g_str_equal, g_free, app_free
+    );
+    self->priv->apps_monitor = NULL;
+    self->priv->apps_dir = g_strdup_printf (
+        CGROUPS_APPS_FREEZE_DIR, getuid (), getuid ()
+    );
     self->priv->type = DOZING_LIGHT;
+    self->priv->timeout_id = 0;
+    self->priv->thaw_id = 0;
+    self->priv->budget_id = 0;
+    self->priv->throttle = FALSE;
+    self->priv->phone_active = FALSE;
+    self->priv->cancellable = g_cancellable_new ();
+
+    monitor_apps (self);
 }
 
 /**
@@ -255,7 +715,9 @@ dozing_new (void)
  */
 void
 dozing_start (Dozing  *self) {
-    self->priv->apps = get_apps(self);
+    sched_shaper_set_shape (
+        self->priv->sched_shaper, SCHED_SHAPE_BACKGROUND, NULL
+    );
 
     self->priv->type = DOZING_LIGHT;
     self->priv->timeout_id = g_timeout_add_seconds (
@@ -264,7 +726,7 @@ dozing_start (Dozing  *self) {
         self
     );
 
-    network_manager_start_modem_monitoring (self->priv->network_manager);
+    network_manager_start_monitoring (self->priv->network_manager);
 }
 
 /**
@@ -277,16 +739,66 @@ dozing_start (Dozing  *self) {
 void
 dozing_stop (Dozing  *self) {
     Bus *bus = bus_get_default ();
-    const char *app;
+    GHashTableIter iter;
+    struct App *app;
 
     g_clear_handle_id (&self->priv->timeout_id, g_source_remove);
+    g_clear_handle_id (&self->priv->thaw_id, g_source_remove);
+    g_clear_handle_id (&self->priv->budget_id, g_source_remove);
+
+    /* Drop pending freeze */
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    self->priv->cancellable = g_cancellable_new ();
 
+    /* Apps are thawed uncapped */
+    sched_shaper_set_shape (self->priv->sched_shaper, SCHED_SHAPE_NONE, NULL);
+
+    /* Screen is on, do not stagger */
     g_message("Unfreezing apps");
-    GFOREACH (self->priv->apps, app)
-        write_to_file (app, "0");
+    g_hash_table_iter_init (&iter, self->priv->apps);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app)) {
+        app->state = APP_THAWED;
+        throttle_app (app, 0);
+        clamp_app (app, FALSE);
+        write_to_file (app->freeze, "0");
+    }
+
+    network_manager_stop_monitoring (self->priv->network_manager);
 
     bus_set_value (bus, "suspend-modem", g_variant_new ("b", FALSE));
+    bus_set_value (bus, "deep-doze", g_variant_new ("b", FALSE));
+}
+/**
+ * dozing_set_adaptive:
+ *
+ * Adapt sleep and maintenance windows to learned activity
+ *
+ * @param #Dozing
+ * @param adaptive: TRUE to adapt windows, FALSE for fixed windows
+ */
+void
+dozing_set_adaptive (Dozing   *self,
+                     gboolean  adaptive)
+{
+    doze_scheduler_set_adaptive (self->priv->doze_scheduler, adaptive);
+}
+
+/**
+ * dozing_set_throttle:
+ *
+ * Limit CPU time of apps not frozen while dozing
+ *
+ * @param #Dozing
+ * @param throttle: TRUE to throttle apps exempt from freezing
+ */
+void
+dozing_set_throttle (Dozing   *self,
+                     gboolean  throttle)
+{
+    self->priv->throttle = throttle;
 
-    g_list_free_full (self->priv->apps, g_free);
-    self->priv->apps = NULL;
-}
\ No newline at end of file
+    /* Next freeze will throttle apps */
+    if (!throttle)
+        unthrottle_apps (self);
+}
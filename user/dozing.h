@@ -46,6 +46,10 @@ GType           dozing_get_type            (void) G_GNUC_CONST;
 GObject*        dozing_new                 (void);
 void            dozing_start               (Dozing  *dozing);
 void            dozing_stop                (Dozing  *dozing);
+void            dozing_set_adaptive        (Dozing   *dozing,
+                                            gboolean  adaptive);
+void            dozing_set_throttle        (Dozing   *dozing,
+                                            gboolean  throttle);
 G_END_DECLS
 
 #endif
@@ -13,11 +13,17 @@
 #include "settings.h"
 #include "../common/services.h"
 
+/* Milliseconds */
+#define FREEZE_TIMEOUT 2000
+
 struct _ManagerPrivate {
     Dozing *dozing;
     Services *services;
 
     gboolean screen_off_power_saving;
+
+    guint unfreeze_services_id;
+    GCancellable *cancellable;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -40,9 +46,42 @@ on_setting_changed (Settings   *settings,
 
     if (g_strcmp0 (key, "screen-off-power-saving") == 0) {
         self->priv->screen_off_power_saving = g_variant_get_boolean (value);
+    } else if (g_strcmp0 (key, "screen-off-adaptive-dozing") == 0) {
+        dozing_set_adaptive (
+            self->priv->dozing, g_variant_get_boolean (value)
+        );
+    } else if (g_strcmp0 (key, "screen-off-throttle-apps") == 0) {
+        dozing_set_throttle (
+            self->priv->dozing, g_variant_get_boolean (value)
+        );
     }
 }
 
+static gboolean
+on_unfreeze_services (gpointer user_data)
+{
+    Manager *self = MANAGER (user_data);
+    GList *services = settings_get_suspend_services (settings_get_default ());
+
+    self->priv->unfreeze_services_id = 0;
+
+    services_unfreeze (self->priv->services, services, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_services_frozen (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    if (!services_freeze_finish (res, &error) &&
+            !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Services not frozen: %s", error->message);
+}
+
 static void
 on_screen_state_changed (Bus      *bus,
                          gboolean  screen_on,
@@ -50,14 +89,27 @@ on_screen_state_changed (Bus      *bus,
 {
     Manager *self = MANAGER (user_data);
 
+    g_clear_handle_id (&self->priv->unfreeze_services_id, g_source_remove);
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    self->priv->cancellable = g_cancellable_new ();
+
     if (self->priv->screen_off_power_saving) {
         GList *services = settings_get_suspend_services (settings_get_default ());
         if (screen_on) {
+            /* Apps first, services once pending events are dispatched */
             dozing_stop (self->priv->dozing);
-            services_unfreeze (self->priv->services, services);
+            self->priv->unfreeze_services_id = g_idle_add_full (
+                G_PRIORITY_LOW, on_unfreeze_services, self, NULL
+            );
         } else {
             dozing_start (self->priv->dozing);
-            services_freeze (self->priv->services, services);
+            services_freeze_async (self->priv->services,
+                                   services,
+                                   FREEZE_TIMEOUT,
+                                   self->priv->cancellable,
+                                   on_services_frozen,
+                                   NULL);
         }
     }
 }
@@ -67,6 +119,9 @@ manager_dispose (GObject *manager)
 {
     Manager *self = MANAGER (manager);
 
+    g_clear_handle_id (&self->priv->unfreeze_services_id, g_source_remove);
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
     g_clear_object (&self->priv->dozing);
     g_clear_object (&self->priv->services);
 
@@ -98,6 +153,8 @@ manager_init (Manager *self)
     self->priv->services = SERVICES (services_new (G_BUS_TYPE_SESSION));
 
     self->priv->screen_off_power_saving = TRUE;
+    self->priv->unfreeze_services_id = 0;
+    self->priv->cancellable = g_cancellable_new ();
 
     g_signal_connect (
         bus_get_default (),
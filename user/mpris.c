@@ -8,6 +8,8 @@
 #include "config.h"
 #include "mpris.h"
 #include "settings.h"
+#include "../common/matcher.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define DBUS_FREEDESKTOP_NAME           "org.freedesktop.DBus"
@@ -26,10 +28,20 @@ struct Player {
     gboolean    is_playing;
 };
 
+/* Player being looked up on the bus */
+struct PendingPlayer {
+    Mpris *mpris;
+    char  *name;
+    char  *desktop_id;
+};
+
 struct _MprisPrivate {
     GDBusProxy *dbus_proxy;
+    GCancellable *cancellable;
 
     GList *players;
+    /* Players desktop ids, in players order */
+    Matcher *desktop_ids;
 };
 
 G_DEFINE_TYPE_WITH_CODE (Mpris, mpris, G_TYPE_OBJECT,
@@ -61,6 +73,19 @@ clear_player (struct Player *player)
     g_free (player);
 }
 
+static void
+update_desktop_ids (Mpris *self)
+{
+    struct Player *player;
+    GList *desktop_ids = NULL;
+
+    GFOREACH (self->priv->players, player)
+        desktop_ids = g_list_append (desktop_ids, player->desktop_id);
+
+    matcher_set_patterns (self->priv->desktop_ids, desktop_ids);
+    g_list_free (desktop_ids);
+}
+
 static void
 on_player_proxy_properties (GDBusProxy  *proxy,
                             GVariant    *changed_properties,
@@ -84,45 +109,80 @@ on_player_proxy_properties (GDBusProxy  *proxy,
 }
 
 static void
-add_player (Mpris      *self,
-            const char *name,
-            const char *desktop_id)
+pending_player_free (struct PendingPlayer *pending)
+{
+    g_free (pending->name);
+    g_free (pending->desktop_id);
+    g_free (pending);
+}
+
+static gboolean
+has_player (Mpris      *self,
+            const char *name)
+{
+    struct Player *player;
+
+    GFOREACH (self->priv->players, player)
+        if (g_strcmp0 (player->name, name) == 0)
+            return TRUE;
+
+    return FALSE;
+}
+
+static void
+on_player_proxy (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
 {
+    struct PendingPlayer *pending = user_data;
+    g_autoptr (GError) error = NULL;
+    g_autofree char *owner = NULL;
     GDBusProxy *player_bus;
     struct Player *player;
     GVariant *value;
     gboolean is_playing;
+    Mpris *self;
 
-    if (!g_str_has_prefix (name, DBUS_MPRIS_PREFIX))
-        return;
+    player_bus = g_dbus_proxy_new_for_bus_finish (res, &error);
 
-    g_message ("Player added: %s", name);
+    if (player_bus == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get MPRIS player: %s", error->message);
+        pending_player_free (pending);
+        return;
+    }
 
-    player_bus = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SESSION,
-        0,
-        NULL,
-        name,
-        DBUS_MPRIS_PATH,
-        DBUS_MPRIS_PLAYER_INTERFACE,
-        NULL,
-        NULL
-    );
+    self = pending->mpris;
+    owner = g_dbus_proxy_get_name_owner (player_bus);
 
-    g_return_if_fail (player_bus != NULL);
+    /* Player left or was added while we were waiting */
+    if (owner == NULL || has_player (self, pending->name)) {
+        g_object_unref (player_bus);
+        pending_player_free (pending);
+        return;
+    }
 
     value = g_dbus_proxy_get_cached_property (
         player_bus, "PlaybackStatus"
     );
 
-    g_return_if_fail (value != NULL);
+    if (value == NULL) {
+        g_object_unref (player_bus);
+        pending_player_free (pending);
+        return;
+    }
+
+    g_message ("Player added: %s", pending->name);
 
     is_playing = g_strcmp0 (g_variant_get_string (value, NULL), "Playing") == 0;
     g_variant_unref (value);
 
-    player = get_player (player_bus, name, desktop_id, is_playing);
+    player = get_player (
+        player_bus, pending->name, pending->desktop_id, is_playing
+    );
 
     self->priv->players = g_list_append (self->priv->players, player);
+    update_desktop_ids (self);
 
     g_signal_connect (
         player_bus,
@@ -130,46 +190,84 @@ add_player (Mpris      *self,
         G_CALLBACK (on_player_proxy_properties),
         player
     );
+
+    pending_player_free (pending);
 }
 
 static void
-add_player_if_desktop_entry (Mpris      *self,
-                             const char *name)
+on_media_player_proxy (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
 {
-    g_autoptr (GDBusProxy) player = NULL;
+    struct PendingPlayer *pending = user_data;
+    g_autoptr (GDBusProxy) media_player = NULL;
     g_autoptr (GVariant) desktop_entry = NULL;
+    g_autoptr (GError) error = NULL;
     const char *desktop_id = NULL;
 
-    if (!g_str_has_prefix (name, DBUS_MPRIS_PREFIX))
+    media_player = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (media_player == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get MPRIS player: %s", error->message);
+        pending_player_free (pending);
+        return;
+    }
+
+    desktop_entry = g_dbus_proxy_get_cached_property (
+        media_player, "DesktopEntry"
+    );
+    if (desktop_entry == NULL)
+        desktop_entry = g_dbus_proxy_get_cached_property (
+            media_player, "Identity"
+        );
+    if (desktop_entry != NULL)
+        desktop_id = g_variant_get_string (desktop_entry, NULL);
+
+    if (desktop_id == NULL || strlen (desktop_id) == 0) {
+        pending_player_free (pending);
         return;
+    }
+
+    pending->desktop_id = g_strdup (desktop_id);
 
-    player = g_dbus_proxy_new_for_bus_sync (
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SESSION,
         0,
         NULL,
-        name,
+        pending->name,
         DBUS_MPRIS_PATH,
-        DBUS_MPRIS_INTERFACE,
-        NULL,
-        NULL
+        DBUS_MPRIS_PLAYER_INTERFACE,
+        pending->mpris->priv->cancellable,
+        on_player_proxy,
+        pending
     );
+}
 
-    g_return_if_fail (player != NULL);
+static void
+add_player_if_desktop_entry (Mpris      *self,
+                             const char *name)
+{
+    struct PendingPlayer *pending;
 
-    desktop_entry = g_dbus_proxy_get_cached_property (player, "DesktopEntry");
-    if (desktop_entry != NULL) {
-        desktop_id = g_variant_get_string (desktop_entry, NULL);
-        if (desktop_id != NULL && strlen (desktop_id) > 0)
-            add_player (self, name, desktop_id);
+    if (!g_str_has_prefix (name, DBUS_MPRIS_PREFIX))
         return;
-    }
 
-    desktop_entry = g_dbus_proxy_get_cached_property (player, "Identity");
-    if (desktop_entry != NULL) {
-        desktop_id = g_variant_get_string (desktop_entry, NULL);
-        if (desktop_id != NULL && strlen (desktop_id) > 0)
-            add_player (self, name, desktop_id);
-    }
+    pending = g_new0 (struct PendingPlayer, 1);
+    pending->mpris = self;
+    pending->name = g_strdup (name);
+
+    g_dbus_proxy_new_for_bus (
+        G_BUS_TYPE_SESSION,
+        0,
+        NULL,
+        name,
+        DBUS_MPRIS_PATH,
+        DBUS_MPRIS_INTERFACE,
+        self->priv->cancellable,
+        on_media_player_proxy,
+        pending
+    );
 }
 
 static void
@@ -189,37 +287,41 @@ del_player (Mpris      *self,
                 self->priv->players, player
             );
             clear_player (player);
+            update_desktop_ids (self);
             return;
         }
     }
 }
 
 static void
-add_players (Mpris *self)
+on_list_names (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
 {
     g_autoptr (GError) error = NULL;
     g_autoptr (GVariant) value = NULL;
-    g_autoptr (GVariantIter) iter;
+    g_autoptr (GVariantIter) iter = NULL;
     const char *player;
+    Mpris *self;
 
-    value = g_dbus_proxy_call_sync (
-        self->priv->dbus_proxy,
-        "ListNames",
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
 
-    if (error != NULL) {
+    if (value == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
         g_warning ("Can't get MPRIS players: %s", error->message);
+        trace_startup_release ("mpris");
         return;
     }
 
+    self = MPRIS (user_data);
+
+    /* Players are looked up in parallel */
     g_variant_get (value, "(as)", &iter);
     while (g_variant_iter_loop (iter, "&s", &player))
         add_player_if_desktop_entry(self, player);
+
+    trace_startup_release ("mpris");
 }
 
 static void
@@ -252,16 +354,63 @@ on_dbus_signal (GDBusProxy *proxy,
     }
 }
 
+static void
+on_dbus_proxy (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    Mpris *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't contact session bus: %s", error->message);
+        trace_startup_release ("mpris");
+        return;
+    }
+
+    self = MPRIS (user_data);
+    self->priv->dbus_proxy = proxy;
+
+    /* Connect first so we do not miss any player */
+    g_signal_connect (
+        self->priv->dbus_proxy,
+        "g-signal",
+        G_CALLBACK (on_dbus_signal),
+        self
+    );
+
+    g_dbus_proxy_call (
+        self->priv->dbus_proxy,
+        "ListNames",
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_list_names,
+        self
+    );
+}
+
 static void
 mpris_dispose (GObject *mpris)
 {
     Mpris *self = MPRIS (mpris);
     struct Player *player;
 
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+
     GFOREACH (self->priv->players, player)
         clear_player (player);
+    g_clear_pointer (&self->priv->players, g_list_free);
 
     g_clear_object (&self->priv->dbus_proxy);
+    g_clear_object (&self->priv->desktop_ids);
 
     G_OBJECT_CLASS (mpris_parent_class)->dispose (mpris);
 }
@@ -269,10 +418,6 @@ mpris_dispose (GObject *mpris)
 static void
 mpris_finalize (GObject *mpris)
 {
-    Mpris *self = MPRIS (mpris);
-
-    g_list_free (self->priv->players);
-
     G_OBJECT_CLASS (mpris_parent_class)->finalize (mpris);
 }
 
@@ -291,23 +436,22 @@ mpris_init (Mpris *self)
 {
     self->priv = mpris_get_instance_private (self);
 
-    self->priv->dbus_proxy = g_dbus_proxy_new_for_bus_sync (
+    self->priv->dbus_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->players = NULL;
+    self->priv->desktop_ids = MATCHER (matcher_new ());
+
+    trace_startup_hold ();
+
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SESSION,
         0,
         NULL,
         DBUS_FREEDESKTOP_NAME,
         DBUS_FREEDESKTOP_PATH,
         DBUS_FREEDESKTOP_INTERFACE,
-        NULL,
-        NULL
-    );
-
-    add_players (self);
-
-    g_signal_connect (
-        self->priv->dbus_proxy,
-        "g-signal",
-        G_CALLBACK (on_dbus_signal),
+        self->priv->cancellable,
+        on_dbus_proxy,
         self
     );
 }
@@ -348,11 +492,12 @@ mpris_can_freeze (Mpris      *self,
                   const char *app_scope)
 {
     struct Player *player;
+    gint index = matcher_lookup (self->priv->desktop_ids, app_scope);
 
-    GFOREACH (self->priv->players, player) {
-        if (g_strrstr (app_scope, player->desktop_id) != NULL)
-            return !player->is_playing;
-    }
-    return TRUE;
+    if (index == -1)
+        return TRUE;
+
+    player = g_list_nth_data (self->priv->players, index);
+    return !player->is_playing;
 }
 
@@ -4,33 +4,52 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <gio/gio.h>
 
 #include "network_manager.h"
+#include "../common/trace.h"
 #include "../common/utils.h"
 
 #define NETWORK_MANAGER_DBUS_NAME             "org.freedesktop.NetworkManager"
 #define NETWORK_MANAGER_DBUS_PATH             "/org/freedesktop/NetworkManager"
 #define NETWORK_MANAGER_DBUS_INTERFACE        "org.freedesktop.NetworkManager"
 #define NETWORK_MANAGER_DBUS_DEVICE_INTERFACE "org.freedesktop.NetworkManager.Device"
-#define DBUS_PROPERTIES_INTERFACE             "org.freedesktop.DBus.Properties"
 
-#define SYSDIR_PREFIX                         "/sys/class/net"
-#define SYSDIR_SUFFIX                         "statistics"
+#define NM_DEVICE_TYPE_WIFI                   2
+#define NM_DEVICE_TYPE_MODEM                  8
 
+#define SYSFS_NET_DIR                         "/sys/class/net"
+
+/* Bytes per second */
 #define MEDIUM_BANDWIDTH                      100000
+/* Seconds */
+#define SAMPLE_INTERVAL                       5
+/* Seconds, older samples weigh less and less */
+#define RATE_TIME_CONSTANT                    10
+
+struct Device {
+    GDBusProxy *proxy;
+    /* NULL while device has no IP interface */
+    char *interface;
+    /* Kept open, sysfs refreshes values on each read */
+    gint rx_fd;
+    gint tx_fd;
+    guint64 bytes;
+};
 
 struct _NetworkManagerPrivate {
     GDBusProxy *network_manager_proxy;
+    GCancellable *cancellable;
 
-    GList *modem_devices;
-
-    gint64 start_timestamp;
-    gint64 end_timestamp;
+    GList *devices; /* struct Device */
 
-    guint64  start_modem_rx;
-    guint64  end_modem_rx;
+    guint sample_id;
+    gint64 sample_time;
+    /* Bytes per second, exponentially weighted */
+    gdouble rate;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -40,139 +59,234 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (NetworkManager)
 )
 
+static gint
+open_counter (const char *interface,
+              const char *counter)
+{
+    g_autofree char *filename = g_build_filename (
+        SYSFS_NET_DIR, interface, "statistics", counter, NULL
+    );
+    g_autofree char *root_path = get_root_path (filename);
+
+    return open (root_path, O_RDONLY | O_CLOEXEC);
+}
+
+static guint64
+read_counter (gint fd)
+{
+    char buffer[32];
+    ssize_t len;
+
+    if (fd == -1)
+        return 0;
+
+    len = pread (fd, buffer, sizeof (buffer) - 1, 0);
+    if (len <= 0)
+        return 0;
+    buffer[len] = '\0';
+
+    return g_ascii_strtoull (buffer, NULL, 10);
+}
+
 static guint64
-get_bytes (NetworkManager *self,
-           const char     *path)
+device_get_bytes (struct Device *device)
 {
-    g_autofree char *contents = NULL;
+    return read_counter (device->rx_fd) + read_counter (device->tx_fd);
+}
 
-    if (g_file_get_contents (path, &contents, NULL, NULL))
-        return g_ascii_strtoll (contents, NULL, 0);
+static void
+device_close (struct Device *device)
+{
+    if (device->rx_fd != -1)
+        close (device->rx_fd);
+    if (device->tx_fd != -1)
+        close (device->tx_fd);
+    device->rx_fd = -1;
+    device->tx_fd = -1;
+    g_clear_pointer (&device->interface, g_free);
+}
 
-    return 0;
+static void
+device_free (struct Device *device)
+{
+    device_close (device);
+    g_signal_handlers_disconnect_by_data (device->proxy, device);
+    g_clear_object (&device->proxy);
+    g_free (device);
 }
 
-static char*
-get_hw_interface (NetworkManager *self,
-                  GDBusProxy     *network_device_proxy)
+/* Modem data interface comes and goes with connection */
+static void
+device_update_interface (struct Device *device)
 {
     g_autoptr (GVariant) value = NULL;
-    g_autoptr (GVariant) inner_value = NULL;
-    g_autoptr (GError) error = NULL;
-    char *interface;
+    const char *interface;
 
-    value = g_dbus_proxy_call_sync (
-        network_device_proxy,
-        "Get",
-        g_variant_new ("(ss)",
-                       NETWORK_MANAGER_DBUS_DEVICE_INTERFACE,
-                       "IpInterface"
-        ),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
+    value = g_dbus_proxy_get_cached_property (device->proxy, "IpInterface");
+
+    if (value == NULL) {
+        g_warning ("Can't read IpInterface");
+        device_close (device);
+        return;
+    }
+
+    interface = g_variant_get_string (value, NULL);
+    if (g_strcmp0 (interface, device->interface) == 0)
+        return;
+
+    device_close (device);
+
+    if (*interface == '\0')
+        return;
+
+    device->interface = g_strdup (interface);
+    device->rx_fd = open_counter (interface, "rx_bytes");
+    device->tx_fd = open_counter (interface, "tx_bytes");
+    device->bytes = device_get_bytes (device);
+
+    g_debug ("Network interface: %s", interface);
+}
+
+static void
+on_device_properties (GDBusProxy  *proxy,
+                      GVariant    *changed_properties,
+                      char       **invalidated_properties,
+                      gpointer     user_data)
+{
+    struct Device *device = user_data;
+    g_autoptr (GVariant) value = g_variant_lookup_value (
+        changed_properties, "IpInterface", NULL
     );
 
-    if (error != NULL) {
-        g_error (
-            "Can't read IpInterface: %s",
-            error->message
-        );
-        return NULL;
+    if (value != NULL)
+        device_update_interface (device);
+}
+
+static void
+sample (NetworkManager *self)
+{
+    struct Device *device;
+    gint64 now = g_get_monotonic_time ();
+    gint64 elapsed = now - self->priv->sample_time;
+    guint64 bytes = 0;
+    gdouble rate;
+    gdouble alpha;
+
+    GFOREACH (self->priv->devices, device) {
+        guint64 device_bytes = device_get_bytes (device);
+
+        /* Counters restart with interfaces */
+        if (device_bytes >= device->bytes)
+            bytes += device_bytes - device->bytes;
+        device->bytes = device_bytes;
     }
 
-    g_variant_get (value, "(v)", &inner_value);
-    g_variant_get (inner_value, "s", &interface);
+    if (elapsed <= 0)
+        return;
+
+    self->priv->sample_time = now;
 
-    return interface;
+    /* Weight follows elapsed time, a short last sample counts less */
+    rate = (gdouble) bytes * G_USEC_PER_SEC / elapsed;
+    alpha = (gdouble) elapsed / (elapsed + RATE_TIME_CONSTANT * G_USEC_PER_SEC);
+    self->priv->rate += alpha * (rate - self->priv->rate);
+}
+
+static gboolean
+on_sample (gpointer user_data)
+{
+    NetworkManager *self = NETWORK_MANAGER (user_data);
+
+    sample (self);
+
+    return G_SOURCE_CONTINUE;
 }
 
 static void
-add_device (NetworkManager *self,
-            const char     *device_path)
+on_device_proxy (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
 {
-    GDBusProxy *network_device_proxy = NULL;
-    g_autoptr (GVariant) value = NULL;
-    g_autoptr (GVariant) inner_value = NULL;
     g_autoptr (GError) error = NULL;
-    guint device_type;
+    g_autoptr (GVariant) value = NULL;
+    GDBusProxy *network_device_proxy;
+    NetworkManager *self;
+    struct Device *device;
 
-    network_device_proxy = g_dbus_proxy_new_for_bus_sync (
-        G_BUS_TYPE_SYSTEM,
-        0,
-        NULL,
-        NETWORK_MANAGER_DBUS_NAME,
-        device_path,
-        DBUS_PROPERTIES_INTERFACE,
-        NULL,
-        &error
-    );
+    network_device_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
 
-    if (error != NULL) {
-        g_error("Can't get network device: %s", error->message);
+    if (network_device_proxy == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("Can't get network device: %s", error->message);
         return;
     }
 
-    value = g_dbus_proxy_call_sync (
-        network_device_proxy,
-        "Get",
-        g_variant_new ("(ss)",
-                       NETWORK_MANAGER_DBUS_DEVICE_INTERFACE,
-                       "DeviceType"
-        ),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
+    self = NETWORK_MANAGER (user_data);
+
+    value = g_dbus_proxy_get_cached_property (
+        network_device_proxy, "DeviceType"
     );
 
-    if (error != NULL) {
-        g_error (
-            "Can't read DeviceType: %s",
-            error->message
-        );
+    if (value == NULL || (
+            g_variant_get_uint32 (value) != NM_DEVICE_TYPE_MODEM &&
+            g_variant_get_uint32 (value) != NM_DEVICE_TYPE_WIFI)) {
         g_clear_object (&network_device_proxy);
         return;
     }
 
-    g_variant_get (value, "(v)", &inner_value);
-    g_variant_get (inner_value, "u", &device_type);
+    device = g_new0 (struct Device, 1);
+    device->proxy = network_device_proxy;
+    device->rx_fd = -1;
+    device->tx_fd = -1;
+    device_update_interface (device);
 
-    if (device_type == 8) { /* NM_DEVICE_TYPE_MODEM */
-        self->priv->modem_devices = g_list_append (
-            self->priv->modem_devices, network_device_proxy
-        );
-    } else {
-        g_clear_object (&network_device_proxy);
-    }
+    self->priv->devices = g_list_append (self->priv->devices, device);
+
+    g_signal_connect (
+        network_device_proxy,
+        "g-properties-changed",
+        G_CALLBACK (on_device_properties),
+        device
+    );
 }
 
 static void
-del_device_from_list (NetworkManager *self,
-                      const char     *device_path,
-                      GList          *list)
+add_device (NetworkManager *self,
+            const char     *device_path)
 {
-    GDBusProxy *network_device_proxy;
+    g_dbus_proxy_new_for_bus (
+        G_BUS_TYPE_SYSTEM,
+        0,
+        NULL,
+        NETWORK_MANAGER_DBUS_NAME,
+        device_path,
+        NETWORK_MANAGER_DBUS_DEVICE_INTERFACE,
+        self->priv->cancellable,
+        on_device_proxy,
+        self
+    );
+}
+
+static void
+del_device (NetworkManager *self,
+            const char     *device_path)
+{
+    struct Device *device;
 
-    GFOREACH (list, network_device_proxy) {
+    GFOREACH (self->priv->devices, device) {
         const char *object_path = g_dbus_proxy_get_object_path (
-            network_device_proxy
+            device->proxy
         );
         if (g_strcmp0 (object_path, device_path) == 0) {
-            list = g_list_remove (list, network_device_proxy);
+            self->priv->devices = g_list_remove (
+                self->priv->devices, device
+            );
+            device_free (device);
             break;
         }
     }
 }
 
-static void
-del_device (NetworkManager *self,
-            const char     *device_path)
-{
-    del_device_from_list (self, device_path, self->priv->modem_devices);
-}
-
 static void
 on_network_manager_proxy_signal (GDBusProxy *proxy,
                                  const char *sender_name,
@@ -192,11 +306,90 @@ on_network_manager_proxy_signal (GDBusProxy *proxy,
     }
 }
 
+static void
+on_get_devices (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    g_autoptr (GVariantIter) iter = NULL;
+    g_autoptr (GVariant) value = NULL;
+    g_autoptr (GError) error = NULL;
+    const char *device_path = NULL;
+    NetworkManager *self;
+
+    value = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+    if (value == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't get network devices: %s", error->message);
+        trace_startup_release ("network-manager");
+        return;
+    }
+
+    self = NETWORK_MANAGER (user_data);
+
+    /* Devices are looked up in parallel */
+    g_variant_get (value, "(ao)", &iter);
+    while (g_variant_iter_loop (iter, "&o", &device_path, NULL)) {
+        add_device (self, device_path);
+    }
+
+    trace_startup_release ("network-manager");
+}
+
+static void
+on_network_manager_proxy (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GDBusProxy *proxy;
+    NetworkManager *self;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+    if (proxy == NULL) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        g_warning ("Can't contact NetworkManager: %s", error->message);
+        trace_startup_release ("network-manager");
+        return;
+    }
+
+    self = NETWORK_MANAGER (user_data);
+    self->priv->network_manager_proxy = proxy;
+
+    g_signal_connect (
+        self->priv->network_manager_proxy,
+        "g-signal",
+        G_CALLBACK (on_network_manager_proxy_signal),
+        self
+    );
+
+    g_dbus_proxy_call (
+        self->priv->network_manager_proxy,
+        "GetDevices",
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        self->priv->cancellable,
+        on_get_devices,
+        self
+    );
+}
+
 static void
 network_manager_dispose (GObject *network_manager)
 {
     NetworkManager *self = NETWORK_MANAGER (network_manager);
 
+    g_cancellable_cancel (self->priv->cancellable);
+    g_clear_object (&self->priv->cancellable);
+    g_clear_handle_id (&self->priv->sample_id, g_source_remove);
+    g_list_free_full (
+        g_steal_pointer (&self->priv->devices), (GDestroyNotify) device_free
+    );
     g_clear_object (&self->priv->network_manager_proxy);
 
     G_OBJECT_CLASS (network_manager_parent_class)->dispose (network_manager);
@@ -205,10 +398,6 @@ network_manager_dispose (GObject *network_manager)
 static void
 network_manager_finalize (GObject *network_manager)
 {
-    NetworkManager *self = NETWORK_MANAGER (network_manager);
-
-    g_list_free (self->priv->modem_devices);
-
     G_OBJECT_CLASS (network_manager_parent_class)->finalize (network_manager);
 }
 
@@ -225,56 +414,27 @@ network_manager_class_init (NetworkManagerClass *klass)
 static void
 network_manager_init (NetworkManager *self)
 {
-    g_autoptr (GVariantIter) iter = NULL;
-    g_autoptr (GVariant) value = NULL;
-    g_autoptr (GError) error = NULL;
-    const char *device_path = NULL;
-
     self->priv = network_manager_get_instance_private (self);
-    self->priv->modem_devices = NULL;
+    self->priv->network_manager_proxy = NULL;
+    self->priv->cancellable = g_cancellable_new ();
+    self->priv->devices = NULL;
+    self->priv->sample_id = 0;
+    self->priv->sample_time = 0;
+    self->priv->rate = 0;
+
+    trace_startup_hold ();
 
-    self->priv->network_manager_proxy = g_dbus_proxy_new_for_bus_sync (
+    g_dbus_proxy_new_for_bus (
         G_BUS_TYPE_SYSTEM,
         0,
         NULL,
         NETWORK_MANAGER_DBUS_NAME,
         NETWORK_MANAGER_DBUS_PATH,
         NETWORK_MANAGER_DBUS_INTERFACE,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_error("Can't contact NetworkManager: %s", error->message);
-        return;
-    }
-
-    g_signal_connect (
-        self->priv->network_manager_proxy,
-        "g-signal",
-        G_CALLBACK (on_network_manager_proxy_signal),
+        self->priv->cancellable,
+        on_network_manager_proxy,
         self
     );
-
-    value = g_dbus_proxy_call_sync (
-        self->priv->network_manager_proxy,
-        "GetDevices",
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
-
-    if (error != NULL) {
-        g_warning ("Can't get network devices: %s", error->message);
-        return;
-    }
-
-    g_variant_get (value, "(ao)", &iter);
-    while (g_variant_iter_loop (iter, "&o", &device_path, NULL)) {
-        add_device (self, device_path);
-    }
 }
 
 /**
@@ -296,85 +456,61 @@ network_manager_new (void)
 }
 
 /**
- * network_manager_start_modem_monitoring:
+ * network_manager_start_monitoring:
  *
- * Start monitoring modem
+ * Start sampling modem and WiFi traffic
  *
  * @param #NetworkManager
  *
  */
 void
-network_manager_start_modem_monitoring (NetworkManager *self)
+network_manager_start_monitoring (NetworkManager *self)
 {
-    GDBusProxy *network_device_proxy;
+    struct Device *device;
 
-    self->priv->start_modem_rx = 0;
-    self->priv->start_timestamp = g_get_monotonic_time();
+    g_clear_handle_id (&self->priv->sample_id, g_source_remove);
 
-    GFOREACH (self->priv->modem_devices, network_device_proxy) {
-        g_autofree char *interface = get_hw_interface (self, network_device_proxy);
-        g_autofree char *filename = g_build_filename (
-            SYSDIR_PREFIX, interface, SYSDIR_SUFFIX, "rx_bytes", NULL
-        );
+    GFOREACH (self->priv->devices, device)
+        device->bytes = device_get_bytes (device);
 
-        self->priv->start_modem_rx += get_bytes (self, filename);
-    }
+    self->priv->rate = 0;
+    self->priv->sample_time = g_get_monotonic_time ();
+    self->priv->sample_id = g_timeout_add_seconds (
+        SAMPLE_INTERVAL, on_sample, self
+    );
 }
 
 /**
- * network_manager_stop_modem_monitoring:
+ * network_manager_stop_monitoring:
  *
- * Stop monitoring modem
+ * Stop sampling modem and WiFi traffic
  *
  * @param #NetworkManager
  *
  */
 void
-network_manager_stop_modem_monitoring  (NetworkManager *self)
+network_manager_stop_monitoring (NetworkManager *self)
 {
-    GDBusProxy *network_device_proxy;
-
-    self->priv->end_modem_rx = 0;
-    self->priv->end_timestamp = g_get_monotonic_time();
-
-    GFOREACH (self->priv->modem_devices, network_device_proxy) {
-        g_autofree char *interface = NULL;
-        g_autofree char *filename = NULL;
-
-        interface = get_hw_interface (self, network_device_proxy);
-
-        if (interface == NULL)
-            continue;
-
-        filename = g_build_filename (
-            SYSDIR_PREFIX, interface, SYSDIR_SUFFIX, "rx_bytes", NULL
-        );
+    if (self->priv->sample_id == 0)
+        return;
 
-        self->priv->end_modem_rx += get_bytes (self, filename);
-    }
+    g_clear_handle_id (&self->priv->sample_id, g_source_remove);
+    sample (self);
 }
 
 /**
  * network_manager_data_used:
  *
- * Get network data usage
+ * Get network data usage, recent traffic weighs more
  *
  * @param #NetworkManager
  *
- * Returns: TRUE if date in use
+ * Returns: TRUE if data in use
  */
 gboolean
 network_manager_data_used (NetworkManager *self)
 {
-    guint64 bandwidth_modem = (
-        (self->priv->end_modem_rx - self->priv->start_modem_rx) *
-        1000000 /
-        (self->priv->end_timestamp - self->priv->start_timestamp)
-    );
+    g_debug ("Network bandwidth: %.0f", self->priv->rate);
 
-    g_debug (
-        "Network bandwidth: modem: %" G_GUINT64_FORMAT, bandwidth_modem
-    );
-
-    return bandwidth_modem > MEDIUM_BANDWIDTH;
-}
\ No newline at end of file
+    return self->priv->rate > MEDIUM_BANDWIDTH;
+}
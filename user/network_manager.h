@@ -47,12 +47,12 @@ struct _NetworkManagerClass {
     GObjectClass parent_class;
 };
 
-GType           network_manager_get_type               (void) G_GNUC_CONST;
+GType           network_manager_get_type         (void) G_GNUC_CONST;
 
-GObject*        network_manager_new                    (void);
-void            network_manager_start_modem_monitoring (NetworkManager *self);
-void            network_manager_stop_modem_monitoring  (NetworkManager *self);
-gboolean        network_manager_data_used              (NetworkManager *self);
+GObject*        network_manager_new              (void);
+void            network_manager_start_monitoring (NetworkManager *self);
+void            network_manager_stop_monitoring  (NetworkManager *self);
+gboolean        network_manager_data_used        (NetworkManager *self);
 G_END_DECLS
 
 #endif
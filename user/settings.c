@@ -7,6 +7,7 @@
 #include "bus.h"
 #include "config.h"
 #include "settings.h"
+#include "../common/matcher.h"
 
 /* signals */
 enum
@@ -19,6 +20,8 @@ static guint signals[LAST_SIGNAL];
 
 struct _SettingsPrivate {
     GSettings *settings;
+
+    Matcher *apps_blacklist;
 };
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -28,6 +31,23 @@ G_DEFINE_TYPE_WITH_CODE (
     G_ADD_PRIVATE (Settings)
 )
 
+static void
+update_apps_blacklist (Settings *self,
+                       GVariant *value)
+{
+    g_autoptr (GVariantIter) iter;
+    const char *application;
+    GList *applications = NULL;
+
+    g_variant_get (value, "as", &iter);
+    while (g_variant_iter_loop (iter, "s", &application)) {
+        applications = g_list_append (applications, g_strdup (application));
+    }
+
+    matcher_set_patterns (self->priv->apps_blacklist, applications);
+    g_list_free_full (applications, g_free);
+}
+
 static void
 on_setting_changed (GSettings  *settings,
                     const char *key,
@@ -36,6 +56,9 @@ on_setting_changed (GSettings  *settings,
     Settings *self = SETTINGS (user_data);
     g_autoptr (GVariant) value = g_settings_get_value (settings, key);
 
+    if (g_strcmp0 (key, "screen-off-suspend-apps-blacklist") == 0)
+        update_apps_blacklist (self, value);
+
     g_signal_emit(
         self,
         signals[SETTING_CHANGED],
@@ -72,6 +95,7 @@ settings_dispose (GObject *settings)
     Settings *self = SETTINGS (settings);
 
     g_clear_object (&self->priv->settings);
+    g_clear_object (&self->priv->apps_blacklist);
 
     G_OBJECT_CLASS (settings_parent_class)->dispose (settings);
 }
@@ -107,9 +131,17 @@ settings_class_init (SettingsClass *klass)
 static void
 settings_init (Settings *self)
 {
+    g_autoptr (GVariant) value = NULL;
+
     self->priv = settings_get_instance_private (self);
 
     self->priv->settings = g_settings_new (APP_ID);
+    self->priv->apps_blacklist = MATCHER (matcher_new ());
+
+    value = g_settings_get_value (
+        self->priv->settings, "screen-off-suspend-apps-blacklist"
+    );
+    update_apps_blacklist (self, value);
 
     g_signal_connect (
         self->priv->settings,
@@ -185,18 +217,7 @@ gboolean
 settings_can_freeze_app (Settings   *self,
                          const char *app_scope)
 {
-    g_autoptr (GVariant) value = g_settings_get_value (
-        self->priv->settings, "screen-off-suspend-apps-blacklist"
-    );
-    g_autoptr (GVariantIter) iter;
-    const char *application;
-
-    g_variant_get (value, "as", &iter);
-    while (g_variant_iter_loop (iter, "s", &application)) {
-        if (g_strrstr (app_scope, application) != NULL)
-            return FALSE;
-    }
-    return TRUE;
+    return !matcher_match (self->priv->apps_blacklist, app_scope);
 }
 
 /**